@@ -0,0 +1,238 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+
+// Benchmark for the device scan: Creates a synthetic sysfs and device node tree and reports wall
+// time, system calls and memory allocations of full scans, cached rescans and single device scans.
+
+#include "devicescan.h"
+#include "synthetictree.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+#include <linux/input.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// -------------------------------------------------------------------------------------------------
+// Count all heap allocations, including the ones from within Qt, by wrapping the glibc allocator.
+namespace {
+  std::atomic<uint64_t> allocationCount{0};
+}
+
+extern "C" {
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t count, size_t size);
+  void* __libc_realloc(void* ptr, size_t size);
+
+  void* malloc(size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+  }
+
+  void* calloc(size_t count, size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+  }
+
+  void* realloc(void* ptr, size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+  }
+}
+
+namespace {
+  // -----------------------------------------------------------------------------------------------
+  /// Counts system calls of the process with the raw_syscalls:sys_enter tracepoint. If perf events
+  /// are not permitted, read and write system calls from /proc/self/io are counted instead.
+  class SyscallCounter
+  {
+  public:
+    SyscallCounter()
+    {
+      for (const char* path : { "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                                "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id" })
+      {
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly)) continue;
+
+        struct perf_event_attr attr{};
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = f.readAll().trimmed().toULongLong();
+        attr.disabled = 1;
+        m_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (m_fd >= 0) break;
+      }
+      if (m_fd >= 0) ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    ~SyscallCounter() {
+      if (m_fd >= 0) ::close(m_fd);
+    }
+
+    const char* description() const {
+      return (m_fd >= 0) ? "system calls" : "read/write system calls";
+    }
+
+    uint64_t count() const
+    {
+      uint64_t value = 0;
+      if (m_fd >= 0) {
+        return (::read(m_fd, &value, sizeof(value)) == sizeof(value)) ? value : 0;
+      }
+
+      // Fallback: read and write system calls from /proc/self/io
+      if (FILE* f = fopen("/proc/self/io", "r"))
+      {
+        char key[32];
+        unsigned long long n = 0;
+        while (fscanf(f, "%31s %llu", key, &n) == 2) {
+          if (std::strcmp(key, "syscr:") == 0 || std::strcmp(key, "syscw:") == 0) value += n;
+        }
+        fclose(f);
+      }
+      return value;
+    }
+
+  private:
+    int m_fd = -1;
+  };
+
+  struct Measurement {
+    double wallUsec = 0;
+    double syscalls = 0;
+    double allocations = 0;
+  };
+
+  // -----------------------------------------------------------------------------------------------
+  // Average wall time, system calls and allocations of the timed function over all iterations. The
+  // optional prepare function is called before each iteration and not measured.
+  Measurement measure(int iterations, const SyscallCounter& syscalls, const std::function<void()>& func,
+                      const std::function<void()>& prepare = {})
+  {
+    QElapsedTimer timer;
+    qint64 nsecs = 0;
+    uint64_t syscallCount = 0;
+    uint64_t allocations = 0;
+
+    for (int i = 0; i < iterations; ++i)
+    {
+      if (prepare) prepare();
+      const auto syscallsBefore = syscalls.count();
+      const auto allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+      timer.start();
+      func();
+      nsecs += timer.nsecsElapsed();
+      allocations += allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+      syscallCount += syscalls.count() - syscallsBefore;
+    }
+
+    return Measurement{ nsecs / 1000.0 / iterations, static_cast<double>(syscallCount) / iterations,
+                        static_cast<double>(allocations) / iterations };
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  void print(const char* name, const Measurement& m, int hidDevices)
+  {
+    std::printf("%-22s %12.1f %12.1f %12.2f %12.1f %12.2f\n", name, m.wallUsec,
+                m.syscalls, m.syscalls / hidDevices, m.allocations, m.allocations / hidDevices);
+  }
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Benchmark the device scan with a synthetic device tree.");
+  parser.addHelpOption();
+  const QCommandLineOption keyboardsOption("keyboards", "Number of unrelated keyboards.", "N", "500");
+  const QCommandLineOption usbOption("usb-spotlights", "Number of USB Spotlight devices.", "N", "1");
+  const QCommandLineOption btOption("bt-spotlights", "Number of Bluetooth Spotlight devices.", "N", "1");
+  const QCommandLineOption devicesConfOption("devices-conf", "Extra devices configuration file.",
+                                             "file", PROJECTEUR_DEVICES_CONF);
+  const QCommandLineOption noExtraDevicesOption("no-extra-devices", "Do not add devices from devices.conf.");
+  const QCommandLineOption iterationsOption("iterations", "Number of iterations per measurement.", "N", "20");
+  parser.addOptions({keyboardsOption, usbOption, btOption, devicesConfOption, noExtraDevicesOption,
+                     iterationsOption});
+  parser.process(app);
+
+  SyntheticDeviceTree::Options options;
+  options.keyboards = parser.value(keyboardsOption).toInt();
+  options.usbSpotlights = parser.value(usbOption).toInt();
+  options.bluetoothSpotlights = parser.value(btOption).toInt();
+  if (!parser.isSet(noExtraDevicesOption)) options.devicesConf = parser.value(devicesConfOption);
+  const int iterations = std::max(1, parser.value(iterationsOption).toInt());
+
+  QTemporaryDir tmpDir;
+  SyntheticDeviceTree tree(tmpDir.path());
+  if (!tmpDir.isValid() || !tree.create(options) || tree.hidDeviceCount() == 0) {
+    std::cerr << "Cannot create synthetic device tree." << std::endl;
+    return 1;
+  }
+
+  // Devices from the given devices.conf are passed as additional devices, like with the
+  // '--additional-device' command line option.
+  const auto additionalDevices = options.devicesConf.isEmpty()
+                                 ? std::vector<SupportedDevice>()
+                                 : SyntheticDeviceTree::readDevicesConf(options.devicesConf);
+  const auto roots = tree.roots();
+  const auto scanResult = DeviceScan::getDevices(additionalDevices, roots);
+  std::printf("HID devices: %d, supported devices: %d, found: %zu, iterations: %d\n\n",
+              tree.hidDeviceCount(), tree.supportedDeviceCount(), scanResult.devices.size(), iterations);
+  if (static_cast<int>(scanResult.devices.size()) != tree.supportedDeviceCount()) {
+    std::cerr << "Unexpected number of devices found." << std::endl;
+    return 1;
+  }
+
+  const SyscallCounter syscalls;
+  std::printf("%-22s %12s %12s %12s %12s %12s\n", "", "wall (us)", "syscalls", "per device",
+              "allocations", "per device");
+
+  print("full scan", measure(iterations, syscalls, [&additionalDevices, &roots]() {
+    DeviceScan::getDevices(additionalDevices, roots);
+  }), tree.hidDeviceCount());
+
+  DeviceScan::ScanCache cache(roots);
+  cache.getDevices(additionalDevices);
+  print("cached rescan", measure(iterations, syscalls, [&cache, &additionalDevices]() {
+    cache.getDevices(additionalDevices);
+  }), tree.hidDeviceCount());
+
+  // One unrelated keyboard appears and one disappears before each rescan.
+  QString addedKeyboard;
+  print("rescan with changes", measure(iterations, syscalls, [&cache, &additionalDevices]() {
+    cache.getDevices(additionalDevices);
+  }, [&tree, &addedKeyboard]() {
+    if (!addedKeyboard.isEmpty()) tree.removeHidDevice(addedKeyboard);
+    addedKeyboard = tree.addHidDevice(BUS_USB, 0xfeed, 0x0001, "Hotplugged Keyboard",
+                                      "usb-0000:00:1d.0-1/input0", SyntheticDeviceTree::SubDevices{true, false, true});
+  }), tree.hidDeviceCount());
+
+  if (!tree.supportedEventPaths().isEmpty())
+  {
+    const auto eventPath = tree.supportedEventPaths().first();
+    print("single device scan", measure(iterations, syscalls, [&eventPath, &additionalDevices, &roots]() {
+      DeviceScan::getDevice(eventPath, additionalDevices, roots);
+    }), 1);
+  }
+
+  std::printf("\nSystem calls: %s. Cache: scans=%u added=%u changed=%u removed=%u hits=%u negative-hits=%u\n",
+              syscalls.description(), cache.statistics().scans, cache.statistics().added,
+              cache.statistics().changed, cache.statistics().removed, cache.statistics().hits,
+              cache.statistics().negativeHits);
+  return 0;
+}
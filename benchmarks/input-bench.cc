@@ -0,0 +1,353 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+
+// Benchmark for the input pipeline: Feeds synthetic device frames through the InputMapper into a
+// virtual device that writes to a memfd instead of /dev/uinput, and reports per-operation times of
+// feeding, reconfiguring, (de)serializing and storing input mappings and emitting events. With '--format json'
+// the results are written in a machine-readable form to track regressions.
+
+#include "deviceinput.h"
+#include "inputmapstore.h"
+#include "virtualdevice.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <linux/input.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+  // Key codes used for the generated input mappings, the key codes of the feed benchmarks are
+  // outside of this range.
+  constexpr uint16_t firstConfigKey = KEY_ESC;
+  constexpr uint16_t numConfigKeys = 64;
+  constexpr uint16_t mappedKey = KEY_PAGEDOWN;
+  constexpr uint16_t unmappedKey = KEY_PAGEUP;
+
+  struct Result
+  {
+    QString name;
+    size_t iterations = 0;
+    double meanNsecs = 0;
+    double p50Nsecs = 0;
+    double p99Nsecs = 0;
+    double maxNsecs = 0;
+    double itemsPerSecond = 0; // items, e.g. events or mappings, processed per second
+  };
+
+  // -----------------------------------------------------------------------------------------------
+  // Times each call of func(i) separately. The optional prepare function is called before each
+  // iteration and not measured.
+  Result measure(const QString& name, size_t iterations, size_t itemsPerIteration,
+                 const std::function<void(size_t)>& func, const std::function<void()>& prepare = {})
+  {
+    std::vector<qint64> samples;
+    samples.reserve(iterations);
+
+    QElapsedTimer timer;
+    for (size_t i = 0; i < iterations; ++i)
+    {
+      if (prepare) prepare();
+      timer.start();
+      func(i);
+      samples.push_back(timer.nsecsElapsed());
+    }
+
+    Result r;
+    r.name = name;
+    r.iterations = iterations;
+    if (samples.empty()) return r;
+
+    qint64 total = 0;
+    for (const auto s : samples) total += s;
+    std::sort(samples.begin(), samples.end());
+
+    r.meanNsecs = static_cast<double>(total) / samples.size();
+    r.p50Nsecs = samples[samples.size() / 2];
+    r.p99Nsecs = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+    r.maxNsecs = samples.back();
+    r.itemsPerSecond = (total > 0) ? itemsPerIteration * iterations * 1e9 / total : 0.0;
+    return r;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Key event as recorded from a device frame, without the closing SYN event.
+  KeyEvent keyEvent(uint16_t code, int32_t value) {
+    return KeyEvent{ DeviceInputEvent(EV_MSC, MSC_SCAN, code), DeviceInputEvent(EV_KEY, code, value) };
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Input mapping with the given number of two-key sequences, each mapped to a key sequence action.
+  InputMapConfig createConfig(size_t size)
+  {
+    InputMapConfig config;
+    for (size_t i = 0; i < size; ++i)
+    {
+      const auto first = static_cast<uint16_t>(firstConfigKey + (i / numConfigKeys) % numConfigKeys);
+      const auto second = static_cast<uint16_t>(firstConfigKey + i % numConfigKeys);
+      KeyEventSequence sequence{ keyEvent(first, 1), keyEvent(first, 0), keyEvent(second, 1), keyEvent(second, 0) };
+      for (size_t n = i / (numConfigKeys * numConfigKeys); n > 0; --n) {
+        sequence.push_back(keyEvent(second, 1));
+        sequence.push_back(keyEvent(second, 0));
+      }
+      config.emplace(std::move(sequence),
+                     MappedAction{ std::make_shared<KeySequenceAction>(NativeKeySequence::predefined::altTab()) });
+    }
+    return config;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Serialize the input mapping the same way the settings store it: sequence and action per entry.
+  QByteArray serialize(const InputMapConfig& config)
+  {
+    QByteArray data;
+    QDataStream s(&data, QIODevice::WriteOnly);
+    s << quint32(config.size());
+    for (const auto& item : config) {
+      s << item.first << item.second;
+    }
+    return data;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  InputMapConfig deserialize(const QByteArray& data)
+  {
+    InputMapConfig config;
+    QDataStream s(data);
+    quint32 size = 0;
+    s >> size;
+    for (quint32 i = 0; i < size && s.status() == QDataStream::Ok; ++i)
+    {
+      KeyEventSequence sequence;
+      MappedAction action;
+      s >> sequence >> action;
+      config.emplace(std::move(sequence), std::move(action));
+    }
+    return config;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  /// Device frames with increasing (virtual) timestamps, 1 ms apart.
+  class FrameGenerator
+  {
+  public:
+    // Key press or release frame: EV_MSC/MSC_SCAN, EV_KEY, EV_SYN
+    const input_event* keyFrame(uint16_t code, int32_t value)
+    {
+      m_timeUsec += 1000;
+      m_frame[0] = event(EV_MSC, MSC_SCAN, code);
+      m_frame[1] = event(EV_KEY, code, value);
+      m_frame[2] = event(EV_SYN, SYN_REPORT, 0);
+      return m_frame;
+    }
+    static constexpr size_t KeyFrameSize = 3;
+
+    int64_t timeUsec() const { return m_timeUsec; }
+    void advance(int64_t usec) { m_timeUsec += usec; }
+
+  private:
+    input_event event(uint16_t type, uint16_t code, int32_t value) const
+    {
+      input_event ie{};
+      setEventTimeUsec(ie, m_timeUsec);
+      ie.type = type;
+      ie.code = code;
+      ie.value = value;
+      return ie;
+    }
+
+    int64_t m_timeUsec = 0;
+    input_event m_frame[KeyFrameSize];
+  };
+
+  // -----------------------------------------------------------------------------------------------
+  void printConsole(const std::vector<Result>& results)
+  {
+    std::printf("%-28s %12s %12s %12s %12s %12s %14s\n", "", "iterations", "mean (ns)", "p50 (ns)",
+                "p99 (ns)", "max (ns)", "items/s");
+    for (const auto& r : results)
+    {
+      std::printf("%-28s %12zu %12.0f %12.0f %12.0f %12.0f %14.0f\n", r.name.toLocal8Bit().constData(),
+                  r.iterations, r.meanNsecs, r.p50Nsecs, r.p99Nsecs, r.maxNsecs, r.itemsPerSecond);
+    }
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Output in the layout of Google Benchmark's JSON reporter, so existing tooling can compare runs.
+  void printJson(const std::vector<Result>& results)
+  {
+    std::printf("{\n  \"context\": {\n");
+    std::printf("    \"date\": \"%s\",\n", QDateTime::currentDateTime().toString(Qt::ISODate).toLocal8Bit().constData());
+    std::printf("    \"executable\": \"projecteur-bench\",\n");
+    std::printf("    \"num_cpus\": %u\n", std::thread::hardware_concurrency());
+    std::printf("  },\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      const auto& r = results[i];
+      std::printf("    {\n");
+      std::printf("      \"name\": \"%s\",\n", r.name.toLocal8Bit().constData());
+      std::printf("      \"iterations\": %zu,\n", r.iterations);
+      std::printf("      \"real_time\": %.1f,\n", r.meanNsecs);
+      std::printf("      \"p50_time\": %.1f,\n", r.p50Nsecs);
+      std::printf("      \"p99_time\": %.1f,\n", r.p99Nsecs);
+      std::printf("      \"max_time\": %.1f,\n", r.maxNsecs);
+      std::printf("      \"time_unit\": \"ns\",\n");
+      std::printf("      \"items_per_second\": %.1f\n", r.itemsPerSecond);
+      std::printf("    }%s\n", (i + 1 < results.size()) ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+  }
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Benchmark the input pipeline with synthetic device frames.");
+  parser.addHelpOption();
+  const QCommandLineOption iterationsOption("iterations", "Number of iterations for feed and emit measurements.", "N", "100000");
+  const QCommandLineOption configIterationsOption("config-iterations", "Number of iterations for input mapping measurements.", "N", "20");
+  const QCommandLineOption configSizesOption("config-sizes", "Comma separated input mapping sizes.", "list", "10,100,1000,10000");
+  const QCommandLineOption formatOption("format", "Output format (console, json).", "format", "console");
+  parser.addOptions({iterationsOption, configIterationsOption, configSizesOption, formatOption});
+  parser.process(app);
+
+  const auto iterations = static_cast<size_t>(std::max(1, parser.value(iterationsOption).toInt()));
+  const auto configIterations = static_cast<size_t>(std::max(1, parser.value(configIterationsOption).toInt()));
+  const bool json = (parser.value(formatOption) == "json");
+
+  // The virtual device writes to a memfd, which is truncated before each measurement.
+  const int sinkFd = memfd_create("projecteur-bench", MFD_CLOEXEC);
+  const auto virtualDevice = VirtualDevice::createSink(sinkFd);
+  if (!virtualDevice) {
+    std::cerr << "Cannot create virtual device sink." << std::endl;
+    return 1;
+  }
+  const auto resetSink = [sinkFd]() {
+    if (ftruncate(sinkFd, 0) < 0 || lseek(sinkFd, 0, SEEK_SET) < 0) {
+      std::cerr << "Cannot reset virtual device sink." << std::endl;
+    }
+  };
+
+  std::vector<Result> results;
+
+  // --- Feed: one frame per iteration through a mapper with a large input mapping.
+  {
+    InputMapper mapper(virtualDevice);
+    mapper.setVirtualTime(true);
+    auto config = createConfig(1000);
+    config.emplace(KeyEventSequence{ keyEvent(mappedKey, 1), keyEvent(mappedKey, 0) },
+                   MappedAction{ std::make_shared<KeySequenceAction>(NativeKeySequence::predefined::altTab()) });
+    mapper.setConfiguration(config);
+
+    FrameGenerator frames;
+    resetSink();
+    results.push_back(measure("feed/unmapped", iterations, 1, [&mapper, &frames](size_t i) {
+      mapper.addEvents(frames.keyFrame(unmappedKey, (i % 2) ? 0 : 1), FrameGenerator::KeyFrameSize);
+    }));
+
+    resetSink();
+    results.push_back(measure("feed/mapped", iterations, 1, [&mapper, &frames](size_t i) {
+      mapper.addEvents(frames.keyFrame(mappedKey, (i % 2) ? 0 : 1), FrameGenerator::KeyFrameSize);
+    }));
+
+    // Press and release of the first key of a two-key sequence, then the sequence times out.
+    resetSink();
+    const auto sequenceKey = firstConfigKey;
+    results.push_back(measure("feed/sequence-timeout", iterations, 1, [&mapper, &frames, sequenceKey](size_t i) {
+      mapper.addEvents(frames.keyFrame(sequenceKey, (i % 2) ? 0 : 1), FrameGenerator::KeyFrameSize);
+      if (i % 2)
+      {
+        frames.advance(InputMapper::MaxKeyEventInterval * 1000);
+        mapper.processTimeout(frames.timeUsec());
+      }
+    }));
+  }
+
+  // --- Input mappings: reconfigure, serialize and deserialize.
+  QTemporaryDir tmpDir;
+  if (!tmpDir.isValid()) {
+    std::cerr << "Cannot create temporary directory." << std::endl;
+    return 1;
+  }
+
+  for (const auto& sizeValue : parser.value(configSizesOption).split(','))
+  {
+    const auto size = static_cast<size_t>(std::max(1, sizeValue.toInt()));
+    const auto config = createConfig(size);
+    const auto suffix = QString("/%1").arg(size);
+
+    InputMapper mapper(virtualDevice);
+    results.push_back(measure("reconfigure" + suffix, configIterations, size, [&mapper, &config](size_t) {
+      mapper.setConfiguration(config);
+    }, [&mapper]() { mapper.setConfiguration(InputMapConfig()); }));
+
+    QByteArray data;
+    results.push_back(measure("serialize" + suffix, configIterations, size, [&config, &data](size_t) {
+      data = serialize(config);
+    }));
+
+    size_t deserializedSize = 0;
+    results.push_back(measure("deserialize" + suffix, configIterations, size, [&data, &deserializedSize](size_t) {
+      deserializedSize = deserialize(data).size();
+    }));
+    if (deserializedSize != config.size()) {
+      std::cerr << "Deserialized input mapping differs in size." << std::endl;
+      return 1;
+    }
+
+    // Binary input mapping files, as stored per device by the settings.
+    const auto path = tmpDir.filePath(QString("inputmap-%1.pim").arg(size));
+    results.push_back(measure("store/save" + suffix, configIterations, size, [&config, &path](size_t) {
+      InputMapStore::save(path, config);
+    }));
+
+    InputMapStore::File file;
+    results.push_back(measure("store/open" + suffix, configIterations, 1, [&file, &path](size_t) {
+      file.open(path);
+    }));
+
+    InputMapConfig decoded;
+    results.push_back(measure("store/decode" + suffix, configIterations, size, [&file, &decoded](size_t) {
+      file.decode(decoded);
+    }));
+    if (decoded.size() != config.size()) {
+      std::cerr << "Decoded input mapping differs in size." << std::endl;
+      return 1;
+    }
+  }
+
+  // --- Emission: events per second written to the virtual device.
+  {
+    FrameGenerator frames;
+    resetSink();
+    results.push_back(measure("emit/frame", iterations, FrameGenerator::KeyFrameSize, [&virtualDevice, &frames](size_t i) {
+      virtualDevice->emitEvents(frames.keyFrame(unmappedKey, (i % 2) ? 0 : 1), FrameGenerator::KeyFrameSize);
+    }));
+
+    const auto& ks = NativeKeySequence::predefined::altTab();
+    InputEventBatch batch;
+    for (int i = 0; i < 8; ++i) batch.append(ks.nativeEvents(), ks.nativeEventCount());
+    resetSink();
+    results.push_back(measure("emit/batch", iterations, batch.eventCount(), [&virtualDevice, &batch](size_t) {
+      virtualDevice->emitEvents(batch);
+    }));
+  }
+  resetSink();
+
+  if (json) printJson(results);
+  else printConsole(results);
+  return 0;
+}
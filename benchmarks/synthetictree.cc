@@ -0,0 +1,217 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "synthetictree.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QTextStream>
+
+#include <linux/input.h>
+
+namespace {
+  constexpr quint16 logitechVendorId = 0x046d;
+  constexpr quint16 spotlightUsbProductId = 0xc53e;
+  constexpr quint16 spotlightBtProductId = 0xb503;
+
+  // Vendor ids for unrelated keyboards, not used by any supported device.
+  constexpr quint16 keyboardVendorIdBase = 0xf000;
+
+  // -----------------------------------------------------------------------------------------------
+  bool writeFile(const QString& path, const QString& contents)
+  {
+    if (!QDir().mkpath(QFileInfo(path).path())) return false;
+    QFile f(path);
+    const auto data = contents.toUtf8();
+    return f.open(QIODevice::WriteOnly) && f.write(data) == data.size();
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  QString hex(quint16 value, int width = 4) {
+    return QString("%1").arg(value, width, 16, QChar('0')).toUpper();
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  QString usbPhys(int port) {
+    return QString("usb-0000:00:14.0-%1").arg(port);
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  QString bluetoothPhys(int index) {
+    return QString("00:1a:7d:da:%1:%2").arg((index >> 8) & 0xff, 2, 16, QChar('0'))
+                                       .arg(index & 0xff, 2, 16, QChar('0'));
+  }
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+SyntheticDeviceTree::SyntheticDeviceTree(const QString& rootPath)
+  : m_rootPath(rootPath) {}
+
+// -------------------------------------------------------------------------------------------------
+DeviceScan::Roots SyntheticDeviceTree::roots() const
+{
+  DeviceScan::Roots roots;
+  roots.sysfs = QDir(m_rootPath).filePath("sys");
+  roots.dev = QDir(m_rootPath).filePath("dev");
+  return roots;
+}
+
+// -------------------------------------------------------------------------------------------------
+bool SyntheticDeviceTree::create(const Options& options)
+{
+  if (!QDir().mkpath(roots().hidDevicePath())) return false;
+
+  int port = 1;
+  for (int i = 0; i < options.usbSpotlights; ++i, ++port)
+  {
+    // The USB receiver has a keyboard, a mouse and a vendor specific (HID++) interface.
+    const auto phys = usbPhys(port);
+    const auto name = QString("Logitech USB Receiver");
+    if (addSupportedHidDevice(BUS_USB, logitechVendorId, spotlightUsbProductId, name, phys + "/input0",
+                              SubDevices{true, false, true}).isEmpty()
+        || addSupportedHidDevice(BUS_USB, logitechVendorId, spotlightUsbProductId, name, phys + "/input1",
+                                 SubDevices{false, true, true}).isEmpty()
+        || addSupportedHidDevice(BUS_USB, logitechVendorId, spotlightUsbProductId, name, phys + "/input2",
+                                 SubDevices{false, false, true}).isEmpty()) {
+      return false;
+    }
+    ++m_supportedDeviceCount;
+  }
+
+  int btIndex = 0;
+  for (int i = 0; i < options.bluetoothSpotlights; ++i, ++btIndex)
+  {
+    if (addSupportedHidDevice(BUS_BLUETOOTH, logitechVendorId, spotlightBtProductId, "SPOTLIGHT",
+                              bluetoothPhys(btIndex), SubDevices{true, true, true}).isEmpty()) {
+      return false;
+    }
+    ++m_supportedDeviceCount;
+  }
+
+  if (!options.devicesConf.isEmpty())
+  {
+    for (const auto& extraDevice : readDevicesConf(options.devicesConf))
+    {
+      const auto busType = extraDevice.isBluetooth ? BUS_BLUETOOTH : BUS_USB;
+      const auto phys = extraDevice.isBluetooth ? bluetoothPhys(btIndex++) : usbPhys(port++) + "/input0";
+      if (addSupportedHidDevice(busType, extraDevice.vendorId, extraDevice.productId, extraDevice.name,
+                                phys, SubDevices{true, true, true}).isEmpty()) {
+        return false;
+      }
+      ++m_supportedDeviceCount;
+    }
+  }
+
+  for (int i = 0; i < options.keyboards; ++i, ++port)
+  {
+    const auto vendorId = static_cast<quint16>(keyboardVendorIdBase + (i % 0x100));
+    const auto productId = static_cast<quint16>(i);
+    if (addHidDevice(BUS_USB, vendorId, productId, QString("Keyboard %1").arg(i),
+                     usbPhys(port) + "/input0", SubDevices{true, false, true}).isEmpty()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+QString SyntheticDeviceTree::addSupportedHidDevice(quint16 busType, quint16 vendorId, quint16 productId,
+                                                   const QString& name, const QString& phys,
+                                                   const SubDevices& subDevices)
+{
+  const int eventPathCount = m_eventPaths.size();
+  const auto hidDirName = addHidDevice(busType, vendorId, productId, name, phys, subDevices);
+  m_supportedEventPaths.append(m_eventPaths.mid(eventPathCount));
+  return hidDirName;
+}
+
+// -------------------------------------------------------------------------------------------------
+QString SyntheticDeviceTree::addHidDevice(quint16 busType, quint16 vendorId, quint16 productId,
+                                          const QString& name, const QString& phys,
+                                          const SubDevices& subDevices)
+{
+  const auto hidDirName = QString("%1:%2:%3.%4").arg(hex(busType)).arg(hex(vendorId))
+                                                .arg(hex(productId)).arg(hex(m_nextHidIndex++));
+  const auto hidPath = QDir(roots().sysfs).filePath("devices/synthetic/" + hidDirName);
+
+  const QString uevent = QString("DRIVER=hid-generic\nHID_ID=%1:%2:%3\nHID_NAME=%4\nHID_PHYS=%5\n"
+                                 "HID_UNIQ=\nMODALIAS=hid:b%1g0001v%2p%3\n")
+                         .arg(hex(busType)).arg(hex(vendorId, 8)).arg(hex(productId, 8))
+                         .arg(name).arg(phys);
+  if (!writeFile(QDir(hidPath).filePath("uevent"), uevent)) return QString();
+
+  if ((subDevices.keyboardEvents && !addEventDevice(hidPath, phys, false))
+      || (subDevices.mouseEvents && !addEventDevice(hidPath, phys, true))
+      || (subDevices.hidraw && !addHidrawDevice(hidPath))) {
+    return QString();
+  }
+
+  // Like in the real sysfs, the HID bus lists symbolic links to the devices.
+  if (!QFile::link(hidPath, QDir(roots().hidDevicePath()).filePath(hidDirName))) return QString();
+
+  ++m_hidDeviceCount;
+  return hidDirName;
+}
+
+// -------------------------------------------------------------------------------------------------
+bool SyntheticDeviceTree::removeHidDevice(const QString& hidDirName)
+{
+  const auto hidPath = QDir(roots().sysfs).filePath("devices/synthetic/" + hidDirName);
+  if (!QFile::remove(QDir(roots().hidDevicePath()).filePath(hidDirName))) return false;
+  if (!QDir(hidPath).removeRecursively()) return false;
+  --m_hidDeviceCount;
+  return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+bool SyntheticDeviceTree::addEventDevice(const QString& hidPath, const QString& phys, bool mouse)
+{
+  const int index = m_nextInputIndex++;
+  const auto inputPath = QDir(hidPath).filePath(QString("input/input%1").arg(index));
+  const auto eventPath = QDir(inputPath).filePath(QString("event%1").arg(index));
+  const auto devName = QString("input/event%1").arg(index);
+
+  // Keyboard: EV_SYN, EV_KEY, EV_MSC, EV_LED, EV_REP - Mouse: EV_SYN, EV_KEY, EV_REL, EV_MSC
+  const bool ok = writeFile(QDir(inputPath).filePath("phys"), phys + '\n')
+                  && writeFile(QDir(inputPath).filePath("capabilities/ev"), mouse ? "17\n" : "120013\n")
+                  && writeFile(QDir(inputPath).filePath("capabilities/rel"), mouse ? "1943\n" : "0\n")
+                  && writeFile(QDir(eventPath).filePath("uevent"),
+                               QString("MAJOR=13\nMINOR=%1\nDEVNAME=%2\n").arg(64 + index).arg(devName))
+                  && writeFile(QDir(roots().dev).filePath(devName), QString());
+  if (ok) m_eventPaths.push_back(eventPath);
+  return ok;
+}
+
+// -------------------------------------------------------------------------------------------------
+bool SyntheticDeviceTree::addHidrawDevice(const QString& hidPath)
+{
+  const int index = m_nextHidrawIndex++;
+  const auto devName = QString("hidraw%1").arg(index);
+  return writeFile(QDir(hidPath).filePath(QString("hidraw/%1/uevent").arg(devName)),
+                   QString("MAJOR=241\nMINOR=%1\nDEVNAME=%2\n").arg(index).arg(devName))
+         && writeFile(QDir(roots().dev).filePath(devName), QString());
+}
+
+// -------------------------------------------------------------------------------------------------
+std::vector<SupportedDevice> SyntheticDeviceTree::readDevicesConf(const QString& filename)
+{
+  // Same format as parsed by CMake: 'vendorId, productId, usb|bt, name'
+  static const QRegularExpression lineRegex(
+    "^\\s*0x([0-9a-fA-F]{4})\\s*,\\s*0x([0-9a-fA-F]{4})\\s*,\\s*(usb|bt)\\s*,\\s*(.*?)\\s*$");
+
+  std::vector<SupportedDevice> devices;
+  QFile f(filename);
+  if (!f.open(QIODevice::ReadOnly)) return devices;
+
+  QTextStream in(&f);
+  while (!in.atEnd())
+  {
+    const auto match = lineRegex.match(in.readLine());
+    if (!match.hasMatch()) continue;
+    devices.push_back(SupportedDevice{match.captured(1).toUShort(nullptr, 16),
+                                      match.captured(2).toUShort(nullptr, 16),
+                                      match.captured(3) == "bt", match.captured(4)});
+  }
+  return devices;
+}
@@ -0,0 +1,65 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include "devicescan.h"
+
+#include <QString>
+#include <QStringList>
+
+#include <vector>
+
+// -------------------------------------------------------------------------------------------------
+/// Generator for synthetic sysfs and device node trees, laid out like the parts of /sys and /dev
+/// read by the DeviceScan. HID devices are created below 'sys/devices/synthetic' and linked from
+/// 'sys/bus/hid/devices', device nodes are empty regular files below 'dev'.
+class SyntheticDeviceTree
+{
+public:
+  struct Options {
+    int usbSpotlights = 1;       // Logitech Spotlight (USB receiver), three HID interfaces each
+    int bluetoothSpotlights = 1; // Logitech Spotlight (Bluetooth)
+    QString devicesConf;         // one device per entry of this devices.conf file, if not empty
+    int keyboards = 500;         // unrelated USB keyboards
+  };
+
+  struct SubDevices {
+    bool keyboardEvents = false; // input event device with key events
+    bool mouseEvents = false;    // input event device with relative x/y events
+    bool hidraw = false;         // hidraw device
+  };
+
+  explicit SyntheticDeviceTree(const QString& rootPath);
+
+  /// Create the device tree with the given options, returns false on file system errors.
+  bool create(const Options& options);
+
+  /// Add a single HID device (interface), returns its HID directory name or an empty string on
+  /// failure. HID devices with the same ids and physical path are one device for the DeviceScan.
+  QString addHidDevice(quint16 busType, quint16 vendorId, quint16 productId, const QString& name,
+                       const QString& phys, const SubDevices& subDevices);
+  bool removeHidDevice(const QString& hidDirName);
+
+  DeviceScan::Roots roots() const;
+  int hidDeviceCount() const { return m_hidDeviceCount; }
+  int supportedDeviceCount() const { return m_supportedDeviceCount; }
+  /// Sysfs paths of all created input event devices of supported devices.
+  const QStringList& supportedEventPaths() const { return m_supportedEventPaths; }
+
+  /// Read the supported extra devices from a devices.conf file.
+  static std::vector<SupportedDevice> readDevicesConf(const QString& filename);
+
+private:
+  QString addSupportedHidDevice(quint16 busType, quint16 vendorId, quint16 productId,
+                                const QString& name, const QString& phys, const SubDevices& subDevices);
+  bool addEventDevice(const QString& hidPath, const QString& phys, bool mouse);
+  bool addHidrawDevice(const QString& hidPath);
+
+  const QString m_rootPath;
+  int m_hidDeviceCount = 0;
+  int m_supportedDeviceCount = 0;
+  int m_nextHidIndex = 1;
+  int m_nextInputIndex = 0;
+  int m_nextHidrawIndex = 0;
+  QStringList m_eventPaths; // sysfs paths of all input event devices
+  QStringList m_supportedEventPaths;
+};
@@ -3,12 +3,16 @@
 
 #include "deviceinput.h"
 #include "devicescan.h"
+#include "hidpp.h"
 #include "logging.h"
 
-#include <QSocketNotifier>
+#include <algorithm>
 
 #include <fcntl.h>
+#include <linux/hidraw.h>
 #include <linux/input.h>
+#include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 
 
@@ -51,6 +55,20 @@ bool DeviceConnection::removeSubDevice(const QString& path)
   if (find_it != m_subDeviceConnections.end())
   {
     if (find_it->second) { find_it->second->disconnect(); } // Important
+    if (find_it->second && find_it->second->type() == ConnectionType::Event)
+    {
+      const auto& stats = static_cast<SubEventConnection*>(find_it->second.get())->readStatistics();
+      logDebug(device) << tr("Read statistics for %1: %2 read calls, %3 events, %4 frames "
+                             "(%5 read calls per frame), %6 coalesced frames")
+                          .arg(path).arg(stats.readCalls).arg(stats.events).arg(stats.frames)
+                          .arg(stats.readCallsPerFrame(), 0, 'f', 2).arg(stats.coalescedFrames);
+    }
+    else if (find_it->second && find_it->second->type() == ConnectionType::Hidraw)
+    {
+      const auto& stats = static_cast<SubHidrawConnection*>(find_it->second.get())->readStatistics();
+      logDebug(device) << tr("Read statistics for %1: %2 read calls, %3 reports, %4 events")
+                          .arg(path).arg(stats.readCalls).arg(stats.reports).arg(stats.events);
+    }
     logDebug(device) << tr("Disconnected sub-device: %1 (%2:%3) %4")
                         .arg(m_deviceName).arg(m_deviceId.vendorId, 4, 16, QChar('0'))
                         .arg(m_deviceId.productId, 4, 16, QChar('0')).arg(path);
@@ -66,21 +84,31 @@ SubDeviceConnection::SubDeviceConnection(const QString& path, ConnectionType typ
   : m_details(path, type, mode) {}
 
 // -------------------------------------------------------------------------------------------------
-SubDeviceConnection::~SubDeviceConnection() = default;
+SubDeviceConnection::~SubDeviceConnection() {
+  disconnect();
+}
 
 // -------------------------------------------------------------------------------------------------
 bool SubDeviceConnection::isConnected() const {
-  return m_notifier && m_notifier->isEnabled();
+  return m_fd >= 0 && m_enabled;
 }
 
 // -------------------------------------------------------------------------------------------------
-void SubDeviceConnection::disconnect() {
-  m_notifier.reset();
+void SubDeviceConnection::disconnect()
+{
+  m_enabled = false;
+  if (m_fd < 0) return;
+
+  if (m_details.grabbed) {
+    ioctl(m_fd, EVIOCGRAB, 0);
+  }
+  ::close(m_fd);
+  m_fd = -1;
 }
 
 // -------------------------------------------------------------------------------------------------
 void SubDeviceConnection::disable() {
-  if (m_notifier) m_notifier->setEnabled(false);
+  m_enabled = false;
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -88,11 +116,6 @@ const std::shared_ptr<InputMapper>& SubDeviceConnection::inputMapper() const  {
   return m_inputMapper;
 }
 
-// -------------------------------------------------------------------------------------------------
-QSocketNotifier* SubDeviceConnection::socketNotifier() {
-  return m_notifier.get();
-}
-
 // -------------------------------------------------------------------------------------------------
 SubEventConnection::SubEventConnection(Token, const QString& path)
   : SubDeviceConnection(path, ConnectionType::Event, ConnectionMode::ReadOnly) {}
@@ -158,24 +181,200 @@ std::shared_ptr<SubEventConnection> SubEventConnection::create(const DeviceScan:
     }
   }
 
+  // Use monotonic event timestamps, the input mapper compares them with the steady clock.
+  int clockId = CLOCK_MONOTONIC;
+  if (ioctl(evfd, EVIOCSCLOCKID, &clockId) < 0) {
+    logDebug(device) << tr("Cannot set monotonic event clock for '%1'").arg(sd.deviceFile);
+  }
+
   fcntl(evfd, F_SETFL, fcntl(evfd, F_GETFL, 0) | O_NONBLOCK);
   if ((fcntl(evfd, F_GETFL, 0) & O_NONBLOCK) == O_NONBLOCK) {
     connection->m_details.deviceFlags |= DeviceFlag::NonBlocking;
   }
 
-  // Create socket notifier
-  connection->m_notifier = std::make_unique<QSocketNotifier>(evfd, QSocketNotifier::Read);
-  QSocketNotifier* const notifier = connection->m_notifier.get();
-  // Auto clean up and close descriptor on destruction of notifier
-  connect(notifier, &QSocketNotifier::destroyed, [grabbed = connection->m_details.grabbed, notifier]() {
-    if (grabbed) {
-      ioctl(static_cast<int>(notifier->socket()), EVIOCGRAB, 0);
-    }
-    ::close(static_cast<int>(notifier->socket()));
-  });
+  // The connection owns the file descriptor from here on, reading is done by the InputEngine.
+  connection->m_fd = evfd;
+  connection->m_enabled = true;
 
   connection->m_inputMapper = dc.inputMapper();
   connection->m_details.phys = sd.phys;
 
   return connection;
 }
+
+// -------------------------------------------------------------------------------------------------
+SubHidrawConnection::SubHidrawConnection(Token, const QString& path)
+  : SubDeviceConnection(path, ConnectionType::Hidraw, ConnectionMode::ReadWrite) {}
+
+// -------------------------------------------------------------------------------------------------
+SubHidrawConnection::~SubHidrawConnection() {
+  disconnect(); // the base class destructor does not call the override
+}
+
+// -------------------------------------------------------------------------------------------------
+void SubHidrawConnection::disconnect()
+{
+  // Diverted controls stay diverted until the device is reset, give them back to the device.
+  if (m_reprogFeatureIndex != 0) setControlsDiverted(false);
+  m_reprogFeatureIndex = 0;
+  SubDeviceConnection::disconnect();
+}
+
+// -------------------------------------------------------------------------------------------------
+void SubHidrawConnection::setControlsDiverted(bool divert)
+{
+  if (m_fd < 0) return;
+
+  for (const auto& control : HIDPP::divertedControls())
+  {
+    const auto request = HIDPP::setCidReportingRequest(m_hidppDeviceIndex, m_reprogFeatureIndex,
+                                                       control.controlId, divert);
+    if (::write(m_fd, request.data(), request.size()) != static_cast<ssize_t>(request.size())) {
+      logDebug(device) << tr("Cannot send HID++ control reporting request to '%1'").arg(path());
+    }
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+std::shared_ptr<SubHidrawConnection> SubHidrawConnection::create(const DeviceScan::SubDevice& sd,
+                                                                 const DeviceConnection& dc)
+{
+  const int fd = ::open(sd.deviceFile.toLocal8Bit().constData(), O_RDWR | O_NONBLOCK, 0);
+  if (fd < 0) {
+    logDebug(device) << tr("Cannot open hidraw device: %1").arg(sd.deviceFile);
+    return std::shared_ptr<SubHidrawConnection>();
+  }
+
+  struct hidraw_devinfo devinfo{};
+  ioctl(fd, HIDIOCGRAWINFO, &devinfo);
+
+  // Check against given device id
+  if (static_cast<uint16_t>(devinfo.vendor) != dc.deviceId().vendorId
+      || static_cast<uint16_t>(devinfo.product) != dc.deviceId().productId)
+  {
+    ::close(fd);
+    logDebug(device) << tr("Device id mismatch: %1 (%2:%3)")
+                        .arg(sd.deviceFile)
+                        .arg(static_cast<uint16_t>(devinfo.vendor), 4, 16, QChar('0'))
+                        .arg(static_cast<uint16_t>(devinfo.product), 4, 16, QChar('0'));
+    return std::shared_ptr<SubHidrawConnection>();
+  }
+
+  // Only connect to HID interfaces with HID++ reports, i.e. a report descriptor
+  // containing the 'Report ID (0x11)' item of the HID++ long report.
+  struct hidraw_report_descriptor descriptor{};
+  int descriptorSize = 0;
+  const bool hasDescriptor = ioctl(fd, HIDIOCGRDESCSIZE, &descriptorSize) == 0 && descriptorSize > 0
+                             && static_cast<size_t>(descriptorSize) <= sizeof(descriptor.value);
+  if (hasDescriptor) {
+    descriptor.size = static_cast<uint32_t>(descriptorSize);
+  }
+  const uint8_t longReportId[] = { 0x85, static_cast<uint8_t>(HIDPP::ReportType::Long) };
+  if (!hasDescriptor || ioctl(fd, HIDIOCGRDESC, &descriptor) < 0
+      || std::search(descriptor.value, descriptor.value + descriptor.size,
+                     std::begin(longReportId), std::end(longReportId)) == descriptor.value + descriptor.size)
+  {
+    ::close(fd);
+    logDebug(device) << tr("No HID++ reports on hidraw device: %1").arg(sd.deviceFile);
+    return std::shared_ptr<SubHidrawConnection>();
+  }
+
+  // Devices paired with a USB receiver are addressed by their receiver slot.
+  const uint8_t hidppDeviceIndex = (devinfo.bustype == BUS_USB) ? HIDPP::FirstReceiverDeviceIndex
+                                                                : HIDPP::DirectDeviceIndex;
+  auto connection = create(fd, hidppDeviceIndex, sd.deviceFile, dc);
+  connection->m_details.phys = sd.phys;
+
+  return connection;
+}
+
+// -------------------------------------------------------------------------------------------------
+std::shared_ptr<SubHidrawConnection> SubHidrawConnection::create(int fd, uint8_t hidppDeviceIndex,
+                                                                 const QString& path,
+                                                                 const DeviceConnection& dc)
+{
+  auto connection = std::make_shared<SubHidrawConnection>(Token{}, path);
+  connection->m_details.deviceFlags |= DeviceFlag::NonBlocking;
+  connection->m_hidppDeviceIndex = hidppDeviceIndex;
+
+  // Ask for the index of the REPROG_CONTROLS_V4 feature, diverted button events are sent with it.
+  // The response is read and decoded by the InputEngine like any other report.
+  const auto request = HIDPP::getFeatureRequest(hidppDeviceIndex, HIDPP::ReprogControlsV4Feature);
+  if (::write(fd, request.data(), request.size()) != static_cast<ssize_t>(request.size())) {
+    logDebug(device) << tr("Cannot send HID++ feature request to '%1'").arg(path);
+  }
+
+  // The connection owns the file descriptor from here on, reading is done by the InputEngine.
+  connection->m_fd = fd;
+  connection->m_enabled = true;
+
+  connection->m_inputMapper = dc.inputMapper();
+
+  return connection;
+}
+
+// -------------------------------------------------------------------------------------------------
+size_t SubHidrawConnection::decodeReport(const uint8_t* data, size_t size, int64_t timeUsec)
+{
+  const auto message = HIDPP::Message::parse(data, size);
+  if (!message.isValid() || message.deviceIndex() != m_hidppDeviceIndex) return 0;
+
+  if (message.isError())
+  { // Error message params: feature index, function/software id, error code of the request
+    logDebug(device) << tr("HID++ error %1 from '%2'").arg(message.params()[1]).arg(path());
+    return 0;
+  }
+
+  uint8_t featureIndex = 0;
+  if (HIDPP::decodeGetFeatureResponse(message, featureIndex))
+  {
+    m_reprogFeatureIndex = featureIndex;
+    if (featureIndex == 0) {
+      logDebug(device) << tr("HID++ device '%1' has no REPROG_CONTROLS_V4 feature.").arg(path());
+    }
+    else {
+      setControlsDiverted(true);
+    }
+    return 0;
+  }
+
+  HIDPP::DivertedButtons buttons;
+  if (!HIDPP::decodeDivertedButtons(message, m_reprogFeatureIndex, buttons)) return 0;
+
+  size_t added = 0;
+  const auto addEvent = [this, &added, timeUsec](uint16_t type, uint16_t code, int32_t value)
+  {
+    auto& ev = m_inputEventBuffer.current();
+    ev = input_event{};
+    setEventTimeUsec(ev, timeUsec);
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    ++m_inputEventBuffer;
+    ++added;
+  };
+
+  const auto addKeyEvent = [this, &addEvent](uint16_t controlId, int32_t value)
+  { // Each key event is a frame of its own, like on the keyboard interface of the device.
+    const auto control = HIDPP::findControl(controlId);
+    if (!control || m_inputEventBuffer.available() < 3) return;
+    addEvent(EV_MSC, MSC_SCAN, control->scanCode);
+    addEvent(EV_KEY, control->keyCode, value);
+    addEvent(EV_SYN, SYN_REPORT, 0);
+  };
+
+  // Released controls first, then newly pressed ones.
+  const auto wasPressed = [this](uint16_t controlId) {
+    return controlId != 0
+           && std::find(m_pressedControls.cbegin(), m_pressedControls.cend(), controlId) != m_pressedControls.cend();
+  };
+  for (const auto controlId : m_pressedControls) {
+    if (controlId != 0 && !buttons.contains(controlId)) addKeyEvent(controlId, 0);
+  }
+  for (const auto controlId : buttons.controlIds) {
+    if (controlId != 0 && !wasPressed(controlId)) addKeyEvent(controlId, 1);
+  }
+  m_pressedControls = buttons.controlIds;
+
+  return added;
+}
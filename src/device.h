@@ -3,6 +3,9 @@
 
 #include "enum-helper.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <memory>
 
 #include <QObject>
@@ -34,7 +37,6 @@ Q_DECLARE_METATYPE(DeviceId);
 
 // -------------------------------------------------------------------------------------------------
 class InputMapper;
-class QSocketNotifier;
 class SubDeviceConnection;
 class VirtualDevice;
 
@@ -104,15 +106,35 @@ struct InputBuffer {
   void reset() { pos_ = 0; }
   auto data() { return data_.data(); }
   auto size() const { return data_.size(); }
+  auto available() const { return data_.size() - pos_; }
   T& current() { return data_.at(pos_); }
   InputBuffer& operator++() { ++pos_; return *this; }
+  InputBuffer& operator+=(size_t num) { pos_ += num; return *this; }
   T& operator[](size_t pos) { return data_[pos]; }
   T& first() { return data_[0]; }
+
+  /// Discard the first num elements and move the remaining ones to the front of the buffer.
+  void shift(size_t num) {
+    std::move(data_.begin() + num, data_.begin() + pos_, data_.begin());
+    pos_ -= num;
+  }
 private:
   std::array<T, Size> data_;
   size_t pos_ = 0;
 };
 
+// -------------------------------------------------------------------------------------------------
+/// Counters for the read path of a sub-device connection.
+struct InputReadStatistics {
+  uint64_t readCalls = 0; // number of read() system calls
+  uint64_t events = 0; // number of input events read
+  uint64_t frames = 0; // number of EV_SYN terminated frames
+  uint64_t coalescedFrames = 0; // number of mouse move frames merged into a previous frame
+  uint64_t reports = 0; // number of raw HID reports read (hidraw sub-devices)
+
+  double readCallsPerFrame() const { return frames ? double(readCalls) / frames : 0.0; }
+};
+
 // -------------------------------------------------------------------------------------------------
 class SubDeviceConnection : public QObject
 {
@@ -121,7 +143,7 @@ public:
   virtual ~SubDeviceConnection() = 0;
 
   bool isConnected() const;
-  void disconnect(); // destroys socket notifier and close file handle
+  virtual void disconnect(); // close file handle
   void disable(); // disable receiving/sending data
 
   auto type() const { return m_details.type; };
@@ -132,14 +154,15 @@ public:
   const auto& path() const { return m_details.devicePath; };
 
   const std::shared_ptr<InputMapper>& inputMapper() const;
-  QSocketNotifier* socketNotifier();
+  int fileDescriptor() const { return m_fd; }
 
 protected:
   SubDeviceConnection(const QString& path, ConnectionType type, ConnectionMode mode);
 
   SubDeviceConnectionDetails m_details;
   std::shared_ptr<InputMapper> m_inputMapper; // shared input mapper from parent device.
-  std::unique_ptr<QSocketNotifier> m_notifier;
+  int m_fd = -1;
+  std::atomic<bool> m_enabled{false}; // can be disabled from the input engine thread
 };
 
 // -------------------------------------------------------------------------------------------------
@@ -159,10 +182,68 @@ public:
 
   SubEventConnection(Token, const QString& path);
   auto& inputBuffer() { return m_inputEventBuffer; }
+  auto& readStatistics() { return m_readStatistics; }
+  const auto& readStatistics() const { return m_readStatistics; }
 
 protected:
-  InputBuffer<12> m_inputEventBuffer;
+  // Large enough to drain many frames from the device with a single read() call.
+  InputBuffer<64> m_inputEventBuffer;
+  InputReadStatistics m_readStatistics;
 };
 
 // -------------------------------------------------------------------------------------------------
-// TODO SubHidrawConnection
+/// Buffer for raw HID reports. The hidraw driver returns one report per read() call, all reports
+/// available are read into the slots of this buffer before they are decoded in place.
+template<int Slots, int SlotSize>
+struct ReportBuffer {
+  uint8_t* slot(size_t index) { return data_[index].data(); }
+  size_t reportSize(size_t index) const { return sizes_[index]; }
+  void setReportSize(size_t index, size_t size) { sizes_[index] = size; }
+  static constexpr size_t slotCount() { return Slots; }
+  static constexpr size_t slotSize() { return SlotSize; }
+private:
+  std::array<std::array<uint8_t, SlotSize>, Slots> data_;
+  std::array<size_t, Slots> sizes_{};
+};
+
+// -------------------------------------------------------------------------------------------------
+/// Connection to the hidraw sub-device of a device speaking the Logitech HID++ 2.0 protocol.
+/// The controls in HIDPP::divertedControls() are diverted to software once the index of the
+/// REPROG_CONTROLS_V4 feature is known, their presses are reported as key events to the input
+/// mapper of the device.
+class SubHidrawConnection : public SubDeviceConnection
+{
+  Q_OBJECT
+  class Token{};
+
+public:
+  static std::shared_ptr<SubHidrawConnection> create(const DeviceScan::SubDevice& sd,
+                                                     const DeviceConnection& dc);
+  /// Create a connection for an opened and checked HID++ device, takes ownership of the fd.
+  static std::shared_ptr<SubHidrawConnection> create(int fd, uint8_t hidppDeviceIndex,
+                                                     const QString& path,
+                                                     const DeviceConnection& dc);
+
+  SubHidrawConnection(Token, const QString& path);
+  ~SubHidrawConnection() override;
+  void disconnect() override; // restores the diverted controls before closing the file handle
+  auto& reportBuffer() { return m_reportBuffer; }
+  auto& inputBuffer() { return m_inputEventBuffer; }
+  auto& readStatistics() { return m_readStatistics; }
+  const auto& readStatistics() const { return m_readStatistics; }
+
+  /// Decode a report in place and append resulting key events to the input buffer. Each key event
+  /// is a frame of its own: MSC_SCAN, EV_KEY and SYN_REPORT event. Returns the number of events added.
+  size_t decodeReport(const uint8_t* data, size_t size, int64_t timeUsec);
+
+protected:
+  void setControlsDiverted(bool divert);
+
+  ReportBuffer<16, 64> m_reportBuffer;
+  InputBuffer<16> m_inputEventBuffer;
+  InputReadStatistics m_readStatistics;
+
+  uint8_t m_hidppDeviceIndex = 0;
+  uint8_t m_reprogFeatureIndex = 0; // 0 until the getFeature response has been received
+  std::array<uint16_t, 4> m_pressedControls{};
+};
@@ -1,17 +1,17 @@
 // This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
 #include "deviceinput.h"
 
+#include "devicekeymap.h"
+#include "inputlatency.h"
 #include "logging.h"
-#include "settings.h"
 #include "virtualdevice.h"
 
 #include <algorithm>
-#include <map>
-#include <set>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <type_traits>
 
-#include <QTimer>
-
 #include <linux/input.h>
 
 LOGGING_CATEGORY(input, "input")
@@ -19,7 +19,9 @@ LOGGING_CATEGORY(input, "input")
 namespace  {
   // -----------------------------------------------------------------------------------------------
   static auto registered_ = qRegisterMetaTypeStreamOperators<KeyEventSequence>()
-                            && qRegisterMetaTypeStreamOperators<MappedAction>();
+                            && qRegisterMetaTypeStreamOperators<MappedAction>()
+                            && qRegisterMetaType<KeyEvent>()
+                            && qRegisterMetaType<std::shared_ptr<Action>>();
 
   // -----------------------------------------------------------------------------------------------
   void addKeyToString(QString& str, const QString& key)
@@ -40,9 +42,31 @@ namespace  {
   }
 }
 
+// -------------------------------------------------------------------------------------------------
+int64_t eventTimeUsec(const struct input_event& ie)
+{
+#ifdef input_event_sec // Linux >= 4.16, input_event time might not be a struct timeval
+  return static_cast<int64_t>(ie.input_event_sec) * 1000000 + ie.input_event_usec;
+#else
+  return static_cast<int64_t>(ie.time.tv_sec) * 1000000 + ie.time.tv_usec;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------------
+void setEventTimeUsec(struct input_event& ie, int64_t usec)
+{
+#ifdef input_event_sec
+  ie.input_event_sec = usec / 1000000;
+  ie.input_event_usec = usec % 1000000;
+#else
+  ie.time.tv_sec = usec / 1000000;
+  ie.time.tv_usec = usec % 1000000;
+#endif
+}
+
 // -------------------------------------------------------------------------------------------------
 DeviceInputEvent::DeviceInputEvent(const struct input_event& ie)
-  : type(ie.type), code(ie.code), value(ie.value) {}
+  : type(ie.type), code(ie.code), value(ie.value), time(eventTimeUsec(ie)) {}
 
 bool DeviceInputEvent::operator==(const DeviceInputEvent& o) const {
   return std::tie(type,code,value) == std::tie(o.type,o.code,o.value);
@@ -139,148 +163,6 @@ QDataStream& operator<<(QDataStream& s, const MappedAction& mia) {
   return mia.action->save(s);
 }
 
-// -------------------------------------------------------------------------------------------------
-namespace  {
-  struct Next;
-  // Map of Key event and the next possible key events.
-  using SynKeyEventMap = std::map<const KeyEvent, std::unique_ptr<Next>>;
-  using RefPair = SynKeyEventMap::value_type;
-  // Set of references to the next possible key event.
-  using RefSet = std::set<const RefPair*>;
-
-  struct Next {
-    std::shared_ptr<Action> action;
-    RefSet next_events;
-  };
-
-  // Helper function
-  size_t maxSequenceLength(const InputMapConfig& config)
-  {
-    const auto max = std::max_element(config.cbegin(), config.cend(),
-    [](const auto& a, const auto& b){
-      return a.first.size() < b.first.size();
-    });
-
-    return ((max == config.cend()) ? 0 : max->first.size());
-  }
-
-  // Internal data structure for keeping track of key events and checking if a configured
-  // key event sequence was pressed. Needs to be completely reconstructed/reconfigured
-  // if the configuration changes.
-  struct DeviceKeyMap
-  {
-    DeviceKeyMap(const InputMapConfig& config = {}) { reconfigure(config); }
-
-    enum Result : uint8_t {
-      Miss, Valid, Hit, PartialHit
-    };
-
-    Result feed(const struct input_event input_events[], size_t num);
-
-    auto state() const { return m_pos; }
-    void resetState();
-    void reconfigure(const InputMapConfig& config = {});
-    bool hasConfig() const { return m_keymaps.size(); }
-
-  private:
-    const RefPair* m_pos = nullptr;
-    std::vector<SynKeyEventMap> m_keymaps;
-  };
-}
-
-// -------------------------------------------------------------------------------------------------
-DeviceKeyMap::Result DeviceKeyMap::feed(const struct input_event input_events[], size_t num)
-{
-  if (!hasConfig()) return Result::Miss;
-
-  if (m_pos == nullptr)
-  {
-    const auto find_it = m_keymaps[0].find(KeyEvent(input_events, input_events + num));
-    if (find_it == m_keymaps[0].cend()) return Result::Miss;
-    m_pos = &(*find_it);
-  }
-  else
-  {
-    if (!m_pos->second) return Result::Miss;
-
-    const auto ke = KeyEvent(KeyEvent(input_events, input_events + num));
-    const auto& set = m_pos->second->next_events;
-    const auto find_it = std::find_if(set.cbegin(), set.cend(), [&ke](RefPair const* next_ptr) {
-      return ke == next_ptr->first;
-    });
-
-    if (find_it == set.cend()) return Result::Miss;
-
-    m_pos = (*find_it);
-  }
-
-  // Last KeyEvent in possible sequence...
-  if (!m_pos->second || m_pos->second->next_events.empty()) {
-    return Result::Hit;
-  }
-
-  // KeyEvent in Sequence has action attached, but there are other possible sequences...
-  if (m_pos->second->action && !m_pos->second->action->empty()) {
-    return Result::PartialHit;
-  }
-
-  return Result::Valid;
-}
-
-// -------------------------------------------------------------------------------------------------
-void DeviceKeyMap::resetState()
-{
-  m_pos = nullptr;
-}
-
-// -------------------------------------------------------------------------------------------------
-void DeviceKeyMap::reconfigure(const InputMapConfig& config)
-{
-  m_keymaps.resize(maxSequenceLength(config));
-
-  // -- clear maps + state
-  resetState();
-  for (auto& synKeyEventMap : m_keymaps) { synKeyEventMap.clear(); }
-
-  // -- fill maps
-  for (const auto& item: config)
-  {
-    if (!item.second.action || item.second.action->empty()) continue;
-
-    const auto& kes = item.first;
-    for (size_t i = 0; i < kes.size(); ++i) {
-      m_keymaps[i].emplace(kes[i], nullptr);
-    }
-  }
-
-  // -- fill references
-  for (const auto& item: config)
-  {
-    if (!item.second.action || item.second.action->empty()) continue;
-
-    const auto& kes = item.first;
-    for (size_t i = 0; i < kes.size(); ++i)
-    {
-      const auto r = m_keymaps[i].equal_range(kes[i]);
-      if (r.first == r.second) continue;
-      auto& refobj = r.first->second;
-      if (!refobj) {
-        refobj = std::make_unique<Next>();
-      }
-
-      if (i == kes.size() - 1) { // last keyevent in seq
-        refobj->action = item.second.action;
-      }
-      else if (i+1 < m_keymaps.size()) // if not last keyevent in seq
-      {
-        const auto r = m_keymaps[i+1].equal_range(kes[i+1]);
-        if (r.first == r.second) continue;
-        refobj->next_events.emplace(&(*r.first));
-      }
-    }
-  }
-}
-
 // -------------------------------------------------------------------------------------------------
 // -------------------------------------------------------------------------------------------------
 NativeKeySequence::NativeKeySequence() = default;
@@ -292,7 +174,8 @@ NativeKeySequence::NativeKeySequence(const std::vector<int>& qtKeys,
   : m_keySequence(makeQKeySequence(qtKeys))
   , m_nativeSequence(std::move(kes))
   , m_nativeModifiers(std::move(nativeModifiers))
-{ 
+{
+  updateNativeEvents();
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -317,6 +200,7 @@ void NativeKeySequence::clear()
   m_keySequence = QKeySequence{};
   m_nativeModifiers.clear();
   m_nativeSequence.clear();
+  m_nativeEvents.clear();
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -422,6 +306,35 @@ void NativeKeySequence::swap(NativeKeySequence& other)
   m_keySequence.swap(other.m_keySequence);
   m_nativeSequence.swap(other.m_nativeSequence);
   m_nativeModifiers.swap(other.m_nativeModifiers);
+  m_nativeEvents.swap(other.m_nativeEvents);
+}
+
+// -------------------------------------------------------------------------------------------------
+void NativeKeySequence::updateNativeEvents()
+{
+  size_t count = 0;
+  for (const auto& ke : m_nativeSequence) count += ke.size();
+
+  // The QByteArray data is suitably aligned for input_event.
+  m_nativeEvents.resize(static_cast<int>(count * sizeof(input_event)));
+  auto events = reinterpret_cast<input_event*>(m_nativeEvents.data());
+  for (const auto& ke : m_nativeSequence)
+  {
+    for (const auto& ie : ke)
+      *events++ = input_event{{}, ie.type, ie.code, ie.value};
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+const struct input_event* NativeKeySequence::nativeEvents() const
+{
+  return reinterpret_cast<const input_event*>(m_nativeEvents.constData());
+}
+
+// -------------------------------------------------------------------------------------------------
+size_t NativeKeySequence::nativeEventCount() const
+{
+  return static_cast<size_t>(m_nativeEvents.size()) / sizeof(input_event);
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -440,6 +353,7 @@ const NativeKeySequence& NativeKeySequence::predefined::altTab()
     released.emplace_back(EV_SYN, SYN_REPORT, 0);
     ks.m_nativeSequence.emplace_back(std::move(pressed));
     ks.m_nativeSequence.emplace_back(std::move(released));
+    ks.updateNativeEvents();
     return ks;
   }();
   return ks;
@@ -461,6 +375,7 @@ const NativeKeySequence& NativeKeySequence::predefined::altF4()
     released.emplace_back(EV_SYN, SYN_REPORT, 0);
     ks.m_nativeSequence.emplace_back(std::move(pressed));
     ks.m_nativeSequence.emplace_back(std::move(released));
+    ks.updateNativeEvents();
     return ks;
   }();
   return ks;
@@ -479,11 +394,51 @@ const NativeKeySequence& NativeKeySequence::predefined::meta()
     released.emplace_back(EV_SYN, SYN_REPORT, 0);
     ks.m_nativeSequence.emplace_back(std::move(pressed));
     ks.m_nativeSequence.emplace_back(std::move(released));
+    ks.updateNativeEvents();
     return ks;
   }();
   return ks;
 }
 
+// -------------------------------------------------------------------------------------------------
+namespace {
+  // Single shot timer for key sequence timeouts. It does not need an event loop, the
+  // InputEngine thread polls the remaining time and triggers the timeout processing.
+  // The timer is started at the (kernel) time of an input event, not at the time the event
+  // was processed, so a busy system does not change the outcome of a key sequence.
+  class SequenceTimer
+  {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    int interval() const { return m_interval; }
+    void setInterval(int msec) { m_interval = msec; }
+    bool isActive() const { return m_active; }
+    void stop() { m_active = false; }
+
+    void start(Clock::time_point from) {
+      m_deadline = from + std::chrono::milliseconds(m_interval);
+      m_active = true;
+    }
+
+    bool hasExpired(Clock::time_point at = Clock::now()) const {
+      return m_active && at >= m_deadline;
+    }
+
+    int remainingTime() const
+    {
+      if (!m_active) return -1;
+      const auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(m_deadline - Clock::now());
+      return (remaining.count() <= 0) ? 0 : static_cast<int>((remaining.count() + 999) / 1000);
+    }
+
+  private:
+    std::atomic<int> m_interval{250};
+    bool m_active = false;
+    Clock::time_point m_deadline;
+  };
+}
+
 // -------------------------------------------------------------------------------------------------
 // -------------------------------------------------------------------------------------------------
 struct InputMapper::Impl
@@ -492,18 +447,27 @@ struct InputMapper::Impl
 
   void sequenceTimeout();
   void resetState();
-  void record(const struct input_event input_events[], size_t num);
+  void loadPendingConfiguration(); // m_mutex must be held
+  void record(const struct input_event input_events[], size_t num, SequenceTimer::Clock::time_point time);
+  SequenceTimer::Clock::time_point eventTime(const struct input_event& ie) const;
   void emitNativeKeySequence(const NativeKeySequence& ks);
+  void emitBatch();
   void execAction(const std::shared_ptr<Action>& action, DeviceKeyMap::Result r);
 
   InputMapper* m_parent = nullptr;
   std::shared_ptr<VirtualDevice> m_vdev; // can be a nullptr if application is started without uinput
-  QTimer* m_seqTimer = nullptr;
+  mutable std::mutex m_mutex; // guards state shared between GUI and InputEngine thread
+  SequenceTimer m_seqTimer;
   DeviceKeyMap m_keymap;
+  InputLatencyStatistics m_latency;
+  std::atomic<bool> m_relEventCoalescing{false};
+  bool m_virtualTime = false;
 
-  std::pair<DeviceKeyMap::Result, const RefPair*> m_lastState;
+  std::pair<DeviceKeyMap::Result, const DeviceKeyMap::State*> m_lastState;
   std::vector<input_event> m_events;
+  InputEventBatch m_batch; // staging buffer for all events of one action or forwarded sequence
   InputMapConfig m_config;
+  InputMapper::ConfigurationLoader m_configLoader; // pending configuration, loaded on first use
   bool m_recordingMode = false;
 };
 
@@ -511,11 +475,7 @@ struct InputMapper::Impl
 InputMapper::Impl::Impl(InputMapper* parent, std::shared_ptr<VirtualDevice> vdev)
   : m_parent(parent)
   , m_vdev(std::move(vdev))
-  , m_seqTimer(new QTimer(parent))
 {
-  m_seqTimer->setSingleShot(true);
-  m_seqTimer->setInterval(250);
-  connect(m_seqTimer, &QTimer::timeout, parent, [this](){ sequenceTimeout(); });
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -553,19 +513,22 @@ void InputMapper::Impl::sequenceTimeout()
     if (m_vdev && m_events.size())
     {
       m_vdev->emitEvents(m_events);
+      m_latency.record(InputPath::SequenceTimeout, eventTimeUsec(m_events.back()));
     }
     resetState();
   }
   else if (m_lastState.first == DeviceKeyMap::Result::PartialHit) {
     // Last input could have triggered an action, but we needed to wait for the timeout, since
     // other sequences could have been possible.
-    if (m_lastState.second->second)
+    if (m_lastState.second)
     {
-      execAction(m_lastState.second->second->action, DeviceKeyMap::Result::PartialHit);
+      execAction(m_lastState.second->action, DeviceKeyMap::Result::PartialHit);
+      if (m_events.size()) m_latency.record(InputPath::MappedAction, eventTimeUsec(m_events.back()));
     }
     else if (m_vdev && m_events.size())
     {
       m_vdev->emitEvents(m_events);
+      m_latency.record(InputPath::SequenceTimeout, eventTimeUsec(m_events.back()));
       m_events.resize(0);
     }
     resetState();
@@ -579,35 +542,62 @@ void InputMapper::Impl::resetState()
   m_events.resize(0);
 }
 
+// -------------------------------------------------------------------------------------------------
+void InputMapper::Impl::loadPendingConfiguration()
+{
+  const auto loader = std::move(m_configLoader);
+  m_configLoader = nullptr;
+  m_config = loader();
+  resetState();
+  m_keymap.reconfigure(m_config);
+}
+
 // -------------------------------------------------------------------------------------------------
 void InputMapper::Impl::emitNativeKeySequence(const NativeKeySequence& ks)
 {
   if (!m_vdev) return;
 
-  std::vector<input_event> events;
-  events.reserve(5); // up to 3 modifier keys + 1 key + 1 syn event
-  for (const auto& ke : ks.nativeSequence())
-  {
-    for (const auto& ie : ke)
-      events.emplace_back(input_event{{}, ie.type, ie.code, ie.value});
+  // All key events of the sequence (each closed by a syn event) are written at once, directly
+  // from the precompiled events of the sequence.
+  m_batch.append(ks.nativeEvents(), ks.nativeEventCount());
+  emitBatch();
+}
 
-    m_vdev->emitEvents(events);
-    events.resize(0);
-  }
+// -------------------------------------------------------------------------------------------------
+void InputMapper::Impl::emitBatch()
+{
+  if (m_vdev) m_vdev->emitEvents(m_batch);
+  m_batch.clear();
 }
 
 // -------------------------------------------------------------------------------------------------
-void InputMapper::Impl::record(const struct input_event input_events[], size_t num)
+void InputMapper::Impl::record(const struct input_event input_events[], size_t num,
+                               SequenceTimer::Clock::time_point time)
 {
   const auto ev = KeyEvent(input_events, input_events + num);
 
-  if (!m_seqTimer->isActive()) {
+  if (!m_seqTimer.isActive()) {
     emit m_parent->recordingStarted();
   }
-  m_seqTimer->start();
+  m_seqTimer.start(time);
   emit m_parent->keyEventRecorded(ev);
 }
 
+// -------------------------------------------------------------------------------------------------
+SequenceTimer::Clock::time_point InputMapper::Impl::eventTime(const struct input_event& ie) const
+{
+  using Clock = SequenceTimer::Clock;
+  // Event devices are switched to CLOCK_MONOTONIC (see SubEventConnection::create), which is
+  // what the steady clock uses on Linux. Fall back to the current time for events with a
+  // timestamp from another clock, e.g. if the device could not be switched to monotonic time.
+  constexpr std::chrono::seconds maxEventAge{5};
+  const auto time = Clock::time_point(std::chrono::microseconds(eventTimeUsec(ie)));
+  if (m_virtualTime) return time;
+
+  const auto now = Clock::now();
+  return (time > now || now - time > maxEventAge) ? now : time;
+}
+
 // -------------------------------------------------------------------------------------------------
 // -------------------------------------------------------------------------------------------------
 InputMapper::InputMapper(std::shared_ptr<VirtualDevice> virtualDevice, QObject* parent)
@@ -633,6 +623,18 @@ bool InputMapper::hasVirtualDevice() const
   return !!(impl->m_vdev);
 }
 
+// -------------------------------------------------------------------------------------------------
+InputLatencyStatistics& InputMapper::latencyStatistics()
+{
+  return impl->m_latency;
+}
+
+// -------------------------------------------------------------------------------------------------
+const InputLatencyStatistics& InputMapper::latencyStatistics() const
+{
+  return impl->m_latency;
+}
+
 // -------------------------------------------------------------------------------------------------
 bool InputMapper::recordingMode() const
 {
@@ -642,29 +644,80 @@ bool InputMapper::recordingMode() const
 // -------------------------------------------------------------------------------------------------
 void InputMapper::setRecordingMode(bool recording)
 {
-  if (impl->m_recordingMode == recording)
-    return;
+  bool wasRecording = false;
+  {
+    std::lock_guard<std::mutex> lock(impl->m_mutex);
+    if (impl->m_recordingMode == recording)
+      return;
 
-  const auto wasRecording = (impl->m_recordingMode && impl->m_seqTimer->isActive());
-  impl->m_recordingMode = recording;
+    wasRecording = (impl->m_recordingMode && impl->m_seqTimer.isActive());
+    impl->m_recordingMode = recording;
+    impl->m_seqTimer.stop();
+    impl->resetState();
+  }
 
+  // Emit signals without holding the lock, receivers might call back into the input mapper.
   if (wasRecording) emit recordingFinished(true);
-  impl->m_seqTimer->stop();
-  resetState();
-  emit recordingModeChanged(impl->m_recordingMode);
+  emit recordingModeChanged(recording);
 }
 
 // -------------------------------------------------------------------------------------------------
 int InputMapper::keyEventInterval() const
 {
-  return impl->m_seqTimer->interval();
+  return impl->m_seqTimer.interval();
 }
 
 // -------------------------------------------------------------------------------------------------
 void InputMapper::setKeyEventInterval(int interval)
 {
-  impl->m_seqTimer->setInterval(std::min(Settings::inputSequenceIntervalRange().max,
-                                std::max(Settings::inputSequenceIntervalRange().min, interval)));
+  impl->m_seqTimer.setInterval(std::min(int(MaxKeyEventInterval), std::max(int(MinKeyEventInterval), interval)));
+}
+
+// -------------------------------------------------------------------------------------------------
+bool InputMapper::relEventCoalescing() const
+{
+  return impl->m_relEventCoalescing;
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputMapper::setRelEventCoalescing(bool coalesce)
+{
+  impl->m_relEventCoalescing = coalesce;
+}
+
+// -------------------------------------------------------------------------------------------------
+int InputMapper::remainingTimeout() const
+{
+  std::lock_guard<std::mutex> lock(impl->m_mutex);
+  return impl->m_seqTimer.remainingTime();
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputMapper::processTimeout()
+{
+  std::lock_guard<std::mutex> lock(impl->m_mutex);
+  if (!impl->m_seqTimer.hasExpired()) return;
+
+  impl->m_seqTimer.stop();
+  impl->sequenceTimeout();
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputMapper::processTimeout(int64_t timeUsec)
+{
+  std::lock_guard<std::mutex> lock(impl->m_mutex);
+  const auto time = SequenceTimer::Clock::time_point(std::chrono::microseconds(timeUsec));
+  if (!impl->m_seqTimer.hasExpired(time)) return;
+
+  impl->m_seqTimer.stop();
+  impl->sequenceTimeout();
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputMapper::setVirtualTime(bool virtualTime)
+{
+  std::lock_guard<std::mutex> lock(impl->m_mutex);
+  impl->m_virtualTime = virtualTime;
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -672,10 +725,14 @@ void InputMapper::addEvents(const input_event* input_events, size_t num)
 {
   if (num == 0 || (!impl->m_vdev)) return;
 
+  std::lock_guard<std::mutex> lock(impl->m_mutex);
+  if (impl->m_configLoader) impl->loadPendingConfiguration();
+
   // If no key mapping is configured ...
   if (!impl->m_recordingMode && !impl->m_keymap.hasConfig()) {
     if (impl->m_vdev) { // ... forward events to virtual device if it exists...
       impl->m_vdev->emitEvents(input_events, num);
+      impl->m_latency.record(InputPath::Forwarded, eventTimeUsec(input_events[num-1]));
     } // ... end return
     return;
   }
@@ -699,10 +756,19 @@ void InputMapper::addEvents(const input_event* input_events, size_t num)
     ++input_events; --num;
   }
 
+  // Key event interval decisions are based on the time the events happened. If the events are
+  // processed late, the timeout of a pending sequence must be handled before the new events.
+  const auto eventTime = impl->eventTime(input_events[num-1]);
+  if (impl->m_seqTimer.hasExpired(eventTime))
+  {
+    impl->m_seqTimer.stop();
+    impl->sequenceTimeout();
+  }
+
   if (impl->m_recordingMode)
   {
     logDebug(input) << "Recorded device event:" << KeyEvent{input_events, input_events + num - 1};
-    impl->record(input_events, num-1); // exclude closing syn event for recording
+    impl->record(input_events, num-1, eventTime); // exclude closing syn event for recording
     return;
   }
 
@@ -710,21 +776,21 @@ void InputMapper::addEvents(const input_event* input_events, size_t num)
 
   if (res == DeviceKeyMap::Result::Miss)
   { // key sequence miss, send all buffered events so far + current event
-    impl->m_seqTimer->stop();
+    impl->m_seqTimer.stop();
     if (impl->m_vdev)
     {
-      if (impl->m_events.size()) {
-        impl->m_vdev->emitEvents(impl->m_events);
-        impl->m_events.resize(0);
-      }
-      impl->m_vdev->emitEvents(input_events, num);
+      impl->m_batch.append(impl->m_events);
+      impl->m_batch.append(input_events, num);
+      impl->emitBatch();
+      impl->m_events.resize(0);
+      impl->m_latency.record(InputPath::Forwarded, eventTimeUsec(input_events[num-1]));
     }
     impl->m_keymap.resetState();
   }
   else if (res == DeviceKeyMap::Result::Valid)
   { // KeyEvent is part of valid key sequence.
     impl->m_lastState = std::make_pair(res, impl->m_keymap.state());
-    impl->m_seqTimer->start();
+    impl->m_seqTimer.start(eventTime);
     if (impl->m_vdev) {
       impl->m_events.reserve(impl->m_events.size() + num);
       std::copy(input_events, input_events + num, std::back_inserter(impl->m_events));
@@ -732,16 +798,19 @@ void InputMapper::addEvents(const input_event* input_events, size_t num)
   }
   else if (res == DeviceKeyMap::Result::Hit)
   { // Found a valid key sequence
-    impl->m_seqTimer->stop();
+    impl->m_seqTimer.stop();
     if (impl->m_vdev)
     {
-      if (impl->m_keymap.state()->second) {
-        impl->execAction(impl->m_keymap.state()->second->action, DeviceKeyMap::Result::Hit);
+      if (impl->m_keymap.state()) {
+        impl->execAction(impl->m_keymap.state()->action, DeviceKeyMap::Result::Hit);
+        impl->m_latency.record(InputPath::MappedAction, eventTimeUsec(input_events[num-1]));
       }
       else
       {
-        if (impl->m_events.size()) impl->m_vdev->emitEvents(impl->m_events);
-        impl->m_vdev->emitEvents(input_events, num);
+        impl->m_batch.append(impl->m_events);
+        impl->m_batch.append(input_events, num);
+        impl->emitBatch();
+        impl->m_latency.record(InputPath::Forwarded, eventTimeUsec(input_events[num-1]));
       }
     }
     impl->resetState();
@@ -749,7 +818,7 @@ void InputMapper::addEvents(const input_event* input_events, size_t num)
   else if (res == DeviceKeyMap::Result::PartialHit)
   { // Found a valid key sequence, but are still more valid sequences possible -> start timer
     impl->m_lastState = std::make_pair(res, impl->m_keymap.state());
-    impl->m_seqTimer->start();
+    impl->m_seqTimer.start(eventTime);
     if (impl->m_vdev) {
       impl->m_events.reserve(impl->m_events.size() + num);
       std::copy(input_events, input_events + num, std::back_inserter(impl->m_events));
@@ -757,38 +826,84 @@ void InputMapper::addEvents(const input_event* input_events, size_t num)
   }
 }
 
+// -------------------------------------------------------------------------------------------------
+size_t InputMapper::addFrames(const input_event* input_events, size_t num)
+{
+  size_t frames = 0;
+  size_t frameStart = 0;
+  for (size_t i = 0; i < num; ++i)
+  {
+    if (input_events[i].type != EV_SYN) continue;
+
+    addEvents(&input_events[frameStart], i + 1 - frameStart);
+    frameStart = i + 1;
+    ++frames;
+  }
+  return frames;
+}
+
 // -------------------------------------------------------------------------------------------------
 void InputMapper::resetState()
 {
+  std::lock_guard<std::mutex> lock(impl->m_mutex);
   impl->resetState();
 }
 
 // -------------------------------------------------------------------------------------------------
 void InputMapper::setConfiguration(const InputMapConfig& config)
 {
+  loadConfiguration();
   if (config == impl->m_config) return;
 
-  impl->m_config = config;
-  impl->resetState();
-  impl->m_keymap.reconfigure(impl->m_config);
+  {
+    std::lock_guard<std::mutex> lock(impl->m_mutex);
+    impl->m_config = config;
+    impl->resetState();
+    impl->m_keymap.reconfigure(impl->m_config);
+  }
   emit configurationChanged();
 }
 
 // -------------------------------------------------------------------------------------------------
 void InputMapper::setConfiguration(InputMapConfig&& config)
 {
+  loadConfiguration();
   if (config == impl->m_config) return;
 
-  impl->m_config.swap(config);
-  impl->resetState();
-  impl->m_keymap.reconfigure(impl->m_config);
+  {
+    std::lock_guard<std::mutex> lock(impl->m_mutex);
+    impl->m_config.swap(config);
+    impl->resetState();
+    impl->m_keymap.reconfigure(impl->m_config);
+  }
   emit configurationChanged();
 }
 
 // -------------------------------------------------------------------------------------------------
 const InputMapConfig& InputMapper::configuration() const
 {
+  {
+    std::lock_guard<std::mutex> lock(impl->m_mutex);
+    if (impl->m_configLoader) impl->loadPendingConfiguration();
+  }
   return impl->m_config;
 }
 
+// -------------------------------------------------------------------------------------------------
+void InputMapper::setConfigurationLoader(ConfigurationLoader loader)
+{
+  std::lock_guard<std::mutex> lock(impl->m_mutex);
+  impl->m_config.clear();
+  impl->resetState();
+  impl->m_keymap.reconfigure(impl->m_config);
+  impl->m_configLoader = std::move(loader);
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputMapper::loadConfiguration()
+{
+  std::lock_guard<std::mutex> lock(impl->m_mutex);
+  if (impl->m_configLoader) impl->loadPendingConfiguration();
+}
+
 
@@ -1,6 +1,7 @@
 // This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -8,10 +9,12 @@
 #include <QKeySequence>
 #include <QObject>
 
+class InputLatencyStatistics;
 class VirtualDevice;
 
 // -------------------------------------------------------------------------------------------------
-/// This is basically the input_event struct from linux/input.h without the time member
+/// This is basically the input_event struct from linux/input.h. The kernel timestamp is kept
+/// in microseconds, but it is not part of comparisons or serialization.
 struct DeviceInputEvent
 {
   DeviceInputEvent() = default;
@@ -26,6 +29,7 @@ struct DeviceInputEvent
   uint16_t type;
   uint16_t code;
   int32_t  value;
+  int64_t  time = 0;
 
   bool operator==(const DeviceInputEvent& o) const;
   bool operator!=(const DeviceInputEvent& o) const;
@@ -34,6 +38,10 @@ struct DeviceInputEvent
   bool operator<(const struct input_event& o) const;
 };
 
+// -------------------------------------------------------------------------------------------------
+int64_t eventTimeUsec(const struct input_event& ie); // Kernel timestamp in microseconds
+void setEventTimeUsec(struct input_event& ie, int64_t usec);
+
 // -------------------------------------------------------------------------------------------------
 QDataStream& operator<<(QDataStream& s, const DeviceInputEvent& die);
 QDataStream& operator>>(QDataStream& s, DeviceInputEvent& die);
@@ -41,6 +49,7 @@ QDataStream& operator>>(QDataStream& s, DeviceInputEvent& die);
 // -------------------------------------------------------------------------------------------------
 /// KeyEvent is a sequence of DeviceInputEvent.
 using KeyEvent = std::vector<DeviceInputEvent>;
+Q_DECLARE_METATYPE(KeyEvent);
 
 /// KeyEventSequence is a sequence of KeyEvents.
 using KeyEventSequence = std::vector<KeyEvent>;
@@ -107,12 +116,17 @@ public:
   bool empty() const { return count() == 0; }
   const auto& keySequence() const { return m_keySequence; }
   const auto& nativeSequence() const { return m_nativeSequence; }
+  /// The native sequence as ready-to-write input events, rebuilt whenever the sequence changes.
+  const struct input_event* nativeEvents() const;
+  size_t nativeEventCount() const;
   QString toString() const;
 
   void clear();
 
   friend QDataStream& operator>>(QDataStream& s, NativeKeySequence& ks) {
-    return s >> ks.m_keySequence >> ks.m_nativeSequence >> ks.m_nativeModifiers;
+    s >> ks.m_keySequence >> ks.m_nativeSequence >> ks.m_nativeModifiers;
+    ks.updateNativeEvents();
+    return s;
   }
 
   friend QDataStream& operator<<(QDataStream& s, const NativeKeySequence& ks) {
@@ -130,9 +144,12 @@ public:
   };
 
 private:
+  void updateNativeEvents();
+
   QKeySequence m_keySequence;
   KeyEventSequence m_nativeSequence;
   std::vector<uint16_t> m_nativeModifiers;
+  QByteArray m_nativeEvents; // input_event blob, shared between copies
 };
 Q_DECLARE_METATYPE(NativeKeySequence)
 
@@ -187,6 +204,9 @@ struct ToggleSpotlightAction : public Action
   bool placeholder = false;
 };
 
+// -------------------------------------------------------------------------------------------------
+Q_DECLARE_METATYPE(std::shared_ptr<Action>);
+
 // -------------------------------------------------------------------------------------------------
 struct MappedAction
 {
@@ -202,18 +222,40 @@ QDataStream& operator<<(QDataStream& s, const MappedAction& mia);
 class InputMapConfig : public std::map<KeyEventSequence, MappedAction>{};
 
 // -------------------------------------------------------------------------------------------------
+/// The InputMapper is fed with input events and key sequence timeouts from the InputEngine
+/// thread, all other methods are called from the GUI thread. Signals are emitted from the
+/// thread that caused them.
 class InputMapper : public QObject
 {
   Q_OBJECT
 
 public:
+  // Valid range of the key event interval in milliseconds.
+  static constexpr int MinKeyEventInterval = 100;
+  static constexpr int MaxKeyEventInterval = 950;
+
   InputMapper(std::shared_ptr<VirtualDevice> virtualDevice, QObject* parent = nullptr);
   ~InputMapper();
 
   void resetState(); // Reset any stored sequence state.
 
-  // input_events = complete sequence including SYN event
+  // input_events = complete sequence including SYN event, the time of the SYN event is used
+  // as time of the whole sequence for key event interval decisions.
   void addEvents(const struct input_event input_events[], size_t num);
+  // input_events = one or more complete sequences, each closed by a SYN event. The sequences are
+  // passed to addEvents one by one, returns the number of sequences.
+  size_t addFrames(const struct input_event input_events[], size_t num);
+
+  // Milliseconds until a pending key sequence times out, -1 if there is no pending timeout.
+  int remainingTimeout() const;
+  // Handle a pending key sequence timeout if it has expired.
+  void processTimeout();
+  // Handle a pending key sequence timeout if it has expired at the given (virtual) time.
+  void processTimeout(int64_t timeUsec);
+
+  // Use event timestamps as they are, without checking them against the current time, e.g.
+  // for the deterministic replay of recorded events.
+  void setVirtualTime(bool virtualTime);
 
   bool recordingMode() const;
   void setRecordingMode(bool recording);
@@ -221,13 +263,27 @@ public:
   int keyEventInterval() const;
   void setKeyEventInterval(int interval);
 
+  // Merge relative mouse move events that are read from the device at once into a single
+  // event frame before they are forwarded to the virtual device (done by the InputEngine).
+  bool relEventCoalescing() const;
+  void setRelEventCoalescing(bool coalesce);
+
   std::shared_ptr<VirtualDevice> virtualDevice() const;
   bool hasVirtualDevice() const;
 
+  InputLatencyStatistics& latencyStatistics();
+  const InputLatencyStatistics& latencyStatistics() const;
+
   void setConfiguration(const InputMapConfig& config);
   void setConfiguration(InputMapConfig&& config);
   const InputMapConfig& configuration() const;
 
+  // Set a configuration that is loaded on first use: When the first events are fed or the
+  // configuration is requested. Does not emit configurationChanged.
+  using ConfigurationLoader = std::function<InputMapConfig()>;
+  void setConfigurationLoader(ConfigurationLoader loader);
+  void loadConfiguration(); // Load a pending configuration now.
+
 signals:
   void configurationChanged();
   void recordingModeChanged(bool recording);
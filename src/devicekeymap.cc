@@ -0,0 +1,158 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "devicekeymap.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include <linux/input.h>
+
+namespace {
+  // Hash over the packed (type, code, value) members of the input events of one frame.
+  template<typename Iterator>
+  uint64_t frameHash(Iterator begin, Iterator end)
+  {
+    uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a offset basis
+    for (auto it = begin; it != end; ++it)
+    {
+      const uint64_t packed = (uint64_t(it->type) << 48) | (uint64_t(it->code) << 32)
+                              | uint32_t(it->value);
+      hash = (hash ^ packed) * 0x100000001b3ull; // FNV-1a prime
+      hash ^= (hash >> 29);
+    }
+    return hash;
+  }
+
+  // Helper function
+  size_t maxSequenceLength(const InputMapConfig& config)
+  {
+    const auto max = std::max_element(config.cbegin(), config.cend(),
+    [](const auto& a, const auto& b){
+      return a.first.size() < b.first.size();
+    });
+
+    return ((max == config.cend()) ? 0 : max->first.size());
+  }
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+constexpr uint32_t DeviceKeyMap::rootState;
+
+// -------------------------------------------------------------------------------------------------
+bool DeviceKeyMap::matches(const State& s, const InputEventSpan& span) const
+{
+  if (s.eventsCount != span.size) return false;
+  const auto begin = m_events.cbegin() + s.eventsOffset;
+  return std::equal(begin, begin + s.eventsCount, span.data,
+  [](const DeviceInputEvent& die, const struct input_event& ie){ return die == ie; });
+}
+
+// -------------------------------------------------------------------------------------------------
+DeviceKeyMap::Result DeviceKeyMap::feed(const struct input_event input_events[], size_t num)
+{
+  if (!hasConfig()) return Result::Miss;
+
+  // Compare the received input events in place - no allocations on this path.
+  const InputEventSpan span{input_events, num};
+  const uint64_t hash = frameHash(input_events, input_events + num);
+
+  const auto& current = m_states[m_pos];
+  const auto first = m_transitions.cbegin() + current.transitionsOffset;
+  const auto last = first + current.transitionsCount;
+  auto it = std::lower_bound(first, last, hash, [](const Transition& t, uint64_t h) {
+    return t.hash < h;
+  });
+
+  for (; it != last && it->hash == hash; ++it) {
+    if (matches(m_states[it->target], span)) break;
+  }
+
+  if (it == last || it->hash != hash) return Result::Miss;
+  m_pos = it->target;
+
+  const auto& s = m_states[m_pos];
+  // Last KeyEvent in possible sequence...
+  if (s.transitionsCount == 0) {
+    return Result::Hit;
+  }
+
+  // KeyEvent in Sequence has action attached, but there are other possible sequences...
+  if (s.action && !s.action->empty()) {
+    return Result::PartialHit;
+  }
+
+  return Result::Valid;
+}
+
+// -------------------------------------------------------------------------------------------------
+void DeviceKeyMap::resetState()
+{
+  m_pos = rootState;
+}
+
+// -------------------------------------------------------------------------------------------------
+void DeviceKeyMap::reconfigure(const InputMapConfig& config)
+{
+  // -- clear automaton + state
+  resetState();
+  m_hasConfig = (maxSequenceLength(config) > 0);
+  m_states.assign(1, State{}); // root state
+  m_transitions.clear();
+  m_events.clear();
+
+  // -- create states, one for each key event at a sequence position
+  std::map<std::pair<size_t, KeyEvent>, uint32_t> stateIndex;
+  const auto getState = [this, &stateIndex](size_t pos, const KeyEvent& ke) -> uint32_t
+  {
+    const auto r = stateIndex.emplace(std::make_pair(pos, ke), static_cast<uint32_t>(m_states.size()));
+    if (r.second)
+    {
+      State s;
+      s.eventsOffset = static_cast<uint32_t>(m_events.size());
+      s.eventsCount = static_cast<uint32_t>(ke.size());
+      m_events.insert(m_events.end(), ke.cbegin(), ke.cend());
+      m_states.emplace_back(std::move(s));
+    }
+    return r.first->second;
+  };
+
+  // -- collect transitions and actions
+  std::set<std::pair<uint32_t, uint32_t>> edges;
+  for (const auto& item: config)
+  {
+    if (!item.second.action || item.second.action->empty()) continue;
+
+    const auto& kes = item.first;
+    uint32_t from = rootState;
+    for (size_t i = 0; i < kes.size(); ++i)
+    {
+      const uint32_t to = getState(i, kes[i]);
+      edges.emplace(from, to);
+      if (i == kes.size() - 1) { // last keyevent in seq
+        m_states[to].action = item.second.action;
+      }
+      from = to;
+    }
+  }
+
+  // -- flatten transitions, sorted by state and frame hash
+  m_transitions.reserve(edges.size());
+  for (const auto& edge : edges)
+  {
+    auto& s = m_states[edge.first];
+    if (s.transitionsCount == 0) s.transitionsOffset = static_cast<uint32_t>(m_transitions.size());
+    ++s.transitionsCount;
+    const auto& target = m_states[edge.second];
+    const auto eventsBegin = m_events.cbegin() + target.eventsOffset;
+    m_transitions.emplace_back(Transition{frameHash(eventsBegin, eventsBegin + target.eventsCount),
+                                          edge.second});
+  }
+
+  for (const auto& s : m_states)
+  {
+    const auto first = m_transitions.begin() + s.transitionsOffset;
+    std::sort(first, first + s.transitionsCount, [](const Transition& a, const Transition& b) {
+      return a.hash < b.hash;
+    });
+  }
+}
@@ -0,0 +1,66 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include "deviceinput.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct input_event;
+
+// -------------------------------------------------------------------------------------------------
+// Non-owning view on the input events of one frame, as received from the device.
+struct InputEventSpan {
+  const struct input_event* data;
+  size_t size;
+};
+
+// -------------------------------------------------------------------------------------------------
+// Internal data structure for keeping track of key events and checking if a configured
+// key event sequence was pressed. Needs to be completely reconstructed/reconfigured
+// if the configuration changes.
+//
+// The configuration is compiled into an automaton with one state per key event and
+// sequence position. All states, their key events and their transitions (sorted by frame
+// hash) are stored in contiguous arrays, feeding a frame is a binary search over the
+// transitions of the current state.
+struct DeviceKeyMap
+{
+  DeviceKeyMap(const InputMapConfig& config = {}) { reconfigure(config); }
+
+  enum Result : uint8_t {
+    Miss, Valid, Hit, PartialHit
+  };
+
+  struct State {
+    std::shared_ptr<Action> action; // Action of a configured sequence ending with this state
+    uint32_t eventsOffset = 0; // Key event of this state, range in m_events
+    uint32_t eventsCount = 0;
+    uint32_t transitionsOffset = 0; // Possible next states, range in m_transitions
+    uint32_t transitionsCount = 0;
+  };
+
+  Result feed(const struct input_event input_events[], size_t num);
+
+  const State* state() const { return (m_pos == rootState) ? nullptr : &m_states[m_pos]; }
+  void resetState();
+  void reconfigure(const InputMapConfig& config = {});
+  bool hasConfig() const { return m_hasConfig; }
+
+private:
+  struct Transition {
+    uint64_t hash;
+    uint32_t target;
+  };
+
+  static constexpr uint32_t rootState = 0;
+
+  bool matches(const State& s, const InputEventSpan& span) const;
+
+  uint32_t m_pos = rootState;
+  bool m_hasConfig = false;
+  std::vector<State> m_states;
+  std::vector<Transition> m_transitions;
+  std::vector<DeviceInputEvent> m_events;
+};
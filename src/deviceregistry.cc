@@ -0,0 +1,31 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "deviceregistry.h"
+
+// -------------------------------------------------------------------------------------------------
+DeviceRegistry::DeviceRegistry(const std::vector<SupportedDevice>& additionalDevices)
+{
+  m_additionalDevices.reserve(additionalDevices.size());
+  for (const auto& device : additionalDevices) {
+    m_additionalDevices.emplace(detail::deviceKey(device.vendorId, device.productId), device.name);
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+DeviceRegistry::Match DeviceRegistry::find(quint16 vendorId, quint16 productId) const
+{
+  Match match;
+  match.known = findKnownDevice(vendorId, productId);
+  if (!m_additionalDevices.empty())
+  {
+    const auto it = m_additionalDevices.find(detail::deviceKey(vendorId, productId));
+    if (it != m_additionalDevices.cend()) match.additionalName = &it->second;
+  }
+  return match;
+}
+
+// -------------------------------------------------------------------------------------------------
+QString DeviceRegistry::Match::name() const
+{
+  if (known && known->name[0] != '\0') return QString::fromUtf8(known->name);
+  return additionalName ? *additionalName : QString();
+}
@@ -0,0 +1,115 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include "devicescan.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// -------------------------------------------------------------------------------------------------
+/// Device known at compile time, from the default device list or devices.conf.
+struct KnownDevice
+{
+  quint16 vendorId;
+  quint16 productId;
+  bool isBluetooth;
+  const char* name;
+};
+
+namespace detail {
+  constexpr uint32_t deviceKey(quint16 vendorId, quint16 productId) {
+    return (static_cast<uint32_t>(vendorId) << 16) | productId;
+  }
+
+  constexpr uint32_t deviceHash(uint32_t key, uint32_t seed) {
+    const uint32_t h = (key ^ seed) * 0x9e3779b1u;
+    return h ^ (h >> 15);
+  }
+
+  constexpr size_t perfectHashTableSize(size_t numKeys) {
+    size_t size = 4;
+    while (size < 4 * numKeys) size *= 2;
+    return size;
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+/// Perfect hash table over vendor:product ids, built at compile time: The hash seed is searched
+/// until all devices map to different slots. For duplicate ids the first device wins.
+template<size_t N>
+class PerfectHashTable
+{
+  static_assert(N > 0 && N < 0x7fff, "Unsupported number of devices");
+
+public:
+  static constexpr size_t TableSize = detail::perfectHashTableSize(N);
+
+  constexpr explicit PerfectHashTable(const KnownDevice (&devices)[N])
+    : m_devices(devices)
+  {
+    for (uint32_t seed = 1; m_seed == 0; ++seed)
+    {
+      for (size_t i = 0; i < TableSize; ++i) m_slots[i] = -1;
+
+      bool collision = false;
+      for (size_t i = 0; i < N && !collision; ++i)
+      {
+        const auto key = detail::deviceKey(devices[i].vendorId, devices[i].productId);
+        const auto slot = detail::deviceHash(key, seed) & (TableSize - 1);
+        if (m_slots[slot] < 0) {
+          m_slots[slot] = static_cast<int16_t>(i);
+        }
+        else {
+          const auto& other = devices[m_slots[slot]];
+          collision = (key != detail::deviceKey(other.vendorId, other.productId));
+        }
+      }
+      if (!collision) m_seed = seed;
+    }
+  }
+
+  constexpr const KnownDevice* find(quint16 vendorId, quint16 productId) const
+  {
+    const auto key = detail::deviceKey(vendorId, productId);
+    const auto index = m_slots[detail::deviceHash(key, m_seed) & (TableSize - 1)];
+    if (index < 0) return nullptr;
+
+    const auto& device = m_devices[index];
+    return (detail::deviceKey(device.vendorId, device.productId) == key) ? &device : nullptr;
+  }
+
+  constexpr uint32_t seed() const { return m_seed; }
+
+private:
+  const KnownDevice* m_devices = nullptr;
+  uint32_t m_seed = 0;
+  int16_t m_slots[TableSize] = {};
+};
+
+// Lookup in the known devices, defined in the generated extra-devices.cc
+const KnownDevice* findKnownDevice(quint16 vendorId, quint16 productId);
+
+// -------------------------------------------------------------------------------------------------
+/// All supported devices: The known devices and the additional devices given at runtime, e.g.
+/// with the '--additional-device' command line option.
+class DeviceRegistry
+{
+public:
+  explicit DeviceRegistry(const std::vector<SupportedDevice>& additionalDevices = {});
+
+  struct Match
+  {
+    const KnownDevice* known = nullptr;
+    const QString* additionalName = nullptr;
+
+    explicit operator bool() const { return known || additionalName; }
+    /// User defined name, names of known devices take precedence.
+    QString name() const;
+  };
+
+  Match find(quint16 vendorId, quint16 productId) const;
+
+private:
+  std::unordered_map<uint32_t, QString> m_additionalDevices; // device key -> name
+};
@@ -1,70 +1,17 @@
 // This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
 #include "devicescan.h"
 
+#include "deviceregistry.h"
+
 #include <QDirIterator>
 #include <QFileInfo>
 #include <QTextStream>
 
 #include <linux/input.h>
 
-// Function declaration to check for extra devices, defintion in generated source
-bool isExtraDeviceSupported(quint16 vendorId, quint16 productId);
-QString getExtraDeviceName(quint16 vendorId, quint16 productId);
-
 namespace {
   class DeviceScan_ : public QObject {}; // for i18n and logging
 
-  // -----------------------------------------------------------------------------------------------
-  // List of supported devices
-  const std::array<SupportedDevice, 2> supportedDefaultDevices {{
-    {0x46d, 0xc53e, false, "Logitech Spotlight (USB)"},
-    {0x46d, 0xb503, true, "Logitech Spotlight (Bluetooth)"},
-  }};
-
-  // -----------------------------------------------------------------------------------------------
-  bool isDeviceSupported(quint16 vendorId, quint16 productId)
-  {
-    const auto it = std::find_if(supportedDefaultDevices.cbegin(), supportedDefaultDevices.cend(),
-    [vendorId, productId](const SupportedDevice& d) {
-      return (vendorId == d.vendorId) && (productId == d.productId);
-    });
-    return (it != supportedDefaultDevices.cend()) || isExtraDeviceSupported(vendorId, productId);
-  }
-
-  // -----------------------------------------------------------------------------------------------
-  bool isAdditionallySupported(quint16 vendorId, quint16 productId,
-                               const std::vector<SupportedDevice>& devices)
-  {
-    const auto it = std::find_if(devices.cbegin(), devices.cend(),
-    [vendorId, productId](const SupportedDevice& d) {
-      return (vendorId == d.vendorId) && (productId == d.productId);
-    });
-    return (it != devices.cend());
-  }
-
-  // -----------------------------------------------------------------------------------------------
-  // Return the defined device name for vendor/productId if defined in
-  // any of the supported device lists (default, extra, additional)
-  QString getUserDeviceName(quint16 vendorId, quint16 productId,
-                            const std::vector<SupportedDevice>& additionalDevices)
-  {
-    const auto it = std::find_if(supportedDefaultDevices.cbegin(), supportedDefaultDevices.cend(),
-    [vendorId, productId](const SupportedDevice& d) {
-      return (vendorId == d.vendorId) && (productId == d.productId);
-    });
-    if (it != supportedDefaultDevices.cend() && it->name.size()) return it->name;
-
-    auto extraName = getExtraDeviceName(vendorId, productId);
-    if (!extraName.isEmpty()) return extraName;
-
-    const auto ait = std::find_if(additionalDevices.cbegin(), additionalDevices.cend(),
-    [vendorId, productId](const SupportedDevice& d) {
-      return (vendorId == d.vendorId) && (productId == d.productId);
-    });
-    if (ait != additionalDevices.cend() && ait->name.size()) return ait->name;
-    return QString();
-  }
-
   // -----------------------------------------------------------------------------------------------
   quint64 readULongLongFromDeviceFile(const QString& filename)
   {
@@ -155,136 +102,234 @@ namespace {
     return spotlightDevice;
   }
 
+  // -----------------------------------------------------------------------------------------------
+  // List the sysfs entries the sub-devices of a HID device are read from, i.e.
+  // 'input/inputX/eventY' and 'hidraw/hidrawZ', without reading any files.
+  QStringList subDeviceNodes(const QString& hidDevicePath)
+  {
+    QStringList nodes;
+    QDirIterator inputIt(QDir(hidDevicePath).filePath("input"), QDir::System | QDir::Dirs | QDir::Executable | QDir::NoDotAndDotDot);
+    while (inputIt.hasNext())
+    {
+      inputIt.next();
+      QDirIterator dirIt(inputIt.filePath(), QDir::System | QDir::Dirs | QDir::Executable | QDir::NoDotAndDotDot);
+      while (dirIt.hasNext())
+      {
+        dirIt.next();
+        if (dirIt.fileName().startsWith("event")) nodes.push_back(inputIt.fileName() + "/" + dirIt.fileName());
+      }
+    }
+
+    QDirIterator hidrawIt(QDir(hidDevicePath).filePath("hidraw"), QDir::System | QDir::Dirs | QDir::Executable | QDir::NoDotAndDotDot);
+    while (hidrawIt.hasNext())
+    {
+      hidrawIt.next();
+      if (hidrawIt.fileName().startsWith("hidraw")) nodes.push_back(hidrawIt.fileName());
+    }
+
+    // Directory iteration order is not defined
+    nodes.sort();
+    return nodes;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Add input event and hidraw sub-devices of the HID device at the given sysfs path.
+  void addSubDevices(const QString& hidDevicePath, const QString& devRoot, DeviceScan::Device& rootDevice)
+  {
+    // Iterate over 'input' sub-dircectory, check for input-hid device nodes
+    const QFileInfo inputSubdir(QDir(hidDevicePath).filePath("input"));
+    if (inputSubdir.exists() || inputSubdir.isExecutable())
+    {
+      QDirIterator inputIt(inputSubdir.filePath(), QDir::System | QDir::Dirs | QDir::Executable | QDir::NoDotAndDotDot);
+      while (inputIt.hasNext())
+      {
+        inputIt.next();
+
+        DeviceScan::SubDevice subDevice;
+        QDirIterator dirIt(inputIt.filePath(), QDir::System | QDir::Dirs | QDir::Executable | QDir::NoDotAndDotDot);
+        while (dirIt.hasNext())
+        {
+          dirIt.next();
+          if (!dirIt.fileName().startsWith("event")) continue;
+          subDevice.type = DeviceScan::SubDevice::Type::Event;
+          subDevice.deviceFile = readPropertyFromDeviceFile(QDir(dirIt.filePath()).filePath("uevent"), "DEVNAME");
+          if (!subDevice.deviceFile.isEmpty()) {
+            subDevice.deviceFile = QDir(devRoot).filePath(subDevice.deviceFile);
+            break;
+          }
+        }
+
+        if (subDevice.deviceFile.isEmpty()) continue;
+        subDevice.phys = readStringFromDeviceFile(QDir(inputIt.filePath()).filePath("phys"));
+
+        // Check if device supports relative events
+        const auto supportedEvents = readULongLongFromDeviceFile(QDir(inputIt.filePath()).filePath("capabilities/ev"));
+        const bool hasRelativeEvents = !!(supportedEvents & (1 << EV_REL));
+
+        // Check if device supports relative x and y event types
+        const auto supportedRelEv = readULongLongFromDeviceFile(QDir(inputIt.filePath()).filePath("capabilities/rel"));
+        const bool hasRelXEvents = !!(supportedRelEv & (1 << REL_X));
+        const bool hasRelYEvents = !!(supportedRelEv & (1 << REL_Y));
+
+        subDevice.hasRelativeEvents = hasRelativeEvents && hasRelXEvents && hasRelYEvents;
+
+        const QFileInfo fi(subDevice.deviceFile);
+        subDevice.deviceReadable = fi.isReadable();
+        subDevice.deviceWritable = fi.isWritable();
+
+        rootDevice.subDevices.emplace_back(std::move(subDevice));
+      }
+    }
+
+    // For the Logitech Spotlight we are only interested in the hidraw sub device that has no event
+    // device, if there is already an event device we skip hidraw detection for this sub-device.
+    const bool hasInputEventDevices
+        = std::any_of(rootDevice.subDevices.cbegin(), rootDevice.subDevices.cend(),
+          [](const DeviceScan::SubDevice& sd) { return sd.type == DeviceScan::SubDevice::Type::Event; });
+
+    if (hasInputEventDevices) return;
+
+    // Iterate over 'hidraw' sub-dircectory, check for hidraw device node
+    const QFileInfo hidrawSubdir(QDir(hidDevicePath).filePath("hidraw"));
+    if (hidrawSubdir.exists() || hidrawSubdir.isExecutable())
+    {
+      QDirIterator hidrawIt(hidrawSubdir.filePath(), QDir::System | QDir::Dirs | QDir::Executable | QDir::NoDotAndDotDot);
+      while (hidrawIt.hasNext())
+      {
+        hidrawIt.next();
+        if (!hidrawIt.fileName().startsWith("hidraw")) continue;
+        DeviceScan::SubDevice subDevice;
+        subDevice.deviceFile = readPropertyFromDeviceFile(QDir(hidrawIt.filePath()).filePath("uevent"), "DEVNAME");
+        if (!subDevice.deviceFile.isEmpty()) {
+          subDevice.type = DeviceScan::SubDevice::Type::Hidraw;
+          subDevice.deviceFile = QDir(devRoot).filePath(subDevice.deviceFile);
+          if (subDevice.deviceFile.isEmpty()) continue;
+          const QFileInfo fi(subDevice.deviceFile);
+          subDevice.deviceReadable = fi.isReadable();
+          subDevice.deviceWritable = fi.isWritable();
+
+          rootDevice.subDevices.emplace_back(std::move(subDevice));
+        }
+      }
+    }
+  }
 }
 
 namespace DeviceScan {
   // -----------------------------------------------------------------------------------------------
-  ScanResult getDevices(const std::vector<SupportedDevice>& additionalDevices)
+  ScanResult getDevices(const std::vector<SupportedDevice>& additionalDevices, const Roots& roots)
   {
-    constexpr char hidDevicePath[] = "/sys/bus/hid/devices";
+    return ScanCache(roots).getDevices(additionalDevices);
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  ScanCache::ScanCache(const Roots& roots)
+    : m_roots(roots), m_hidDevicePath(roots.hidDevicePath()) {}
 
+  // -----------------------------------------------------------------------------------------------
+  ScanResult ScanCache::getDevices(const std::vector<SupportedDevice>& additionalDevices)
+  {
     ScanResult result;
-    const QFileInfo dpInfo(hidDevicePath);
+    const QFileInfo dpInfo(m_hidDevicePath);
 
     if (!dpInfo.exists()) {
-      result.errorMessages.push_back(DeviceScan_::tr("HID device path '%1' does not exist.").arg(hidDevicePath));
+      result.errorMessages.push_back(DeviceScan_::tr("HID device path '%1' does not exist.").arg(m_hidDevicePath));
       return result;
     }
 
     if (!dpInfo.isExecutable()) {
-      result.errorMessages.push_back(DeviceScan_::tr("HID device path '%1': Cannot list files.").arg(hidDevicePath));
+      result.errorMessages.push_back(DeviceScan_::tr("HID device path '%1': Cannot list files.").arg(m_hidDevicePath));
       return result;
     }
 
-    QDirIterator hidIt(hidDevicePath, QDir::System | QDir::Dirs | QDir::Executable | QDir::NoDotAndDotDot);
+    ++m_generation;
+    ++m_statistics.scans;
+    const DeviceRegistry registry(additionalDevices);
+
+    QDirIterator hidIt(m_hidDevicePath, QDir::System | QDir::Dirs | QDir::Executable | QDir::NoDotAndDotDot);
     while (hidIt.hasNext())
     {
       hidIt.next();
 
-      const QFileInfo uEventFile(QDir(hidIt.filePath()).filePath("uevent"));
-      if (!uEventFile.exists()) continue;
-
-      // Get basic information from uevent file
-      Device newDevice = deviceFromUEventFile(uEventFile.filePath());
-      const auto& deviceId = newDevice.id;
-      // Skip unsupported devices
-      if (deviceId.vendorId == 0 || deviceId.productId == 0) continue;
-      if (!isDeviceSupported(deviceId.vendorId, deviceId.productId)
-          && !(isAdditionallySupported(deviceId.vendorId, deviceId.productId, additionalDevices))) continue;
+      // HID device directory names contain a unique sequence number (e.g. 0003:046D:C53E.0004),
+      // a re-attached device gets a new entry.
+      auto it = m_entries.find(hidIt.fileName());
+      const bool isNewEntry = (it == m_entries.end());
+      if (isNewEntry)
+      {
+        Entry entry;
+        // Get basic information from uevent file, devices without will be negative entries.
+        const QFileInfo uEventFile(QDir(hidIt.filePath()).filePath("uevent"));
+        if (uEventFile.exists()) {
+          entry.device = deviceFromUEventFile(uEventFile.filePath());
+        }
+        it = m_entries.emplace(hidIt.fileName(), std::move(entry)).first;
+        ++m_statistics.added;
+      }
 
-      // Check if device is already in list (and we have another sub-device for it)
-      const auto find_it = std::find_if(result.devices.begin(), result.devices.end(),
-      [&newDevice](const Device& existingDevice){
-        return existingDevice.id == newDevice.id;
-      });
+      Entry& entry = it->second;
+      entry.generation = m_generation;
 
-      Device& rootDevice = [&find_it, &result, &newDevice, &additionalDevices]() -> Device&
+      // Skip unsupported devices, the support check does not touch the file system.
+      const auto& deviceId = entry.device.id;
+      const auto match = (deviceId.vendorId == 0 || deviceId.productId == 0)
+                         ? DeviceRegistry::Match() : registry.find(deviceId.vendorId, deviceId.productId);
+      if (!match)
       {
-        if (find_it == result.devices.end())
-        {
-          newDevice.userName = getUserDeviceName(newDevice.id.vendorId, newDevice.id.productId, additionalDevices);
-          result.devices.emplace_back(std::move(newDevice));
-          return result.devices.back();
-        }
-        return *find_it;
-      }();
+        if (!isNewEntry) ++m_statistics.negativeHits;
+        continue;
+      }
 
-      // Iterate over 'input' sub-dircectory, check for input-hid device nodes
-      const QFileInfo inputSubdir(QDir(hidIt.filePath()).filePath("input"));
-      if (inputSubdir.exists() || inputSubdir.isExecutable())
+      // Sub-devices (e.g. input event devices) might show up later than the HID device itself,
+      // only re-read them if the sysfs sub-device entries changed.
+      auto nodes = subDeviceNodes(hidIt.filePath());
+      if (!entry.subDevicesScanned || nodes != entry.subDeviceNodes)
+      {
+        if (entry.subDevicesScanned) ++m_statistics.changed;
+        entry.device.subDevices.clear();
+        addSubDevices(hidIt.filePath(), m_roots.dev, entry.device);
+        entry.subDeviceNodes = std::move(nodes);
+        entry.subDevicesScanned = true;
+      }
+      else
       {
-        QDirIterator inputIt(inputSubdir.filePath(), QDir::System | QDir::Dirs | QDir::Executable | QDir::NoDotAndDotDot);
-        while (inputIt.hasNext())
+        ++m_statistics.hits;
+        // Device node permissions can change after the device appeared (e.g. by udev rules)
+        for (auto& subDevice : entry.device.subDevices)
         {
-          inputIt.next();
-
-          SubDevice subDevice;
-          QDirIterator dirIt(inputIt.filePath(), QDir::System | QDir::Dirs | QDir::Executable | QDir::NoDotAndDotDot);
-          while (dirIt.hasNext())
-          {
-            dirIt.next();
-            if (!dirIt.fileName().startsWith("event")) continue;
-            subDevice.type = SubDevice::Type::Event;
-            subDevice.deviceFile = readPropertyFromDeviceFile(QDir(dirIt.filePath()).filePath("uevent"), "DEVNAME");
-            if (!subDevice.deviceFile.isEmpty()) {
-              subDevice.deviceFile = QDir("/dev").filePath(subDevice.deviceFile);
-              break;
-            }
-          }
-
-          if (subDevice.deviceFile.isEmpty()) continue;
-          subDevice.phys = readStringFromDeviceFile(QDir(inputIt.filePath()).filePath("phys"));
-
-          // Check if device supports relative events
-          const auto supportedEvents = readULongLongFromDeviceFile(QDir(inputIt.filePath()).filePath("capabilities/ev"));
-          const bool hasRelativeEvents = !!(supportedEvents & (1 << EV_REL));
-
-          // Check if device supports relative x and y event types
-          const auto supportedRelEv = readULongLongFromDeviceFile(QDir(inputIt.filePath()).filePath("capabilities/rel"));
-          const bool hasRelXEvents = !!(supportedRelEv & (1 << REL_X));
-          const bool hasRelYEvents = !!(supportedRelEv & (1 << REL_Y));
-
-          subDevice.hasRelativeEvents = hasRelativeEvents && hasRelXEvents && hasRelYEvents;
-
           const QFileInfo fi(subDevice.deviceFile);
           subDevice.deviceReadable = fi.isReadable();
           subDevice.deviceWritable = fi.isWritable();
-
-          rootDevice.subDevices.emplace_back(std::move(subDevice));
         }
       }
 
-      // For the Logitech Spotlight we are only interested in the hidraw sub device that has no event
-      // device, if there is already an event device we skip hidraw detection for this sub-device.
-      const bool hasInputEventDevices
-          = std::any_of(rootDevice.subDevices.cbegin(), rootDevice.subDevices.cend(),
-            [](const SubDevice& sd) { return sd.type == SubDevice::Type::Event; });
-
-      if (hasInputEventDevices) continue;
+      // Check if device is already in list (and we have another sub-device for it)
+      const auto find_it = std::find_if(result.devices.begin(), result.devices.end(),
+      [&entry](const Device& existingDevice){
+        return existingDevice.id == entry.device.id;
+      });
 
-      // Iterate over 'hidraw' sub-dircectory, check for hidraw device node
-      const QFileInfo hidrawSubdir(QDir(hidIt.filePath()).filePath("hidraw"));
-      if (hidrawSubdir.exists() || hidrawSubdir.isExecutable())
+      if (find_it == result.devices.end())
       {
-        QDirIterator hidrawIt(hidrawSubdir.filePath(), QDir::System | QDir::Dirs | QDir::Executable | QDir::NoDotAndDotDot);
-        while (hidrawIt.hasNext())
-        {
-          hidrawIt.next();
-          if (!hidrawIt.fileName().startsWith("hidraw")) continue;
-          SubDevice subDevice;
-          subDevice.deviceFile = readPropertyFromDeviceFile(QDir(hidrawIt.filePath()).filePath("uevent"), "DEVNAME");
-          if (!subDevice.deviceFile.isEmpty()) {
-            subDevice.type = SubDevice::Type::Hidraw;
-            subDevice.deviceFile = QDir("/dev").filePath(subDevice.deviceFile);
-            if (subDevice.deviceFile.isEmpty()) continue;
-            const QFileInfo fi(subDevice.deviceFile);
-            subDevice.deviceReadable = fi.isReadable();
-            subDevice.deviceWritable = fi.isWritable();
-
-            rootDevice.subDevices.emplace_back(std::move(subDevice));
-          }
-        }
+        result.devices.push_back(entry.device);
+        result.devices.back().userName = match.name();
+      }
+      else
+      {
+        find_it->subDevices.insert(find_it->subDevices.end(),
+                                   entry.device.subDevices.cbegin(), entry.device.subDevices.cend());
+      }
+    }
+
+    // Remove entries of HID devices that disappeared
+    for (auto it = m_entries.begin(); it != m_entries.end(); )
+    {
+      if (it->second.generation == m_generation) {
+        ++it;
+        continue;
       }
+      it = m_entries.erase(it);
+      ++m_statistics.removed;
     }
 
     for (const auto& dev : result.devices)
@@ -305,4 +350,48 @@ namespace DeviceScan {
 
     return result;
   }
+
+  // -----------------------------------------------------------------------------------------------
+  void ScanCache::invalidate(const QString& sysPath)
+  {
+    // The HID device directory is a component of the sysfs paths of all its sub-devices.
+    const auto components = sysPath.split('/');
+    for (const auto& component : components) {
+      if (m_entries.erase(component)) return;
+    }
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  void ScanCache::clear()
+  {
+    m_entries.clear();
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  Device getDevice(const QString& sysPath, const std::vector<SupportedDevice>& additionalDevices,
+                   const Roots& roots)
+  {
+    // Walk up the sysfs path until the HID device, e.g.
+    // /sys/devices/.../0003:046D:C53E.0004/input/input17/event7 -> /sys/devices/.../0003:046D:C53E.0004
+    const QString sysfsPrefix = roots.sysfs + "/";
+    for (QString path = sysPath; path.size() > sysfsPrefix.size() && path.startsWith(sysfsPrefix);
+         path.truncate(path.lastIndexOf('/')))
+    {
+      const QFileInfo uEventFile(QDir(path).filePath("uevent"));
+      if (!uEventFile.exists()) continue;
+
+      Device device = deviceFromUEventFile(uEventFile.filePath());
+      const auto& deviceId = device.id;
+      if (deviceId.vendorId == 0 || deviceId.productId == 0) continue;
+
+      // Found the HID device, check if it is supported.
+      const auto match = DeviceRegistry(additionalDevices).find(deviceId.vendorId, deviceId.productId);
+      if (!match) return Device();
+
+      device.userName = match.name();
+      addSubDevices(path, roots.dev, device);
+      return device;
+    }
+    return Device();
+  }
 }
@@ -6,6 +6,7 @@
 #include <QString>
 #include <QMetaType>
 
+#include <map>
 #include <vector>
 
 // -------------------------------------------------------------------------------------------------
@@ -47,6 +48,63 @@ namespace DeviceScan
     QStringList errorMessages;
   };
 
+  /// Root directories of the sysfs and device node trees, can be changed to scan e.g. a
+  /// synthetic device tree.
+  struct Roots {
+    QString sysfs = "/sys";
+    QString dev = "/dev";
+    QString hidDevicePath() const { return sysfs + "/bus/hid/devices"; }
+  };
+
   /// Scan for supported devices and check if they are accessible
-  ScanResult getDevices(const std::vector<SupportedDevice>& additionalDevices = {});
+  ScanResult getDevices(const std::vector<SupportedDevice>& additionalDevices = {},
+                        const Roots& roots = Roots());
+
+  /// Persistent device scan cache, keyed by the sysfs path of the HID devices. A rescan only reads
+  /// the sysfs entries of HID devices that appeared or changed since the last scan. Unsupported
+  /// devices are remembered as negative entries and are not read again.
+  class ScanCache
+  {
+  public:
+    struct Statistics {
+      quint32 scans = 0;
+      quint32 added = 0;        // HID devices read for the first time
+      quint32 changed = 0;      // supported HID devices with changed sub-devices
+      quint32 removed = 0;      // HID devices that disappeared
+      quint32 hits = 0;         // supported HID devices taken from the cache
+      quint32 negativeHits = 0; // unsupported HID devices taken from the cache
+    };
+
+    explicit ScanCache(const Roots& roots = Roots());
+
+    /// Scan for supported devices, reusing cached results of unchanged HID devices.
+    ScanResult getDevices(const std::vector<SupportedDevice>& additionalDevices = {});
+
+    /// Remove the cache entry of the HID device the given sysfs path belongs to.
+    void invalidate(const QString& sysPath);
+    void clear();
+
+    size_t size() const { return m_entries.size(); }
+    const Statistics& statistics() const { return m_statistics; }
+    const Roots& roots() const { return m_roots; }
+
+  private:
+    struct Entry {
+      Device device;              // device info, sub-devices only for supported devices
+      QStringList subDeviceNodes; // sysfs sub-device entries the sub-devices were read from
+      bool subDevicesScanned = false;
+      quint32 generation = 0;     // last scan the HID device was seen in
+    };
+
+    const Roots m_roots;
+    const QString m_hidDevicePath;
+    std::map<QString, Entry> m_entries; // key: HID device directory name
+    quint32 m_generation = 0;
+    Statistics m_statistics;
+  };
+
+  /// Scan only the HID device the given sysfs path (e.g. of an input event device) belongs to.
+  /// Returns a device with an empty DeviceId if the device is not supported.
+  Device getDevice(const QString& sysPath, const std::vector<SupportedDevice>& additionalDevices = {},
+                   const Roots& roots = Roots());
 }
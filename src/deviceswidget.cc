@@ -8,6 +8,7 @@
 #include "settings.h"
 #include "spotlight.h"
 
+#include <QCheckBox>
 #include <QComboBox>
 #include <QLabel>
 #include <QLayout>
@@ -118,9 +119,17 @@ QWidget* DevicesWidget::createInputMapperWidget(Settings* settings, Spotlight* /
                                      : settings->deviceInputSeqInterval(currentDeviceId()));
   intervalSb->setSingleStep(50);
 
+  const auto coalesceCb = new QCheckBox(tr("Merge mouse moves"), imWidget);
+  coalesceCb->setToolTip(tr("Merge mouse move events that arrive at once into a single event "
+                            "before forwarding them."));
+  coalesceCb->setChecked(m_inputMapper ? m_inputMapper->relEventCoalescing()
+                                       : settings->deviceRelEventCoalescing(currentDeviceId()));
+
   intervalLayout->addWidget(addBtn);
   intervalLayout->addWidget(delBtn);
   intervalLayout->addStretch(1);
+  intervalLayout->addWidget(coalesceCb);
+  intervalLayout->addSpacing(10);
   intervalLayout->addWidget(intervalLbl);
   intervalLayout->addWidget(intervalSb);
   intervalLayout->addWidget(intervalUnitLbl);
@@ -139,10 +148,11 @@ QWidget* DevicesWidget::createInputMapperWidget(Settings* settings, Spotlight* /
   updateImWidget();
 
   connect(this, &DevicesWidget::currentDeviceChanged, this,
-  [this, imModel, intervalSb, updateImWidget=std::move(updateImWidget)](){
+  [this, imModel, intervalSb, coalesceCb, updateImWidget=std::move(updateImWidget)](){
     imModel->setInputMapper(m_inputMapper);
     if (m_inputMapper) {
       intervalSb->setValue(m_inputMapper->keyEventInterval());
+      coalesceCb->setChecked(m_inputMapper->relEventCoalescing());
       imModel->setConfiguration(m_inputMapper->configuration());
     }
     updateImWidget();
@@ -156,6 +166,13 @@ QWidget* DevicesWidget::createInputMapperWidget(Settings* settings, Spotlight* /
     }
   });
 
+  connect(coalesceCb, &QCheckBox::toggled, this, [this, settings](bool checked) {
+    if (m_inputMapper) {
+      m_inputMapper->setRelEventCoalescing(checked);
+      settings->setDeviceRelEventCoalescing(currentDeviceId(), checked);
+    }
+  });
+
   connect(selectionModel, &QItemSelectionModel::selectionChanged, this,
   [delBtn, selectionModel](){
     delBtn->setEnabled(selectionModel->hasSelection());
@@ -0,0 +1,127 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "hidpp.h"
+
+#include <algorithm>
+
+#include <linux/input.h>
+
+namespace {
+  // REPROG_CONTROLS_V4 functions and setCidReporting flags
+  constexpr uint8_t SetCidReportingFunction = 3;
+  constexpr uint8_t DivertFlag = 0x01;
+  constexpr uint8_t DivertValidFlag = 0x02;
+
+  // Next and Back buttons of the Spotlight, reported as right and left arrow keys (HID usage
+  // page 0x07) like on the keyboard interface.
+  const std::array<HIDPP::Control, 2> spotlightControls = {{
+    { 0x00da, KEY_RIGHT, 0x7004f },
+    { 0x00dc, KEY_LEFT, 0x70050 },
+  }};
+
+  // -----------------------------------------------------------------------------------------------
+  size_t reportSize(uint8_t reportId)
+  {
+    switch (static_cast<HIDPP::ReportType>(reportId))
+    {
+    case HIDPP::ReportType::Short: return HIDPP::ShortReportSize;
+    case HIDPP::ReportType::Long: return HIDPP::LongReportSize;
+    case HIDPP::ReportType::VeryLong: return HIDPP::VeryLongReportSize;
+    }
+    return 0;
+  }
+} // --- end anonymous namespace
+
+namespace HIDPP {
+  // -----------------------------------------------------------------------------------------------
+  Message Message::parse(const uint8_t* data, size_t size)
+  {
+    Message message;
+    if (!data || size == 0) return message;
+
+    const size_t expectedSize = reportSize(data[0]);
+    if (expectedSize == 0 || size < expectedSize) return message;
+
+    message.m_data = data;
+    message.m_size = expectedSize;
+    return message;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  uint16_t Message::paramWord(size_t offset) const
+  {
+    if (offset + 1 >= paramsSize()) return 0;
+    return static_cast<uint16_t>((params()[offset] << 8) | params()[offset + 1]);
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  ShortReport getFeatureRequest(uint8_t deviceIndex, uint16_t featureId)
+  {
+    // Function 0 of the root feature is getFeature(featureId)
+    return ShortReport{{ static_cast<uint8_t>(ReportType::Short), deviceIndex, RootFeatureIndex,
+                         SoftwareId, static_cast<uint8_t>(featureId >> 8),
+                         static_cast<uint8_t>(featureId & 0xff), 0 }};
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  LongReport setCidReportingRequest(uint8_t deviceIndex, uint8_t reprogFeatureIndex,
+                                    uint16_t controlId, bool divert)
+  {
+    // Params: control id, flags, remapped control id (0: no change)
+    LongReport report{};
+    report[0] = static_cast<uint8_t>(ReportType::Long);
+    report[1] = deviceIndex;
+    report[2] = reprogFeatureIndex;
+    report[3] = static_cast<uint8_t>((SetCidReportingFunction << 4) | SoftwareId);
+    report[4] = static_cast<uint8_t>(controlId >> 8);
+    report[5] = static_cast<uint8_t>(controlId & 0xff);
+    report[6] = DivertValidFlag | (divert ? DivertFlag : 0);
+    return report;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool decodeGetFeatureResponse(const Message& message, uint8_t& featureIndex)
+  {
+    if (!message.isValid() || message.featureIndex() != RootFeatureIndex
+        || message.function() != 0 || message.softwareId() != SoftwareId) {
+      return false;
+    }
+    featureIndex = message.params()[0];
+    return true;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool DivertedButtons::contains(uint16_t controlId) const
+  {
+    return controlId != 0
+           && std::find(controlIds.cbegin(), controlIds.cend(), controlId) != controlIds.cend();
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool decodeDivertedButtons(const Message& message, uint8_t reprogFeatureIndex, DivertedButtons& buttons)
+  {
+    // Notifications have the software id 0, divertedButtonsEvent is event 0 of the feature.
+    if (!message.isValid() || reprogFeatureIndex == 0 || message.featureIndex() != reprogFeatureIndex
+        || message.function() != 0 || message.softwareId() != 0) {
+      return false;
+    }
+
+    for (size_t i = 0; i < buttons.controlIds.size(); ++i) {
+      buttons.controlIds[i] = message.paramWord(i * 2);
+    }
+    return true;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  const std::array<Control, 2>& divertedControls()
+  {
+    return spotlightControls;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  const Control* findControl(uint16_t controlId)
+  {
+    const auto it = std::find_if(spotlightControls.cbegin(), spotlightControls.cend(),
+    [controlId](const Control& control) { return control.controlId == controlId; });
+    return (it == spotlightControls.cend()) ? nullptr : &(*it);
+  }
+}
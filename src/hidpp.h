@@ -0,0 +1,97 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// -------------------------------------------------------------------------------------------------
+/// Logitech HID++ 2.0 protocol, as used by the Spotlight on its vendor specific HID interface.
+namespace HIDPP
+{
+  enum class ReportType : uint8_t { Short = 0x10, Long = 0x11, VeryLong = 0x12 };
+
+  constexpr size_t ShortReportSize = 7;
+  constexpr size_t LongReportSize = 20;
+  constexpr size_t VeryLongReportSize = 64;
+  constexpr size_t MaxReportSize = VeryLongReportSize;
+
+  constexpr uint8_t DirectDeviceIndex = 0xff; // device connected directly, e.g. via Bluetooth
+  constexpr uint8_t FirstReceiverDeviceIndex = 0x01; // first device paired with a USB receiver
+
+  constexpr uint8_t RootFeatureIndex = 0x00;
+  constexpr uint8_t ErrorFeatureIndex = 0xff;
+  constexpr uint16_t ReprogControlsV4Feature = 0x1b04;
+
+  // Software id used in our requests to tell responses apart from device notifications (0).
+  constexpr uint8_t SoftwareId = 0x07;
+
+  // -----------------------------------------------------------------------------------------------
+  /// Non-owning view of a HID++ message, decoded in place from the report read buffer.
+  class Message
+  {
+  public:
+    /// Returns an invalid message if the data is not a complete HID++ report.
+    static Message parse(const uint8_t* data, size_t size);
+
+    bool isValid() const { return m_data != nullptr; }
+    ReportType reportType() const { return static_cast<ReportType>(m_data[0]); }
+    uint8_t deviceIndex() const { return m_data[1]; }
+    uint8_t featureIndex() const { return m_data[2]; }
+    uint8_t function() const { return m_data[3] >> 4; }
+    uint8_t softwareId() const { return m_data[3] & 0x0f; }
+    bool isError() const { return featureIndex() == ErrorFeatureIndex; }
+
+    const uint8_t* params() const { return m_data + 4; }
+    size_t paramsSize() const { return m_size - 4; }
+    /// Big endian 16 bit parameter at the given byte offset, 0 if out of range.
+    uint16_t paramWord(size_t offset) const;
+
+  private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+  };
+
+  using ShortReport = std::array<uint8_t, ShortReportSize>;
+  using LongReport = std::array<uint8_t, LongReportSize>;
+
+  /// Root feature request for the feature index of the given feature id.
+  ShortReport getFeatureRequest(uint8_t deviceIndex, uint16_t featureId);
+
+  /// REPROG_CONTROLS_V4 setCidReporting request, diverts the control to software (the device sends
+  /// divertedButtonsEvent notifications instead of its regular HID reports) or restores it.
+  LongReport setCidReportingRequest(uint8_t deviceIndex, uint8_t reprogFeatureIndex,
+                                    uint16_t controlId, bool divert);
+
+  /// Feature index from a getFeature response, 0 if the feature is not supported.
+  bool decodeGetFeatureResponse(const Message& message, uint8_t& featureIndex);
+
+  // -----------------------------------------------------------------------------------------------
+  /// Controls (buttons) diverted to software and currently held down, as sent with the
+  /// divertedButtonsEvent of the REPROG_CONTROLS_V4 feature.
+  struct DivertedButtons
+  {
+    std::array<uint16_t, 4> controlIds{}; // unused entries are 0
+
+    bool contains(uint16_t controlId) const;
+  };
+
+  bool decodeDivertedButtons(const Message& message, uint8_t reprogFeatureIndex, DivertedButtons& buttons);
+
+  // -----------------------------------------------------------------------------------------------
+  /// Control of the Spotlight that is diverted to software and the key event reported for it. The
+  /// key event is the same the device sends on its keyboard interface, so existing input mappings
+  /// keep working and unmapped presses are forwarded unchanged.
+  struct Control
+  {
+    uint16_t controlId;
+    uint16_t keyCode;
+    int32_t scanCode; // MSC_SCAN value
+  };
+
+  /// Controls diverted by Projecteur.
+  const std::array<Control, 2>& divertedControls();
+
+  /// Control for the given id, nullptr if the control is not one of the diverted controls.
+  const Control* findControl(uint16_t controlId);
+}
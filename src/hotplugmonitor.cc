@@ -0,0 +1,236 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "hotplugmonitor.h"
+
+#include "logging.h"
+#include "reactor.h"
+
+#include <QFileInfo>
+
+#include <array>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+DECLARE_LOGGING_CATEGORY(device)
+
+namespace {
+  // Netlink multicast groups of the uevent socket
+  constexpr uint32_t kernelGroup = 1;
+  constexpr uint32_t udevGroup = 2;
+
+  // Header of messages sent by udev (see libudev-monitor.c)
+  constexpr char udevPrefix[] = "libudev";
+  constexpr uint32_t udevMagic = 0xfeedcafe;
+  struct UdevMessageHeader {
+    char prefix[8];
+    uint32_t magic; // network byte order
+    uint32_t headerSize;
+    uint32_t propertiesOffset;
+    uint32_t propertiesLength;
+    uint32_t filterSubsystemHash;
+    uint32_t filterDevtypeHash;
+    uint32_t filterTagBloomHi;
+    uint32_t filterTagBloomLo;
+  };
+
+  // -----------------------------------------------------------------------------------------------
+  UEvent::Action actionFromString(const char* action, size_t size)
+  {
+    const auto equals = [action, size](const char* str) {
+      return size == std::strlen(str) && std::strncmp(action, str, size) == 0;
+    };
+
+    if (equals("add")) return UEvent::Action::Add;
+    if (equals("remove")) return UEvent::Action::Remove;
+    if (equals("change")) return UEvent::Action::Change;
+    if (equals("bind")) return UEvent::Action::Bind;
+    if (equals("unbind")) return UEvent::Action::Unbind;
+    return UEvent::Action::Unknown;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Properties are '\0' separated KEY=VALUE pairs.
+  void parseProperties(const char* at, const char* const end, UEvent& uevent)
+  {
+    while (at < end)
+    {
+      const auto next = static_cast<const char*>(std::memchr(at, '\0', end - at));
+      const char* const propertyEnd = next ? next : end;
+      const auto separator = static_cast<const char*>(std::memchr(at, '=', propertyEnd - at));
+
+      if (separator)
+      {
+        const auto key = QLatin1String(at, static_cast<int>(separator - at));
+        const char* const value = separator + 1;
+        const int valueSize = static_cast<int>(propertyEnd - value);
+
+        if (key == QLatin1String("ACTION")) {
+          uevent.action = actionFromString(value, valueSize);
+        }
+        else if (key == QLatin1String("DEVPATH")) {
+          uevent.devPath = QString::fromUtf8(value, valueSize);
+        }
+        else if (key == QLatin1String("SUBSYSTEM")) {
+          uevent.subsystem = QString::fromUtf8(value, valueSize);
+        }
+        else if (key == QLatin1String("DEVNAME")) {
+          uevent.devName = QString::fromUtf8(value, valueSize);
+        }
+      }
+      at = next ? next + 1 : end;
+    }
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool isMonitoredSubsystem(const QString& subsystem)
+  {
+    return subsystem == QLatin1String("input")
+           || subsystem == QLatin1String("hid")
+           || subsystem == QLatin1String("hidraw");
+  }
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+bool UEvent::parse(const char* data, size_t size, UEvent& uevent)
+{
+  uevent = UEvent();
+
+  if (size >= sizeof(UdevMessageHeader) && std::memcmp(data, udevPrefix, sizeof(udevPrefix)) == 0)
+  {
+    UdevMessageHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (ntohl(header.magic) != udevMagic) return false;
+    if (header.propertiesOffset < sizeof(UdevMessageHeader) || header.propertiesOffset > size
+        || header.propertiesLength > size - header.propertiesOffset) {
+      return false;
+    }
+    const char* const properties = data + header.propertiesOffset;
+    parseProperties(properties, properties + header.propertiesLength, uevent);
+  }
+  else
+  { // Kernel message: 'action@devpath' followed by the properties
+    const auto headerEnd = static_cast<const char*>(std::memchr(data, '\0', size));
+    if (!headerEnd || !std::memchr(data, '@', headerEnd - data)) return false;
+    parseProperties(headerEnd + 1, data + size, uevent);
+  }
+
+  return uevent.action != Action::Unknown && !uevent.devPath.isEmpty();
+}
+
+// -------------------------------------------------------------------------------------------------
+HotplugMonitor* HotplugMonitor::create(EventLoopReactor* reactor, QObject* parent)
+{
+  if (!reactor || !reactor->isValid()) return nullptr;
+
+  const int fd = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+  if (fd < 0) {
+    logWarning(device) << tr("Cannot open uevent netlink socket (%1).").arg(errno);
+    return nullptr;
+  }
+
+  // If udev is running, wait for its messages. Device nodes might not be accessible before
+  // udev has applied its rules.
+  const bool udevRunning = QFileInfo::exists("/run/udev/control");
+  const auto source = udevRunning ? Source::Udev : Source::Kernel;
+
+  struct sockaddr_nl addr{};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = udevRunning ? udevGroup : kernelGroup;
+
+  const int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on));
+
+  if (::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+  {
+    logWarning(device) << tr("Cannot bind uevent netlink socket (%1).").arg(errno);
+    ::close(fd);
+    return nullptr;
+  }
+
+  const auto monitor = new HotplugMonitor(fd, source, reactor, parent);
+  monitor->m_checkSender = true;
+  logDebug(device) << tr("Listening for %1 hotplug events.").arg(udevRunning ? "udev" : "kernel");
+  return monitor;
+}
+
+// -------------------------------------------------------------------------------------------------
+HotplugMonitor::HotplugMonitor(int socketFd, Source source, EventLoopReactor* reactor, QObject* parent)
+  : QObject(parent)
+  , m_fd(socketFd)
+  , m_source(source)
+  , m_reactor(reactor)
+{
+  // Edge-triggered, onDataAvailable() reads all pending messages.
+  if (!m_reactor || !m_reactor->add(m_fd, [this](uint32_t){ onDataAvailable(); })) {
+    logWarning(device) << tr("Cannot watch uevent socket for hotplug events.");
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+HotplugMonitor::~HotplugMonitor()
+{
+  if (m_reactor) m_reactor->remove(m_fd);
+  if (m_fd >= 0) ::close(m_fd);
+}
+
+// -------------------------------------------------------------------------------------------------
+bool HotplugMonitor::isTrustedSender(const struct msghdr& msg, Source source)
+{
+  if (msg.msg_namelen < sizeof(struct sockaddr_nl)) return false;
+  const auto addr = static_cast<const struct sockaddr_nl*>(msg.msg_name);
+  if (addr->nl_family != AF_NETLINK) return false;
+
+  if (source == Source::Kernel) {
+    return addr->nl_pid == 0;
+  }
+
+  // Messages from udev must come from root
+  for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(const_cast<struct msghdr*>(&msg), cmsg))
+  {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_CREDENTIALS) continue;
+    struct ucred cred;
+    std::memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+    return cred.uid == 0;
+  }
+  return false;
+}
+
+// -------------------------------------------------------------------------------------------------
+void HotplugMonitor::onDataAvailable()
+{
+  std::array<char, 8192> buffer;
+  char control[CMSG_SPACE(sizeof(struct ucred))];
+  UEvent uevent;
+
+  while (true)
+  {
+    struct sockaddr_nl addr{};
+    struct iovec iov{ buffer.data(), buffer.size() };
+    struct msghdr msg{};
+    msg.msg_name = &addr;
+    msg.msg_namelen = sizeof(addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    const ssize_t size = ::recvmsg(m_fd, &msg, MSG_DONTWAIT);
+    if (size < 0 && errno == EINTR) continue;
+    if (size <= 0) break;
+
+    if (msg.msg_flags & MSG_TRUNC) continue;
+    if (m_checkSender && !isTrustedSender(msg, m_source)) continue;
+    if (!UEvent::parse(buffer.data(), static_cast<size_t>(size), uevent)) continue;
+    if (!isMonitoredSubsystem(uevent.subsystem)) continue;
+
+    if (uevent.action == UEvent::Action::Add) {
+      emit deviceAdded(uevent);
+    }
+    else if (uevent.action == UEvent::Action::Remove) {
+      emit deviceRemoved(uevent);
+    }
+  }
+}
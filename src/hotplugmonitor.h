@@ -0,0 +1,64 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include <QObject>
+#include <QPointer>
+#include <QString>
+
+class EventLoopReactor;
+
+// -------------------------------------------------------------------------------------------------
+/// Device add/remove message as sent from the kernel or udev via the uevent netlink socket.
+struct UEvent
+{
+  enum class Action : uint8_t { Unknown, Add, Remove, Change, Bind, Unbind };
+
+  Action action = Action::Unknown;
+  QString devPath;   // sysfs path without the /sys prefix
+  QString subsystem;
+  QString devName;   // device node relative to /dev, can be empty
+
+  /// Parse a uevent message, either in the kernel format (`action@devpath` followed by
+  /// properties) or in the udev format (libudev header followed by properties).
+  static bool parse(const char* data, size_t size, UEvent& uevent);
+};
+
+// -------------------------------------------------------------------------------------------------
+/// Listens for hotplug events of the hid, hidraw and input subsystems on the uevent netlink
+/// socket. If udev is running, its messages are used, since they are sent after the udev rules
+/// (e.g. device node permissions) have been applied.
+class HotplugMonitor : public QObject
+{
+  Q_OBJECT
+
+public:
+  enum class Source : uint8_t { Kernel, Udev };
+
+  /// Create a monitor for the netlink uevent socket, returns a nullptr on failure. The socket is
+  /// handled by the given reactor.
+  static HotplugMonitor* create(EventLoopReactor* reactor, QObject* parent = nullptr);
+
+  /// Create a monitor reading uevent messages from the given socket, the monitor takes ownership
+  /// of the socket. Messages are not checked for a netlink sender, so this can be used to inject
+  /// messages from e.g. a socketpair.
+  HotplugMonitor(int socketFd, Source source, EventLoopReactor* reactor, QObject* parent = nullptr);
+  ~HotplugMonitor() override;
+
+  Source source() const { return m_source; }
+
+  /// Check the sender of a received message: the kernel (netlink port id 0) for kernel messages,
+  /// a process running as root (credentials of SO_PASSCRED) for udev messages.
+  static bool isTrustedSender(const struct msghdr& msg, Source source);
+
+signals:
+  void deviceAdded(const UEvent& uevent);
+  void deviceRemoved(const UEvent& uevent);
+
+private:
+  void onDataAvailable();
+
+  const int m_fd = -1;
+  const Source m_source = Source::Kernel;
+  bool m_checkSender = false;
+  QPointer<EventLoopReactor> m_reactor;
+};
@@ -0,0 +1,410 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "inputengine.h"
+
+#include "device.h"
+#include "deviceinput.h"
+#include "inputlatency.h"
+#include "logging.h"
+#include "virtualdevice.h"
+
+#include <array>
+#include <set>
+
+#include <sys/eventfd.h>
+#include <linux/input.h>
+#include <unistd.h>
+
+DECLARE_LOGGING_CATEGORY(device)
+
+namespace {
+  // Time after the last mouse move event until the spot is set inactive again.
+  constexpr std::chrono::milliseconds spotActiveTimeout{600};
+
+  // -----------------------------------------------------------------------------------------------
+  // Sums up the deltas of consecutive mouse move frames, see InputMapper::relEventCoalescing().
+  class RelEventAccumulator
+  {
+  public:
+    // Frames can be merged if they only contain REL_X, REL_Y and REL_WHEEL events.
+    static bool canAccumulate(const struct input_event frame[], size_t num)
+    {
+      for (size_t i = 0; i < num; ++i)
+      {
+        const auto& ev = frame[i];
+        if (ev.type == EV_SYN) continue;
+        if (ev.type != EV_REL || (ev.code != REL_X && ev.code != REL_Y && ev.code != REL_WHEEL)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool empty() const { return m_frames == 0; }
+    size_t frames() const { return m_frames; }
+    int64_t firstEventTime() const { return m_firstEventTime; }
+
+    void add(const struct input_event frame[], size_t num)
+    {
+      if (m_frames++ == 0) m_firstEventTime = eventTimeUsec(frame[num - 1]);
+      for (size_t i = 0; i < num; ++i)
+      {
+        if (frame[i].type != EV_REL) continue;
+        switch (frame[i].code) {
+        case REL_X: m_deltaX += frame[i].value; break;
+        case REL_Y: m_deltaY += frame[i].value; break;
+        case REL_WHEEL: m_deltaWheel += frame[i].value; break;
+        }
+      }
+    }
+
+    // Write the merged frame to `out` and reset, returns the number of events of the frame.
+    size_t takeFrame(std::array<struct input_event, 4>& out)
+    {
+      size_t num = 0;
+      if (m_deltaX) out[num++] = input_event{{}, EV_REL, REL_X, m_deltaX};
+      if (m_deltaY) out[num++] = input_event{{}, EV_REL, REL_Y, m_deltaY};
+      if (m_deltaWheel) out[num++] = input_event{{}, EV_REL, REL_WHEEL, m_deltaWheel};
+      if (num) out[num++] = input_event{{}, EV_SYN, SYN_REPORT, 0};
+      *this = RelEventAccumulator();
+      return num;
+    }
+
+  private:
+    size_t m_frames = 0;
+    int64_t m_firstEventTime = 0;
+    int32_t m_deltaX = 0;
+    int32_t m_deltaY = 0;
+    int32_t m_deltaWheel = 0;
+  };
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+InputEngine::InputEngine(std::shared_ptr<VirtualDevice> vdev, QObject* parent)
+  : QThread(parent)
+  , m_virtualDevice(std::move(vdev))
+  , m_wakeupFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+{
+  setObjectName("InputEngine");
+
+  if (!m_reactor.isValid() || m_wakeupFd < 0) {
+    logError(device) << tr("Cannot create input engine poll descriptors, no device input will be read.");
+    return;
+  }
+
+  m_reactor.add(m_wakeupFd, [this](uint32_t) {
+    uint64_t value = 0;
+    if (::read(m_wakeupFd, &value, sizeof(value)) < 0) { /* nothing to do */ }
+  });
+}
+
+// -------------------------------------------------------------------------------------------------
+InputEngine::~InputEngine()
+{
+  stop();
+  if (m_wakeupFd >= 0) ::close(m_wakeupFd);
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputEngine::stop()
+{
+  if (!isRunning()) return;
+
+  requestInterruption();
+  const uint64_t one = 1;
+  if (::write(m_wakeupFd, &one, sizeof(one)) != sizeof(one)) {
+    logWarning(device) << tr("Cannot wake up input engine thread.");
+  }
+  wait();
+  stopRecording();
+}
+
+// -------------------------------------------------------------------------------------------------
+bool InputEngine::addConnection(std::shared_ptr<SubDeviceConnection> connection)
+{
+  if (!connection || !connection->isConnected() || !m_reactor.isValid()) return false;
+
+  const int fd = connection->fileDescriptor();
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  // Handlers are bound to the connection type, the connection outlives its handler.
+  Reactor::Handler handler;
+  if (connection->type() == ConnectionType::Hidraw)
+  {
+    handler = [this, c = static_cast<SubHidrawConnection*>(connection.get())](uint32_t) {
+      if (c->isConnected()) onHidrawDataAvailable(*c);
+    };
+  }
+  else
+  {
+    handler = [this, c = static_cast<SubEventConnection*>(connection.get())](uint32_t) {
+      if (c->isConnected()) onEventDataAvailable(*c);
+    };
+  }
+
+  if (!m_reactor.add(fd, std::move(handler)))
+  {
+    logError(device) << tr("Cannot add device to input engine: %1").arg(connection->path());
+    return false;
+  }
+
+  m_connections[fd] = std::move(connection);
+  return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputEngine::removeConnection(const QString& devicePath)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto it = m_connections.begin(); it != m_connections.end(); )
+  {
+    if (it->second->path() == devicePath)
+    {
+      m_reactor.remove(it->first);
+      it = m_connections.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputEngine::resetSpotActivity()
+{
+  m_resetSpotActivity = true;
+}
+
+// -------------------------------------------------------------------------------------------------
+bool InputEngine::startRecording(const QString& path)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_recorder.open(path);
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputEngine::stopRecording()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_recorder.close();
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputEngine::run()
+{
+  while (!isInterruptionRequested())
+  {
+    if (m_reactor.wait(nextTimeout()) < 0)
+    {
+      if (errno == EINTR) continue;
+      logError(device) << tr("Input engine stopped, epoll_wait returned with failure (%1).").arg(errno);
+      break;
+    }
+
+    if (m_resetSpotActivity.exchange(false)) {
+      m_spotActive = false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_reactor.dispatchReady();
+    processTimeouts();
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+int InputEngine::nextTimeout() const
+{
+  int timeout = -1;
+  const auto updateTimeout = [&timeout](int msecs) {
+    if (msecs >= 0 && (timeout < 0 || msecs < timeout)) timeout = msecs;
+  };
+
+  if (m_spotActive)
+  {
+    const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(m_spotActiveUntil - Clock::now());
+    updateTimeout(remaining.count() > 0 ? static_cast<int>(remaining.count()) + 1 : 0);
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (const auto& connection : m_connections) {
+    updateTimeout(connection.second->inputMapper()->remainingTimeout());
+  }
+
+  return timeout;
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputEngine::processTimeouts()
+{
+  if (m_spotActive && Clock::now() >= m_spotActiveUntil)
+  {
+    m_spotActive = false;
+    emit spotActiveChanged(false);
+  }
+
+  // Sub-devices of the same device share one input mapper.
+  std::set<InputMapper*> processed;
+  for (const auto& connection : m_connections)
+  {
+    const auto inputMapper = connection.second->inputMapper().get();
+    if (processed.insert(inputMapper).second) {
+      inputMapper->processTimeout();
+    }
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputEngine::onEventDataAvailable(SubEventConnection& connection)
+{
+  const int fd = connection.fileDescriptor();
+  const bool isNonBlocking = !!(connection.flags() & DeviceFlag::NonBlocking);
+  const bool coalesce = connection.inputMapper()->relEventCoalescing();
+  auto& buf = connection.inputBuffer();
+  auto& stats = connection.readStatistics();
+
+  // Mouse move frames read in this call, merged into a single frame if coalescing is enabled.
+  RelEventAccumulator accumulator;
+  const auto flushAccumulator = [this, &accumulator, &connection, &stats]()
+  {
+    if (accumulator.empty()) return;
+
+    stats.coalescedFrames += accumulator.frames() - 1;
+    const auto eventTime = accumulator.firstEventTime();
+    std::array<struct input_event, 4> frame;
+    const size_t frameSize = accumulator.takeFrame(frame);
+    if (m_virtualDevice && frameSize)
+    {
+      m_virtualDevice->emitEvents(frame.data(), frameSize);
+      connection.inputMapper()->latencyStatistics().record(InputPath::MouseMove, eventTime);
+    }
+  };
+
+  while (true)
+  {
+    // Read as many events as fit into the buffer, after any incomplete frame from the last read.
+    const size_t bytesToRead = buf.available() * sizeof(input_event);
+    const ssize_t bytesRead = ::read(fd, &buf[buf.pos()], bytesToRead);
+    ++stats.readCalls;
+
+    if (bytesRead < 0 && errno == EINTR) continue;
+    if (bytesRead <= 0)
+    {
+      if (bytesRead == 0 || errno != EAGAIN)
+      { // Stop reading from the device, the GUI thread will remove the connection.
+        connection.disable();
+        m_reactor.remove(fd);
+        emit readError(connection.path());
+      }
+      break;
+    }
+
+    const size_t numEvents = static_cast<size_t>(bytesRead) / sizeof(input_event);
+    const size_t frameSearchStart = buf.pos();
+    buf += numEvents;
+    stats.events += numEvents;
+
+    // Split the buffer into EV_SYN terminated frames and process them one after another.
+    size_t frameStart = 0;
+    for (size_t i = frameSearchStart; i < buf.pos(); ++i)
+    {
+      if (buf[i].type != EV_SYN) continue;
+
+      ++stats.frames;
+      const size_t frameSize = i + 1 - frameStart;
+      if (m_recorder.isOpen()) m_recorder.record(&buf[frameStart], frameSize);
+
+      // Check for relative events -> set Spotlight active
+      const auto &first_ev = buf[frameStart];
+      const bool isMouseMoveEvent = first_ev.type == EV_REL
+                                    && (first_ev.code == REL_X || first_ev.code == REL_Y);
+      if (isMouseMoveEvent)
+      { // Skip input mapping for mouse move events completely
+        if (!m_spotActive)
+        {
+          m_spotActive = true;
+          emit spotActiveChanged(true);
+        }
+        m_spotActiveUntil = Clock::now() + spotActiveTimeout;
+        if (coalesce && RelEventAccumulator::canAccumulate(&buf[frameStart], frameSize)) {
+          accumulator.add(&buf[frameStart], frameSize);
+        }
+        else if (m_virtualDevice)
+        { // Keep the order of events, write merged mouse moves first.
+          flushAccumulator();
+          m_virtualDevice->emitEvents(&buf[frameStart], frameSize);
+          connection.inputMapper()->latencyStatistics().record(InputPath::MouseMove, eventTimeUsec(buf[i]));
+        }
+      }
+      else
+      { // Forward events to input mapper for the device, write merged mouse moves first.
+        flushAccumulator();
+        connection.inputMapper()->addEvents(&buf[frameStart], frameSize);
+      }
+      frameStart = i + 1;
+    }
+
+    // Keep an incomplete frame for the next read.
+    buf.shift(frameStart);
+
+    if (buf.available() == 0)
+    { // No idea if this will ever happen, but log it to make sure we get notified.
+      logWarning(device) << tr("Discarded %1 input events without EV_SYN.").arg(buf.size());
+      connection.inputMapper()->resetState();
+      buf.reset();
+    }
+
+    // A short read means the device has been drained, no need for another read() call. New events
+    // will signal the (edge-triggered) descriptor again.
+    if (!isNonBlocking || static_cast<size_t>(bytesRead) < bytesToRead) break;
+  } // end while loop
+
+  flushAccumulator();
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputEngine::onHidrawDataAvailable(SubHidrawConnection& connection)
+{
+  const int fd = connection.fileDescriptor();
+  auto& reports = connection.reportBuffer();
+  auto& events = connection.inputBuffer();
+  auto& stats = connection.readStatistics();
+
+  // Reports from hidraw have no kernel timestamp, use the wake up time instead.
+  const auto wakeupTime = monotonicTimeUsec();
+
+  bool drained = false;
+  while (!drained)
+  {
+    // Read all available reports into the report buffer, hidraw returns one report per read().
+    size_t numReports = 0;
+    while (numReports < reports.slotCount())
+    {
+      const ssize_t bytesRead = ::read(fd, reports.slot(numReports), reports.slotSize());
+      ++stats.readCalls;
+
+      if (bytesRead < 0 && errno == EINTR) continue;
+      if (bytesRead <= 0)
+      {
+        if (bytesRead == 0 || errno != EAGAIN)
+        { // Stop reading from the device, the GUI thread will remove the connection.
+          connection.disable();
+          m_reactor.remove(fd);
+          emit readError(connection.path());
+          return;
+        }
+        drained = true;
+        break;
+      }
+      reports.setReportSize(numReports++, static_cast<size_t>(bytesRead));
+    }
+    stats.reports += numReports;
+
+    // Decode the reports in place, key events are passed to the input mapper frame by frame.
+    for (size_t i = 0; i < numReports; ++i)
+    {
+      events.reset();
+      const size_t numEvents = connection.decodeReport(reports.slot(i), reports.reportSize(i), wakeupTime);
+      stats.events += numEvents;
+      stats.frames += connection.inputMapper()->addFrames(events.data(), numEvents);
+    }
+  }
+}
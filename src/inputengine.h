@@ -0,0 +1,68 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include "inputrecording.h"
+#include "reactor.h"
+
+#include <QThread>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+
+class SubDeviceConnection;
+class SubEventConnection;
+class SubHidrawConnection;
+class VirtualDevice;
+
+/// Thread reading input events from all connected sub-devices, independent of the GUI thread.
+/// Events are passed on to the InputMapper of the sub-device and written to the virtual device
+/// directly from this thread, only high-level changes are signaled to the GUI thread.
+class InputEngine : public QThread
+{
+  Q_OBJECT
+
+public:
+  explicit InputEngine(std::shared_ptr<VirtualDevice> vdev, QObject* parent = nullptr);
+  ~InputEngine() override;
+
+  bool addConnection(std::shared_ptr<SubDeviceConnection> connection);
+  // After returning, the connection is not accessed by the input engine thread anymore.
+  void removeConnection(const QString& devicePath);
+
+  void stop();
+  void resetSpotActivity(); // Signal spotActiveChanged(true) again on the next mouse move.
+
+  // Record all frames read from event sub-devices to the given file.
+  bool startRecording(const QString& path);
+  void stopRecording();
+
+signals:
+  void spotActiveChanged(bool active);
+  void readError(const QString& devicePath);
+
+protected:
+  void run() override;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  void onEventDataAvailable(SubEventConnection& connection);
+  void onHidrawDataAvailable(SubHidrawConnection& connection);
+  int nextTimeout() const;
+  void processTimeouts();
+
+  std::shared_ptr<VirtualDevice> m_virtualDevice;
+  Reactor m_reactor; // waits for device input, handlers are called with m_mutex locked
+  int m_wakeupFd = -1;
+
+  mutable std::mutex m_mutex; // guards m_connections and the handlers of m_reactor
+  std::map<int, std::shared_ptr<SubDeviceConnection>> m_connections;
+  InputRecording::Recorder m_recorder; // guarded by m_mutex
+
+  std::atomic<bool> m_resetSpotActivity{false};
+  bool m_spotActive = false; // only accessed from the input engine thread
+  Clock::time_point m_spotActiveUntil;
+};
@@ -0,0 +1,157 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "inputlatency.h"
+
+#include <QStringList>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+  // Ignore latencies that cannot be right, e.g. event timestamps from a different clock.
+  constexpr int64_t maxLatencyUsec = 60 * 1000 * 1000;
+
+  // -----------------------------------------------------------------------------------------------
+  QString usecToString(int64_t usec)
+  {
+    if (usec < 1000) return QString("%1us").arg(usec);
+    if (usec < 1000 * 1000) return QString("%1ms").arg(usec / 1000.0, 0, 'f', 1);
+    return QString("%1s").arg(usec / (1000.0 * 1000.0), 0, 'f', 2);
+  }
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+const std::array<int64_t, LatencyHistogram::NumBuckets - 1>& LatencyHistogram::bucketLimits()
+{
+  static const std::array<int64_t, NumBuckets - 1> limits = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000
+  };
+  return limits;
+}
+
+// -------------------------------------------------------------------------------------------------
+void LatencyHistogram::record(int64_t usec)
+{
+  const auto& limits = bucketLimits();
+  const auto bucket = std::lower_bound(limits.cbegin(), limits.cend(), usec) - limits.cbegin();
+
+  m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  m_sumUsec.fetch_add(usec, std::memory_order_relaxed);
+
+  int64_t max = m_maxUsec.load(std::memory_order_relaxed);
+  while (usec > max && !m_maxUsec.compare_exchange_weak(max, usec, std::memory_order_relaxed)) {}
+}
+
+// -------------------------------------------------------------------------------------------------
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+  Snapshot s;
+  for (size_t i = 0; i < NumBuckets; ++i) {
+    s.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+  }
+  s.count = m_count.load(std::memory_order_relaxed);
+  s.sumUsec = m_sumUsec.load(std::memory_order_relaxed);
+  s.maxUsec = m_maxUsec.load(std::memory_order_relaxed);
+  return s;
+}
+
+// -------------------------------------------------------------------------------------------------
+void LatencyHistogram::reset()
+{
+  for (auto& bucket : m_buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  m_count.store(0, std::memory_order_relaxed);
+  m_sumUsec.store(0, std::memory_order_relaxed);
+  m_maxUsec.store(0, std::memory_order_relaxed);
+}
+
+// -------------------------------------------------------------------------------------------------
+int64_t LatencyHistogram::Snapshot::meanUsec() const
+{
+  return count ? sumUsec / static_cast<int64_t>(count) : 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+int64_t LatencyHistogram::Snapshot::percentileUsec(double percentile) const
+{
+  if (count == 0) return 0;
+
+  const auto& limits = bucketLimits();
+  const double fraction = std::min(std::max(percentile, 0.0), 100.0) / 100.0;
+  const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(count * fraction)));
+
+  uint64_t sum = 0;
+  for (size_t i = 0; i < limits.size(); ++i)
+  {
+    sum += buckets[i];
+    if (sum >= rank) return std::min(limits[i], maxUsec);
+  }
+  return maxUsec;
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputLatencyStatistics::record(InputPath path, int64_t eventTimeUsec)
+{
+  const int64_t latency = monotonicTimeUsec() - eventTimeUsec;
+  if (latency < 0 || latency > maxLatencyUsec) return;
+
+  m_histograms[static_cast<size_t>(path)].record(latency);
+}
+
+// -------------------------------------------------------------------------------------------------
+const LatencyHistogram& InputLatencyStatistics::histogram(InputPath path) const
+{
+  return m_histograms[static_cast<size_t>(path)];
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputLatencyStatistics::reset()
+{
+  for (auto& histogram : m_histograms) {
+    histogram.reset();
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+const char* InputLatencyStatistics::pathName(InputPath path)
+{
+  switch (path)
+  {
+  case InputPath::MouseMove: return "mouse-move";
+  case InputPath::Forwarded: return "forwarded";
+  case InputPath::MappedAction: return "mapped-action";
+  case InputPath::SequenceTimeout: return "sequence-timeout";
+  }
+  return "unknown";
+}
+
+// -------------------------------------------------------------------------------------------------
+int64_t monotonicTimeUsec()
+{
+  // The steady clock is CLOCK_MONOTONIC on Linux.
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// -------------------------------------------------------------------------------------------------
+QString toString(const LatencyHistogram::Snapshot& s)
+{
+  if (s.count == 0) return QString("count=0");
+
+  QStringList buckets;
+  const auto& limits = LatencyHistogram::bucketLimits();
+  for (size_t i = 0; i < s.buckets.size(); ++i)
+  {
+    if (s.buckets[i] == 0) continue;
+    const QString limit = (i < limits.size()) ? "<=" + usecToString(limits[i])
+                                               : ">" + usecToString(limits.back());
+    buckets.push_back(QString("%1:%2").arg(limit).arg(s.buckets[i]));
+  }
+
+  return QString("count=%1 mean=%2 p50=%3 p99=%4 max=%5 [%6]")
+           .arg(s.count).arg(usecToString(s.meanUsec()))
+           .arg(usecToString(s.percentileUsec(50))).arg(usecToString(s.percentileUsec(99)))
+           .arg(usecToString(s.maxUsec)).arg(buckets.join(' '));
+}
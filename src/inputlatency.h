@@ -0,0 +1,74 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include <QString>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// -------------------------------------------------------------------------------------------------
+/// Latency histogram with fixed buckets. Values can be recorded without locking from the
+/// InputEngine thread while other threads take snapshots.
+class LatencyHistogram
+{
+public:
+  static constexpr size_t NumBuckets = 14;
+
+  // Upper bucket limits in microseconds, the last bucket has no upper limit.
+  static const std::array<int64_t, NumBuckets - 1>& bucketLimits();
+
+  struct Snapshot
+  {
+    std::array<uint64_t, NumBuckets> buckets{};
+    uint64_t count = 0;
+    int64_t sumUsec = 0;
+    int64_t maxUsec = 0;
+
+    int64_t meanUsec() const;
+    // Upper limit of the bucket containing the given percentile (0..100), or the maximum value.
+    int64_t percentileUsec(double percentile) const;
+  };
+
+  void record(int64_t usec);
+  Snapshot snapshot() const;
+  void reset();
+
+private:
+  std::array<std::atomic<uint64_t>, NumBuckets> m_buckets{};
+  std::atomic<uint64_t> m_count{0};
+  std::atomic<int64_t> m_sumUsec{0};
+  std::atomic<int64_t> m_maxUsec{0};
+};
+
+// -------------------------------------------------------------------------------------------------
+enum class InputPath : uint8_t {
+  MouseMove,       ///< Mouse move events passed through to the virtual device.
+  Forwarded,       ///< Events forwarded to the virtual device without a mapped action.
+  MappedAction,    ///< Execution of a mapped action.
+  SequenceTimeout, ///< Buffered events of an unfinished key sequence flushed after the timeout.
+};
+
+// -------------------------------------------------------------------------------------------------
+/// Latency of input events of one device, from the kernel timestamp of an event until it (or
+/// the action it is mapped to) has been written to the virtual device.
+class InputLatencyStatistics
+{
+public:
+  static constexpr size_t NumPaths = 4;
+
+  // Record the time from the given kernel event timestamp (in microseconds) until now.
+  void record(InputPath path, int64_t eventTimeUsec);
+
+  const LatencyHistogram& histogram(InputPath path) const;
+  void reset();
+
+  static const char* pathName(InputPath path);
+
+private:
+  std::array<LatencyHistogram, NumPaths> m_histograms;
+};
+
+// -------------------------------------------------------------------------------------------------
+int64_t monotonicTimeUsec(); // Current CLOCK_MONOTONIC time, same clock as the event timestamps.
+QString toString(const LatencyHistogram::Snapshot& snapshot);
@@ -0,0 +1,272 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "inputmapstore.h"
+
+#include "deviceinput.h"
+#include "logging.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+DECLARE_LOGGING_CATEGORY(input)
+
+namespace {
+  class InputMapStore_ : public QObject {}; // for i18n and logging
+
+  // Fixed stream version for actions, independent of the Qt version the file was written with.
+  constexpr auto actionStreamVersion = QDataStream::Qt_5_7;
+
+  struct PackedEvent {
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+  };
+  static_assert(sizeof(PackedEvent) == 8, "Unexpected packed event layout");
+
+  // -----------------------------------------------------------------------------------------------
+  template<typename T>
+  void append(QByteArray& data, const T& value) {
+    data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Bounds checked reads from the mapped payload.
+  class PayloadReader
+  {
+  public:
+    PayloadReader(const char* data, size_t size) : m_data(data), m_size(size) {}
+
+    template<typename T>
+    bool read(T& value)
+    {
+      if (m_size - m_pos < sizeof(T)) return false;
+      std::memcpy(&value, m_data + m_pos, sizeof(T));
+      m_pos += sizeof(T);
+      return true;
+    }
+
+    const char* take(size_t size)
+    {
+      if (m_size - m_pos < size) return nullptr;
+      const char* data = m_data + m_pos;
+      m_pos += size;
+      return data;
+    }
+
+    bool atEnd() const { return m_pos == m_size; }
+
+  private:
+    const char* const m_data;
+    const size_t m_size;
+    size_t m_pos = 0;
+  };
+} // --- end anonymous namespace
+
+namespace InputMapStore {
+  // -----------------------------------------------------------------------------------------------
+  uint32_t crc32(const char* data, size_t size)
+  {
+    static const auto table = []() {
+      std::array<uint32_t, 256> table{};
+      for (uint32_t i = 0; i < table.size(); ++i)
+      {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+        table[i] = c;
+      }
+      return table;
+    }();
+
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < size; ++i) {
+      crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool save(const QString& path, const InputMapConfig& config)
+  {
+    constexpr size_t maxCount = std::numeric_limits<uint16_t>::max();
+    const auto isStorable = [](const KeyEventSequence& sequence) {
+      return sequence.size() <= maxCount
+             && std::all_of(sequence.cbegin(), sequence.cend(), [](const KeyEvent& ke) {
+                  return ke.size() <= maxCount;
+                });
+    };
+
+    QByteArray payload;
+    uint32_t entryCount = 0;
+    for (const auto& item : config)
+    {
+      if (!item.second.action || !isStorable(item.first)) continue;
+
+      append(payload, static_cast<uint16_t>(item.first.size()));
+      for (const auto& keyEvent : item.first)
+      {
+        append(payload, static_cast<uint16_t>(keyEvent.size()));
+        for (const auto& e : keyEvent) {
+          append(payload, PackedEvent{ e.type, e.code, e.value });
+        }
+      }
+
+      QByteArray action;
+      QDataStream s(&action, QIODevice::WriteOnly);
+      s.setVersion(actionStreamVersion);
+      s << item.second;
+      append(payload, static_cast<uint32_t>(action.size()));
+      payload.append(action);
+      ++entryCount;
+    }
+
+    Header header{};
+    std::memcpy(header.magic, Magic, sizeof(header.magic));
+    header.version = Version;
+    header.entryCount = entryCount;
+    header.payloadSize = static_cast<uint32_t>(payload.size());
+    header.checksum = crc32(payload.constData(), payload.size());
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header)
+        || file.write(payload) != payload.size()
+        || !file.commit())
+    {
+      logError(input) << InputMapStore_::tr("Cannot write input mapping file '%1' (%2).")
+                              .arg(path, file.errorString());
+      return false;
+    }
+    return true;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  File::~File()
+  {
+    close();
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool File::open(const QString& path)
+  {
+    close();
+    m_path = path;
+
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+      m_errorString = InputMapStore_::tr("Cannot open input mapping file '%1' (%2).").arg(path).arg(errno);
+      if (fd >= 0) ::close(fd);
+      return false;
+    }
+
+    const auto fileSize = static_cast<size_t>(st.st_size);
+    void* mapping = (fileSize >= sizeof(Header))
+                    ? mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+      m_errorString = InputMapStore_::tr("'%1' is not an input mapping file.").arg(path);
+      return false;
+    }
+
+    const auto h = static_cast<const Header*>(mapping);
+    if (std::memcmp(h->magic, Magic, sizeof(Magic)) != 0 || h->version != Version
+        || fileSize - sizeof(Header) != h->payloadSize)
+    {
+      munmap(mapping, fileSize);
+      m_errorString = InputMapStore_::tr("'%1' is not a supported input mapping file.").arg(path);
+      return false;
+    }
+
+    m_mapping = mapping;
+    m_mappingSize = fileSize;
+    m_errorString.clear();
+    return true;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  void File::close()
+  {
+    if (m_mapping) munmap(m_mapping, m_mappingSize);
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  uint32_t File::entryCount() const
+  {
+    return m_mapping ? header()->entryCount : 0;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool File::decode(InputMapConfig& config) const
+  {
+    config.clear();
+    if (!m_mapping) return false;
+
+    const char* payload = static_cast<const char*>(m_mapping) + sizeof(Header);
+    if (crc32(payload, header()->payloadSize) != header()->checksum)
+    {
+      m_errorString = InputMapStore_::tr("Checksum mismatch in input mapping file '%1'.").arg(m_path);
+      return false;
+    }
+
+    PayloadReader reader(payload, header()->payloadSize);
+    for (uint32_t entry = 0; entry < header()->entryCount; ++entry)
+    {
+      uint16_t keyEventCount = 0;
+      if (!reader.read(keyEventCount)) break;
+
+      KeyEventSequence sequence(keyEventCount);
+      bool ok = true;
+      for (auto& keyEvent : sequence)
+      {
+        uint16_t eventCount = 0;
+        ok = reader.read(eventCount);
+        keyEvent.reserve(eventCount);
+        for (uint16_t i = 0; ok && i < eventCount; ++i)
+        {
+          PackedEvent e{};
+          ok = reader.read(e);
+          keyEvent.emplace_back(e.type, e.code, e.value);
+        }
+        if (!ok) break;
+      }
+
+      uint32_t actionSize = 0;
+      const char* actionData = (ok && reader.read(actionSize)) ? reader.take(actionSize) : nullptr;
+      if (!actionData) break;
+
+      QDataStream s(QByteArray::fromRawData(actionData, static_cast<int>(actionSize)));
+      s.setVersion(actionStreamVersion);
+      MappedAction action;
+      s >> action;
+      if (s.status() != QDataStream::Ok || !action.action) break;
+
+      config.emplace(std::move(sequence), std::move(action));
+    }
+
+    if (config.size() != header()->entryCount || !reader.atEnd())
+    {
+      config.clear();
+      m_errorString = InputMapStore_::tr("Invalid input mapping file '%1'.").arg(m_path);
+      return false;
+    }
+    return true;
+  }
+}
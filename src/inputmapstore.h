@@ -0,0 +1,61 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include <QString>
+
+#include <cstdint>
+
+class InputMapConfig;
+
+// -------------------------------------------------------------------------------------------------
+/// Compact binary storage of an InputMapConfig in a file per device. The file starts with a header
+/// with version, number of entries and a CRC-32 checksum of the payload. Key event sequences are
+/// stored as packed (type, code, value) events, actions in their QDataStream representation.
+/// Opening a file only maps it and checks the header, the entries are decoded on demand.
+namespace InputMapStore
+{
+  constexpr char Magic[8] = {'P','J','I','N','M','A','P','\0'};
+  constexpr uint32_t Version = 1;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t payloadSize; // bytes following the header
+    uint32_t checksum;    // CRC-32 of the payload
+  };
+  static_assert(sizeof(Header) == 24, "Unexpected input map header layout");
+
+  uint32_t crc32(const char* data, size_t size);
+
+  // Write the configuration atomically to the given file, the directory is created if necessary.
+  bool save(const QString& path, const InputMapConfig& config);
+
+  // -----------------------------------------------------------------------------------------------
+  /// Read-only memory mapping of a stored input map.
+  class File
+  {
+  public:
+    File() = default;
+    ~File();
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    bool open(const QString& path); // Maps the file and validates the header.
+    void close();
+    bool isOpen() const { return m_mapping != nullptr; }
+    const QString& errorString() const { return m_errorString; }
+
+    uint32_t entryCount() const;
+    // Validate the checksum and decode all entries, returns false for corrupt files.
+    bool decode(InputMapConfig& config) const;
+
+  private:
+    const Header* header() const { return static_cast<const Header*>(m_mapping); }
+
+    void* m_mapping = nullptr;
+    size_t m_mappingSize = 0;
+    QString m_path;
+    mutable QString m_errorString;
+  };
+}
@@ -0,0 +1,285 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "inputrecording.h"
+
+#include "deviceinput.h"
+#include "logging.h"
+#include "virtualdevice.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/input.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+DECLARE_LOGGING_CATEGORY(input)
+
+namespace {
+  class InputRecording_ : public QObject {}; // for i18n and logging
+
+  constexpr size_t recorderBufferSize = 256; // events
+
+  // Frames longer than this are split, device frames are much shorter.
+  constexpr size_t maxReplayFrameSize = 64;
+
+  // -----------------------------------------------------------------------------------------------
+  bool writeAll(int fd, const void* data, size_t size)
+  {
+    auto bytes = static_cast<const char*>(data);
+    while (size)
+    {
+      const ssize_t written = ::write(fd, bytes, size);
+      if (written < 0 && errno == EINTR) continue;
+      if (written <= 0) return false;
+      bytes += written;
+      size -= static_cast<size_t>(written);
+    }
+    return true;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Read all events written to the sink file descriptor of a virtual device.
+  std::vector<InputRecording::Event> readSink(int fd)
+  {
+    std::vector<InputRecording::Event> events;
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || lseek(fd, 0, SEEK_SET) < 0) return events;
+
+    const size_t num = static_cast<size_t>(st.st_size) / sizeof(input_event);
+    std::vector<input_event> buffer(num);
+    if (::read(fd, buffer.data(), num * sizeof(input_event)) != static_cast<ssize_t>(num * sizeof(input_event))) {
+      return events;
+    }
+
+    events.reserve(num);
+    for (const auto& ie : buffer) {
+      events.push_back(InputRecording::Event{0, ie.type, ie.code, ie.value});
+    }
+    return events;
+  }
+} // --- end anonymous namespace
+
+namespace InputRecording {
+  // -----------------------------------------------------------------------------------------------
+  Recorder::~Recorder()
+  {
+    close();
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool Recorder::open(const QString& path)
+  {
+    close();
+
+    m_fd = ::open(QFile::encodeName(path).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+      logError(input) << InputRecording_::tr("Cannot open recording file '%1' (%2).").arg(path).arg(errno);
+      return false;
+    }
+
+    Header header{};
+    std::memcpy(header.magic, Magic, sizeof(header.magic));
+    header.version = Version;
+    header.eventSize = sizeof(Event);
+    if (!writeAll(m_fd, &header, sizeof(header)))
+    {
+      logError(input) << InputRecording_::tr("Cannot write recording file '%1'.").arg(path);
+      close();
+      return false;
+    }
+
+    m_buffer.reserve(recorderBufferSize);
+    m_eventCount = 0;
+    return true;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  void Recorder::close()
+  {
+    if (m_fd < 0) return;
+
+    flush();
+    ::close(m_fd);
+    m_fd = -1;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  void Recorder::record(const struct input_event events[], size_t num)
+  {
+    if (m_fd < 0) return;
+
+    for (size_t i = 0; i < num; ++i)
+    {
+      m_buffer.push_back(Event{eventTimeUsec(events[i]), events[i].type, events[i].code, events[i].value});
+      if (m_buffer.size() == recorderBufferSize) flush();
+    }
+    m_eventCount += num;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool Recorder::flush()
+  {
+    if (m_fd < 0 || m_buffer.empty()) return true;
+
+    const bool ok = writeAll(m_fd, m_buffer.data(), m_buffer.size() * sizeof(Event));
+    if (!ok) logError(input) << InputRecording_::tr("Error while writing input recording.");
+    m_buffer.resize(0);
+    return ok;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool write(const QString& path, const std::vector<Event>& events)
+  {
+    const int fd = ::open(QFile::encodeName(path).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+      logError(input) << InputRecording_::tr("Cannot open recording file '%1' (%2).").arg(path).arg(errno);
+      return false;
+    }
+
+    Header header{};
+    std::memcpy(header.magic, Magic, sizeof(header.magic));
+    header.version = Version;
+    header.eventSize = sizeof(Event);
+    const bool ok = writeAll(fd, &header, sizeof(header))
+                    && writeAll(fd, events.data(), events.size() * sizeof(Event));
+    ::close(fd);
+
+    if (!ok) logError(input) << InputRecording_::tr("Cannot write recording file '%1'.").arg(path);
+    return ok;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  File::~File()
+  {
+    close();
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool File::open(const QString& path)
+  {
+    close();
+
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+      m_errorString = InputRecording_::tr("Cannot open recording file '%1' (%2).").arg(path).arg(errno);
+      if (fd >= 0) ::close(fd);
+      return false;
+    }
+
+    const auto fileSize = static_cast<size_t>(st.st_size);
+    if (fileSize < sizeof(Header))
+    {
+      ::close(fd);
+      m_errorString = InputRecording_::tr("'%1' is not an input recording.").arg(path);
+      return false;
+    }
+
+    void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+      m_errorString = InputRecording_::tr("Cannot map recording file '%1' (%2).").arg(path).arg(errno);
+      return false;
+    }
+
+    const auto header = static_cast<const Header*>(mapping);
+    if (std::memcmp(header->magic, Magic, sizeof(Magic)) != 0 || header->version != Version
+        || header->eventSize != sizeof(Event))
+    {
+      munmap(mapping, fileSize);
+      m_errorString = InputRecording_::tr("'%1' is not a supported input recording.").arg(path);
+      return false;
+    }
+
+    m_mapping = mapping;
+    m_mappingSize = fileSize;
+    m_events = reinterpret_cast<const Event*>(static_cast<const char*>(mapping) + sizeof(Header));
+    m_size = (fileSize - sizeof(Header)) / sizeof(Event);
+    m_errorString.clear();
+    return true;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  void File::close()
+  {
+    if (m_mapping) munmap(m_mapping, m_mappingSize);
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+    m_events = nullptr;
+    m_size = 0;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  ReplayResult replay(const File& recording, const InputMapConfig& config, int keyEventInterval)
+  {
+    ReplayResult result;
+
+    const int sinkFd = memfd_create("projecteur-replay", MFD_CLOEXEC);
+    const auto virtualDevice = VirtualDevice::createSink(sinkFd);
+    if (!virtualDevice)
+    {
+      result.errorString = InputRecording_::tr("Cannot create replay output (%1).").arg(errno);
+      return result;
+    }
+
+    InputMapper mapper(virtualDevice);
+    mapper.setVirtualTime(true);
+    if (keyEventInterval >= 0) mapper.setKeyEventInterval(keyEventInterval);
+    mapper.setConfiguration(config);
+
+    std::array<input_event, maxReplayFrameSize> frame;
+    size_t frameSize = 0;
+    int64_t lastEventTime = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (size_t i = 0; i < recording.size(); ++i)
+    {
+      const auto& event = recording.events()[i];
+      auto& ie = frame[frameSize++];
+      ie = input_event{};
+      setEventTimeUsec(ie, event.timeUsec);
+      ie.type = event.type;
+      ie.code = event.code;
+      ie.value = event.value;
+      lastEventTime = event.timeUsec;
+
+      const bool isFrameEnd = (event.type == EV_SYN && event.code == SYN_REPORT);
+      if (!isFrameEnd && frameSize < frame.size()) continue;
+
+      // Timeouts that expired before this frame happen first, as in the InputEngine.
+      mapper.processTimeout(event.timeUsec);
+
+      ++result.frames;
+      const bool isMouseMoveEvent = frame[0].type == EV_REL
+                                    && (frame[0].code == REL_X || frame[0].code == REL_Y);
+      if (isMouseMoveEvent)
+      {
+        ++result.mouseMoveFrames;
+        virtualDevice->emitEvents(frame.data(), frameSize);
+      }
+      else {
+        mapper.addEvents(frame.data(), frameSize);
+      }
+      frameSize = 0;
+    }
+
+    // Let pending key sequences time out.
+    mapper.processTimeout(lastEventTime + 60 * 1000 * 1000);
+    result.durationNsecs = timer.nsecsElapsed();
+
+    result.emitted = readSink(sinkFd);
+    result.ok = true;
+    return result;
+  }
+}
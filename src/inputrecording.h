@@ -0,0 +1,107 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include <QString>
+
+#include <cstdint>
+#include <vector>
+
+class InputMapConfig;
+struct input_event;
+
+// -------------------------------------------------------------------------------------------------
+/// Binary recording of raw device input events. The file starts with a header, followed by the
+/// events in a fixed size, architecture independent layout (host byte order), so a recording
+/// can be memory mapped and used in place. Frames are terminated by a SYN_REPORT event.
+namespace InputRecording
+{
+  constexpr char Magic[8] = {'P','J','E','V','R','E','C','\0'};
+  constexpr uint32_t Version = 1;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t eventSize; // sizeof(Event)
+  };
+
+  struct Event {
+    int64_t timeUsec; // kernel timestamp (CLOCK_MONOTONIC)
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+  };
+  static_assert(sizeof(Header) == 16 && sizeof(Event) == 16, "Unexpected recording layout");
+
+  // -----------------------------------------------------------------------------------------------
+  /// Appends events to a recording file. Events are buffered and written in blocks.
+  class Recorder
+  {
+  public:
+    Recorder() = default;
+    ~Recorder();
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    bool open(const QString& path); // Truncates an existing file.
+    void close();
+    bool isOpen() const { return m_fd >= 0; }
+
+    void record(const struct input_event events[], size_t num);
+    bool flush();
+    uint64_t eventCount() const { return m_eventCount; }
+
+  private:
+    int m_fd = -1;
+    std::vector<Event> m_buffer;
+    uint64_t m_eventCount = 0;
+  };
+
+  /// Write events to a new recording file at once.
+  bool write(const QString& path, const std::vector<Event>& events);
+
+  // -----------------------------------------------------------------------------------------------
+  /// Read-only memory mapping of a recording file.
+  class File
+  {
+  public:
+    File() = default;
+    ~File();
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    bool open(const QString& path);
+    void close();
+    const QString& errorString() const { return m_errorString; }
+
+    const Event* events() const { return m_events; }
+    size_t size() const { return m_size; }
+
+  private:
+    void* m_mapping = nullptr;
+    size_t m_mappingSize = 0;
+    const Event* m_events = nullptr;
+    size_t m_size = 0;
+    QString m_errorString;
+  };
+
+  // -----------------------------------------------------------------------------------------------
+  /// Result of a replay: the events written to the virtual device and throughput numbers.
+  struct ReplayResult
+  {
+    uint64_t frames = 0;          // frames fed to the input mapper or forwarded as mouse moves
+    uint64_t mouseMoveFrames = 0; // frames passed through without input mapping
+    std::vector<Event> emitted;   // events written to the virtual device (without timestamps)
+    int64_t durationNsecs = 0;    // wall time of the replay
+    bool ok = false;
+    QString errorString;
+
+    double framesPerSecond() const {
+      return durationNsecs > 0 ? frames * 1e9 / durationNsecs : 0.0;
+    }
+  };
+
+  /// Deterministic replay of a recording through an InputMapper with the given configuration.
+  /// The event timestamps are the only time source, key sequence timeouts happen in virtual time.
+  /// Mouse move frames skip the input mapper, like in the InputEngine.
+  ReplayResult replay(const File& recording, const InputMapConfig& config, int keyEventInterval = -1);
+}
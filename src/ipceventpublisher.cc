@@ -0,0 +1,211 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "ipceventpublisher.h"
+
+#include "logging.h"
+
+#include <QDateTime>
+#include <QLocalSocket>
+#include <QTimer>
+
+#include <algorithm>
+
+DECLARE_LOGGING_CATEGORY(cmdserver)
+
+// -------------------------------------------------------------------------------------------------
+IpcEventPublisher::IpcEventPublisher(QObject* parent)
+  : QObject(parent)
+  , m_cursorTimer(new QTimer(this))
+{
+  m_cursorTimer->setSingleShot(true);
+  connect(m_cursorTimer, &QTimer::timeout, this, &IpcEventPublisher::sendPendingCursorPositions);
+}
+
+// -------------------------------------------------------------------------------------------------
+IpcEventPublisher::~IpcEventPublisher() = default;
+
+// -------------------------------------------------------------------------------------------------
+bool IpcEventPublisher::subscribe(QLocalSocket* client, const QString& topics)
+{
+  IpcProtocol::Topics mask = 0;
+  int cursorIntervalMsecs = DefaultCursorIntervalMsecs;
+  if (!IpcProtocol::parseTopics(topics, mask, cursorIntervalMsecs)) {
+    return false;
+  }
+
+  if (mask == 0)
+  {
+    unsubscribe(client);
+    return true;
+  }
+
+  auto it = m_subscribers.find(client);
+  if (it == m_subscribers.end())
+  {
+    it = m_subscribers.emplace(client, Subscriber()).first;
+    connect(client, &QLocalSocket::bytesWritten, this, [this, client]() {
+      const auto it = m_subscribers.find(client);
+      if (it != m_subscribers.end()) drain(client, it->second);
+    });
+    connect(client, &QObject::destroyed, this, [this, client]() {
+      m_subscribers.erase(client);
+      updateTopics();
+    });
+  }
+
+  it->second.topics = mask;
+  it->second.cursorIntervalMsecs = cursorIntervalMsecs;
+  updateTopics();
+
+  logDebug(cmdserver) << tr("Client subscribed to events (%1).").arg(topics);
+  return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+void IpcEventPublisher::unsubscribe(QLocalSocket* client)
+{
+  if (m_subscribers.erase(client) == 0) return;
+
+  disconnect(client, nullptr, this, nullptr);
+  updateTopics();
+}
+
+// -------------------------------------------------------------------------------------------------
+void IpcEventPublisher::updateTopics()
+{
+  m_topics = 0;
+  for (const auto& item : m_subscribers) {
+    m_topics |= item.second.topics;
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+void IpcEventPublisher::publish(IpcProtocol::Event event)
+{
+  if (!(m_topics & IpcProtocol::topic(event.type))) return;
+
+  if (event.timestamp == 0) event.timestamp = QDateTime::currentMSecsSinceEpoch();
+  const QByteArray encodedEvent = IpcProtocol::encodeEvent(event);
+  for (auto& item : m_subscribers)
+  {
+    if (item.second.topics & IpcProtocol::topic(event.type)) {
+      enqueue(item.second, encodedEvent);
+    }
+  }
+  scheduleDrain();
+}
+
+// -------------------------------------------------------------------------------------------------
+void IpcEventPublisher::publishCursorPosition(const QPoint& pos)
+{
+  m_cursorPos = pos;
+  if (!(m_topics & IpcProtocol::topic(IpcProtocol::EventType::CursorPosition))) return;
+
+  for (auto& item : m_subscribers)
+  {
+    auto& subscriber = item.second;
+    if (!(subscriber.topics & IpcProtocol::topic(IpcProtocol::EventType::CursorPosition))) continue;
+    subscriber.cursorPending = true;
+  }
+  sendPendingCursorPositions();
+}
+
+// -------------------------------------------------------------------------------------------------
+void IpcEventPublisher::sendPendingCursorPositions()
+{
+  IpcProtocol::Event event;
+  event.type = IpcProtocol::EventType::CursorPosition;
+  event.x = m_cursorPos.x();
+  event.y = m_cursorPos.y();
+  QByteArray encodedEvent;
+
+  // Send the latest position to subscribers whose interval has passed, wait for the others.
+  int nextTimeout = -1;
+  for (auto& item : m_subscribers)
+  {
+    auto& subscriber = item.second;
+    if (!subscriber.cursorPending) continue;
+
+    const auto remaining = subscriber.lastCursor.isValid()
+                           ? subscriber.cursorIntervalMsecs - subscriber.lastCursor.elapsed() : 0;
+    if (remaining > 0)
+    {
+      const int msecs = static_cast<int>(remaining);
+      nextTimeout = (nextTimeout < 0) ? msecs : std::min(nextTimeout, msecs);
+      continue;
+    }
+
+    if (encodedEvent.isEmpty())
+    {
+      event.timestamp = QDateTime::currentMSecsSinceEpoch();
+      encodedEvent = IpcProtocol::encodeEvent(event);
+    }
+    enqueue(subscriber, encodedEvent);
+    subscriber.cursorPending = false;
+    subscriber.lastCursor.start();
+  }
+
+  if (nextTimeout >= 0
+      && (!m_cursorTimer->isActive() || nextTimeout < m_cursorTimer->remainingTime())) {
+    m_cursorTimer->start(nextTimeout);
+  }
+  if (!encodedEvent.isEmpty()) scheduleDrain();
+}
+
+// -------------------------------------------------------------------------------------------------
+void IpcEventPublisher::enqueue(Subscriber& subscriber, const QByteArray& encodedEvent)
+{
+  // Drop oldest: the client is informed about the number of dropped events and sees the most
+  // recent state, which is more useful for observers than old events.
+  if (subscriber.queue.size() >= MaxQueuedEvents)
+  {
+    subscriber.queue.pop_front();
+    ++subscriber.dropped;
+    ++m_droppedEvents;
+  }
+  subscriber.queue.push_back(encodedEvent);
+}
+
+// -------------------------------------------------------------------------------------------------
+void IpcEventPublisher::scheduleDrain()
+{
+  // Events published in the same event loop iteration are sent in one frame.
+  if (m_drainScheduled) return;
+  m_drainScheduled = true;
+  QTimer::singleShot(0, this, [this]() {
+    m_drainScheduled = false;
+    drainAll();
+  });
+}
+
+// -------------------------------------------------------------------------------------------------
+void IpcEventPublisher::drainAll()
+{
+  for (auto& item : m_subscribers) {
+    drain(item.first, item.second);
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+void IpcEventPublisher::drain(QLocalSocket* client, Subscriber& subscriber)
+{
+  if (client->state() != QLocalSocket::ConnectedState) return;
+
+  // Only write while the socket buffer is below the limit, otherwise events stay in the bounded
+  // queue until the client has read enough (bytesWritten).
+  while (!subscriber.queue.empty() && client->bytesToWrite() < MaxBufferedBytes)
+  {
+    std::vector<QByteArray> events;
+    int frameSize = 0;
+    constexpr int maxFrameSize = static_cast<int>(IpcProtocol::MaxFrameSize) - 64;
+    while (!subscriber.queue.empty()
+           && (events.empty() || frameSize + subscriber.queue.front().size() < maxFrameSize))
+    {
+      frameSize += subscriber.queue.front().size();
+      events.emplace_back(std::move(subscriber.queue.front()));
+      subscriber.queue.pop_front();
+    }
+
+    client->write(IpcProtocol::eventFrame(subscriber.dropped, events));
+    subscriber.dropped = 0;
+  }
+}
@@ -0,0 +1,74 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include "ipcprotocol.h"
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QPoint>
+
+#include <cstdint>
+#include <deque>
+#include <map>
+
+class QLocalSocket;
+class QTimer;
+
+// -------------------------------------------------------------------------------------------------
+/// Sends events to subscribed IPC clients. Every subscriber has a bounded queue; if a client does
+/// not read fast enough, its socket write buffer fills up and further events are queued. When the
+/// queue is full, the oldest events are dropped and the number of dropped events is reported to
+/// the client with the next event frame. Publishing therefore never blocks the GUI thread and the
+/// memory per subscriber is limited. Cursor positions are throttled per subscriber, only the latest
+/// position is sent after the interval.
+class IpcEventPublisher : public QObject
+{
+  Q_OBJECT
+
+public:
+  static constexpr size_t MaxQueuedEvents = 256;
+  static constexpr qint64 MaxBufferedBytes = 16 * 1024; // socket write buffer limit per subscriber
+  static constexpr int DefaultCursorIntervalMsecs = 100;
+
+  explicit IpcEventPublisher(QObject* parent = nullptr);
+  ~IpcEventPublisher() override;
+
+  // Subscribe the client to the given topics (see IpcProtocol::parseTopics), replaces a previous
+  // subscription of the client. An empty topic list unsubscribes. Returns false for invalid topics.
+  bool subscribe(QLocalSocket* client, const QString& topics);
+  void unsubscribe(QLocalSocket* client);
+  size_t subscriberCount() const { return m_subscribers.size(); }
+
+  // Topics of all current subscribers, to avoid creating events no one is interested in.
+  IpcProtocol::Topics topics() const { return m_topics; }
+
+  void publish(IpcProtocol::Event event);
+  void publishCursorPosition(const QPoint& pos);
+
+  uint64_t droppedEvents() const { return m_droppedEvents; }
+
+private:
+  struct Subscriber
+  {
+    IpcProtocol::Topics topics = 0;
+    std::deque<QByteArray> queue; // encoded events
+    quint32 dropped = 0; // events dropped since the last event frame
+    int cursorIntervalMsecs = DefaultCursorIntervalMsecs;
+    QElapsedTimer lastCursor;
+    bool cursorPending = false;
+  };
+
+  void enqueue(Subscriber& subscriber, const QByteArray& encodedEvent);
+  void scheduleDrain();
+  void drain(QLocalSocket* client, Subscriber& subscriber);
+  void drainAll();
+  void sendPendingCursorPositions();
+  void updateTopics();
+
+  std::map<QLocalSocket*, Subscriber> m_subscribers;
+  IpcProtocol::Topics m_topics = 0;
+  QTimer* const m_cursorTimer;
+  QPoint m_cursorPos;
+  bool m_drainScheduled = false;
+  uint64_t m_droppedEvents = 0;
+};
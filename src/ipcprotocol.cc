@@ -0,0 +1,302 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "ipcprotocol.h"
+
+#include <QDataStream>
+#include <QIODevice>
+#include <QStringList>
+
+namespace {
+  // Fixed stream version, clients written with other Qt versions (or languages) rely on it.
+  constexpr auto streamVersion = QDataStream::Qt_5_7;
+
+  // -----------------------------------------------------------------------------------------------
+  QByteArray frame(quint32 flags, const QByteArray& payload)
+  {
+    QByteArray block;
+    {
+      QDataStream out(&block, QIODevice::WriteOnly);
+      out << (flags | static_cast<quint32>(payload.size()));
+    }
+    block.append(payload);
+    return block;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool hasDevice(IpcProtocol::EventType type)
+  {
+    using IpcProtocol::EventType;
+    return type == EventType::DeviceConnected || type == EventType::DeviceDisconnected
+           || type == EventType::ActionMapped;
+  }
+} // --- end anonymous namespace
+
+namespace IpcProtocol {
+  // -----------------------------------------------------------------------------------------------
+  QByteArray commandFrame(const QByteArray& command)
+  {
+    return frame(0, command);
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  QByteArray batchFrame(const Batch& batch)
+  {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(streamVersion);
+    out << batch.firstSequence << static_cast<quint32>(batch.commands.size());
+    for (const auto& command : batch.commands) {
+      out << command;
+    }
+    return frame(BatchFrameFlag, payload);
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  QByteArray ackFrame(const std::vector<Ack>& acks)
+  {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(streamVersion);
+    out << static_cast<quint32>(acks.size());
+    for (const auto& ack : acks) {
+      out << ack.sequence << static_cast<quint8>(ack.status) << ack.reply;
+    }
+    return frame(BatchFrameFlag, payload);
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool parseTopics(const QString& topics, Topics& mask, int& cursorIntervalMsecs)
+  {
+    mask = 0;
+    for (const auto& item : topics.split(','))
+    {
+      const QString name = item.section(':', 0, 0).trimmed().toLower();
+      const QString argument = item.section(':', 1).trimmed();
+      if (name.isEmpty()) {
+        continue;
+      }
+      else if (name == "spot") {
+        mask |= topic(EventType::SpotActiveChanged);
+      }
+      else if (name == "devices") {
+        mask |= topic(EventType::DeviceConnected) | topic(EventType::DeviceDisconnected);
+      }
+      else if (name == "actions") {
+        mask |= topic(EventType::ActionMapped);
+      }
+      else if (name == "presets") {
+        mask |= topic(EventType::PresetLoaded);
+      }
+      else if (name == "all") {
+        mask |= topic(EventType::SpotActiveChanged) | topic(EventType::DeviceConnected)
+                | topic(EventType::DeviceDisconnected) | topic(EventType::ActionMapped)
+                | topic(EventType::PresetLoaded);
+      }
+      else if (name == "cursor")
+      {
+        mask |= topic(EventType::CursorPosition);
+        if (argument.isEmpty()) continue;
+        bool ok = false;
+        cursorIntervalMsecs = argument.toInt(&ok);
+        if (!ok || cursorIntervalMsecs < 0) return false;
+      }
+      else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  QByteArray encodeEvent(const Event& event)
+  {
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(streamVersion);
+    out << static_cast<quint8>(event.type) << event.timestamp;
+    if (hasDevice(event.type)) {
+      out << event.vendorId << event.productId;
+    }
+
+    switch (event.type)
+    {
+    case EventType::SpotActiveChanged:
+    case EventType::ActionMapped:
+      out << event.value;
+      break;
+    case EventType::DeviceConnected:
+    case EventType::DeviceDisconnected:
+    case EventType::PresetLoaded:
+      out << event.text;
+      break;
+    case EventType::CursorPosition:
+      out << event.x << event.y;
+      break;
+    }
+    return data;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  QByteArray eventFrame(quint32 dropped, const std::vector<QByteArray>& encodedEvents)
+  {
+    QByteArray payload;
+    {
+      QDataStream out(&payload, QIODevice::WriteOnly);
+      out << dropped << static_cast<quint32>(encodedEvents.size());
+    }
+    for (const auto& event : encodedEvents) {
+      payload.append(event);
+    }
+    return frame(EventFrameFlag, payload);
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool parseBatch(const QByteArray& payload, Batch& batch)
+  {
+    QDataStream in(payload);
+    in.setVersion(streamVersion);
+    quint32 count = 0;
+    in >> batch.firstSequence >> count;
+
+    // Each command needs at least its size, do not trust the count for the allocation.
+    const auto maxCount = static_cast<quint32>(payload.size()) / sizeof(quint32);
+    if (in.status() != QDataStream::Ok || count > maxCount) return false;
+
+    batch.commands.clear();
+    batch.commands.reserve(count);
+    for (quint32 i = 0; i < count; ++i)
+    {
+      QByteArray command;
+      in >> command;
+      if (in.status() != QDataStream::Ok) return false;
+      batch.commands.emplace_back(std::move(command));
+    }
+    return in.atEnd();
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool parseAcks(const QByteArray& payload, std::vector<Ack>& acks)
+  {
+    QDataStream in(payload);
+    in.setVersion(streamVersion);
+    quint32 count = 0;
+    in >> count;
+    const auto maxCount = static_cast<quint32>(payload.size()) / sizeof(quint32);
+    if (in.status() != QDataStream::Ok || count > maxCount) return false;
+
+    acks.clear();
+    acks.reserve(count);
+    for (quint32 i = 0; i < count; ++i)
+    {
+      Ack ack;
+      quint8 status = 0;
+      in >> ack.sequence >> status >> ack.reply;
+      if (in.status() != QDataStream::Ok) return false;
+      ack.status = static_cast<Status>(status);
+      acks.emplace_back(std::move(ack));
+    }
+    return in.atEnd();
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool parseEvents(const QByteArray& payload, quint32& dropped, std::vector<Event>& events)
+  {
+    QDataStream in(payload);
+    in.setVersion(streamVersion);
+    quint32 count = 0;
+    in >> dropped >> count;
+    const auto maxCount = static_cast<quint32>(payload.size()) / (sizeof(quint8) + sizeof(qint64));
+    if (in.status() != QDataStream::Ok || count > maxCount) return false;
+
+    events.clear();
+    events.reserve(count);
+    for (quint32 i = 0; i < count; ++i)
+    {
+      Event event;
+      quint8 type = 0;
+      in >> type >> event.timestamp;
+      event.type = static_cast<EventType>(type);
+      if (hasDevice(event.type)) {
+        in >> event.vendorId >> event.productId;
+      }
+
+      switch (event.type)
+      {
+      case EventType::SpotActiveChanged:
+      case EventType::ActionMapped:
+        in >> event.value;
+        break;
+      case EventType::DeviceConnected:
+      case EventType::DeviceDisconnected:
+      case EventType::PresetLoaded:
+        in >> event.text;
+        break;
+      case EventType::CursorPosition:
+        in >> event.x >> event.y;
+        break;
+      default:
+        return false; // unknown events cannot be skipped
+      }
+
+      if (in.status() != QDataStream::Ok) return false;
+      events.emplace_back(std::move(event));
+    }
+    return in.atEnd();
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  const char* statusName(Status status)
+  {
+    switch (status)
+    {
+    case Status::Ok: return "ok";
+    case Status::UnknownCommand: return "unknown";
+    case Status::InvalidCommand: return "invalid";
+    }
+    return "error";
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  const char* eventName(EventType type)
+  {
+    switch (type)
+    {
+    case EventType::SpotActiveChanged: return "spotActiveChanged";
+    case EventType::DeviceConnected: return "deviceConnected";
+    case EventType::DeviceDisconnected: return "deviceDisconnected";
+    case EventType::ActionMapped: return "actionMapped";
+    case EventType::PresetLoaded: return "presetLoaded";
+    case EventType::CursorPosition: return "cursorPosition";
+    }
+    return "unknown";
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  FrameReader::Result FrameReader::read(QIODevice* device, QByteArray& payload, FrameType& type)
+  {
+    if (!m_hasHeader)
+    {
+      if (device->bytesAvailable() < static_cast<qint64>(sizeof(quint32))) {
+        return Result::Incomplete;
+      }
+      QDataStream in(device);
+      in >> m_header;
+      m_hasHeader = true;
+    }
+
+    const quint32 flags = m_header & FrameTypeMask;
+    const quint32 size = m_header & ~FrameTypeMask;
+    if (flags == FrameTypeMask || size > (flags ? MaxFrameSize : MaxCommandSize)) {
+      return Result::Invalid;
+    }
+
+    if (device->bytesAvailable() < size) {
+      return Result::Incomplete;
+    }
+
+    type = (flags == BatchFrameFlag) ? FrameType::Batch
+           : (flags == EventFrameFlag) ? FrameType::Event : FrameType::Command;
+    payload = device->read(size);
+    m_hasHeader = false;
+    return Result::Frame;
+  }
+}
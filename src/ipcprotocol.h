@@ -0,0 +1,110 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+
+#include <vector>
+
+class QIODevice;
+
+// -------------------------------------------------------------------------------------------------
+/// Framing of the local IPC between command line clients and the running instance.
+/// Every frame starts with a quint32 header (big endian) that holds the payload size.
+///  - Version 1: The payload is a single 'key=value' command of at most MaxCommandSize bytes,
+///    only some commands (e.g. 'stats') are answered with a version 1 reply frame.
+///  - Version 2: The BatchFrameFlag is set in the header. A batch payload holds the sequence
+///    number of the first command and any number of commands. The instance answers each batch
+///    with an ack frame that holds the sequence number, status and reply of every command.
+///    Version 2 connections are persistent and can pipeline batches without waiting for acks.
+///    Clients send an empty batch as handshake if they have no commands to send yet; it is
+///    not acknowledged.
+///  - Events: After a 'subscribe=TOPICS' command on a version 2 connection, the instance sends
+///    frames with the EventFrameFlag set. An event payload holds the number of events dropped
+///    since the last event frame (the queue of a slow subscriber is bounded) and the events.
+namespace IpcProtocol
+{
+  constexpr quint32 BatchFrameFlag = 0x80000000u;
+  constexpr quint32 EventFrameFlag = 0x40000000u;
+  constexpr quint32 FrameTypeMask = BatchFrameFlag | EventFrameFlag;
+  constexpr quint32 MaxCommandSize = 256;
+  constexpr quint32 MaxFrameSize = 64 * 1024;
+
+  enum class Status : quint8 {
+    Ok = 0,
+    UnknownCommand = 1,
+    InvalidCommand = 2,
+  };
+
+  struct Ack
+  {
+    quint32 sequence = 0;
+    Status status = Status::Ok;
+    QByteArray reply;
+  };
+
+  struct Batch
+  {
+    quint32 firstSequence = 0;
+    std::vector<QByteArray> commands;
+  };
+
+  enum class EventType : quint8 {
+    SpotActiveChanged = 1,  // value: spot active
+    DeviceConnected = 2,    // vendorId, productId, text: device name
+    DeviceDisconnected = 3, // vendorId, productId, text: device name
+    ActionMapped = 4,       // vendorId, productId, value: Action::Type
+    PresetLoaded = 5,       // text: preset name
+    CursorPosition = 6,     // x, y
+  };
+
+  struct Event
+  {
+    EventType type = EventType::SpotActiveChanged;
+    qint64 timestamp = 0; // msecs since epoch
+    quint16 vendorId = 0;
+    quint16 productId = 0;
+    qint32 value = 0;
+    qint32 x = 0;
+    qint32 y = 0;
+    QString text;
+  };
+
+  // Bit mask of event types for subscriptions.
+  using Topics = quint32;
+  constexpr Topics topic(EventType type) { return 1u << static_cast<quint8>(type); }
+  // Parses a comma separated list of topics (spot, devices, actions, presets, cursor, all),
+  // 'cursor' accepts an optional minimum interval in msecs, e.g. 'cursor:50'.
+  bool parseTopics(const QString& topics, Topics& mask, int& cursorIntervalMsecs);
+
+  QByteArray commandFrame(const QByteArray& command); // version 1 command and reply frames
+  QByteArray batchFrame(const Batch& batch);
+  QByteArray ackFrame(const std::vector<Ack>& acks);
+  QByteArray encodeEvent(const Event& event);
+  // The events must be encoded with encodeEvent.
+  QByteArray eventFrame(quint32 dropped, const std::vector<QByteArray>& encodedEvents);
+
+  bool parseBatch(const QByteArray& payload, Batch& batch);
+  bool parseAcks(const QByteArray& payload, std::vector<Ack>& acks);
+  bool parseEvents(const QByteArray& payload, quint32& dropped, std::vector<Event>& events);
+
+  const char* statusName(Status status);
+  const char* eventName(EventType type);
+
+  // -----------------------------------------------------------------------------------------------
+  /// Incremental reading of frames from a socket; keeps the header of a partially received frame.
+  class FrameReader
+  {
+  public:
+    enum class Result { Incomplete, Frame, Invalid };
+    enum class FrameType { Command, Batch, Event };
+
+    // Reads the next complete frame from the device, payload and type are only set for
+    // Result::Frame.
+    Result read(QIODevice* device, QByteArray& payload, FrameType& type);
+
+  private:
+    bool m_hasHeader = false;
+    quint32 m_header = 0;
+  };
+}
@@ -9,6 +9,7 @@
 #include <QString>
 
 #include <iostream>
+#include <mutex>
 
 namespace {
   // -----------------------------------------------------------------------------------------------
@@ -104,8 +105,11 @@ namespace {
   }
 
   // -----------------------------------------------------------------------------------------------
-  // Currently all logging is done from within the Qt Gui thread
-  // - if that changes and multiple threads will log, this needs a serious overhaul - NOT thread safe
+  // Logging is done from the Qt Gui thread and the input engine thread, the text edit is
+  // only accessed via queued invocations.
+  std::mutex logMutex;
+
+  // -----------------------------------------------------------------------------------------------
   void projecteurLogHandler(QtMsgType type, const QMessageLogContext &context, const QString &msgQString)
   {
     const char *category = context.category ? context.category : "";
@@ -119,6 +123,7 @@ namespace {
     const auto logMsg = QString("[%1][%2][%3] %4").arg(QDateTime::currentDateTime().toString(dateFormat),
                                                        typeToShortString(type), category, msgQString);
 
+    std::lock_guard<std::mutex> lock(logMutex);
     if (type == QtDebugMsg || type == QtInfoMsg)
       std::cout << qUtf8Printable(logMsg) << std::endl;
     else
@@ -131,6 +136,7 @@ namespace {
 namespace logging {
   void registerTextEdit(QPlainTextEdit* textEdit)
   {
+    std::lock_guard<std::mutex> lock(logMutex);
     logPlainTextEdit = textEdit;
     if (!logPlainTextEdit) return;
 
@@ -2,6 +2,8 @@
 #include "projecteurapp.h"
 #include "projecteur-GitVersion.h"
 
+#include "deviceinput.h"
+#include "inputrecording.h"
 #include "logging.h"
 #include "runguard.h"
 #include "settings.h"
@@ -14,6 +16,7 @@
 
 #include <iostream>
 #include <iomanip>
+#include <memory>
 
 #define XSTRINGIFY(s) STRINGIFY(s)
 #define STRINGIFY(x) #x
@@ -46,7 +49,7 @@ int main(int argc, char *argv[])
   QCoreApplication::setApplicationName("Projecteur");
   QCoreApplication::setApplicationVersion(projecteur::version_string());
   ProjecteurApplication::Options options;
-  QStringList ipcCommands;
+  ProjecteurCommandClientApp::Options clientOptions;
   {
     QCommandLineParser parser;
     parser.setApplicationDescription(Main::tr("Linux/X11 application for the Logitech Spotlight device."));
@@ -56,21 +59,34 @@ int main(int argc, char *argv[])
     const QCommandLineOption fullHelpOption(QStringList{ "help-all"}, Main::tr("Show complete command line usage with all properties."));
     const QCommandLineOption cfgFileOption(QStringList{ "cfg" }, Main::tr("Set custom config file."), "file");
     const QCommandLineOption commandOption(QStringList{ "c", "command"}, Main::tr("Send command/property to a running instance."), "cmd");
+    const QCommandLineOption commandStreamOption(QStringList{ "command-stream" },
+                               Main::tr("Send commands read from standard input (one per line) to a running instance."));
+    const QCommandLineOption subscribeOption(QStringList{ "subscribe" },
+                               Main::tr("Print events of a running instance (spot,devices,actions,presets,cursor[:MSECS],all)."), "topics");
     const QCommandLineOption deviceInfoOption(QStringList{ "d", "device-scan"}, Main::tr("Print device-scan results."));
     const QCommandLineOption logLvlOption(QStringList{ "l", "log-level" }, Main::tr("Set log level (dbg,inf,wrn,err)."), "lvl");
     const QCommandLineOption disableUInputOption(QStringList{ "disable-uinput" }, Main::tr("Disable uinput support."));
+    const QCommandLineOption splitUInputOption(QStringList{ "split-uinput" }, Main::tr("Use separate uinput devices for pointer and keyboard events."));
+    const QCommandLineOption asyncUInputOption(QStringList{ "async-uinput" }, Main::tr("Write to uinput devices from a separate thread."));
     const QCommandLineOption showDlgOnStartOption(QStringList{ "show-dialog" }, Main::tr("Show preferences dialog on start."));
     const QCommandLineOption dialogMinOnlyOption(QStringList{ "m", "minimize-only" }, Main::tr("Only allow minimizing the dialog."));
     const QCommandLineOption disableOverlayOption(QStringList{ "disable-overlay" }, Main::tr("Disable spotlight overlay completely."));
+    const QCommandLineOption recordOption(QStringList{ "record" }, Main::tr("Record device input events to a file."), "file");
+    const QCommandLineOption replayOption(QStringList{ "replay" }, Main::tr("Replay a recording through the input mapping and exit."), "file");
+    const QCommandLineOption replayDeviceOption(QStringList{ "replay-device" },
+                               Main::tr("Device (vendorId:productId) whose input mapping is used for replay."), "device");
+    const QCommandLineOption replayOutputOption(QStringList{ "replay-output" }, Main::tr("Write the replay output events to a file."), "file");
     const QCommandLineOption additionalDeviceOption(QStringList{ "D", "additional-device"},
                                Main::tr("Additional accepted device; DEVICE = vendorId:productId\n"
                                         "                         "
                                         "e.g., -D 04b3:310c; e.g. -D 0x0c45:0x8101"), "device");
 
-    parser.addOptions({versionOption, helpOption, fullHelpOption, commandOption,
+    parser.addOptions({versionOption, helpOption, fullHelpOption, commandOption, commandStreamOption, subscribeOption,
                        cfgFileOption, fullVersionOption, deviceInfoOption, logLvlOption,
-                       disableUInputOption, showDlgOnStartOption, dialogMinOnlyOption,
-                       disableOverlayOption, additionalDeviceOption});
+                       disableUInputOption, splitUInputOption, asyncUInputOption,
+                       showDlgOnStartOption, dialogMinOnlyOption,
+                       disableOverlayOption, additionalDeviceOption,
+                       recordOption, replayOption, replayDeviceOption, replayOutputOption});
 
     const QStringList args = [argc, &argv]()
     {
@@ -105,15 +121,24 @@ int main(int argc, char *argv[])
       print() << "  -D DEVICE              " << additionalDeviceOption.description();
       if (parser.isSet(fullHelpOption)) {
         print() << "  --disable-uinput       " << disableUInputOption.description();
+        print() << "  --split-uinput         " << splitUInputOption.description();
+        print() << "  --async-uinput         " << asyncUInputOption.description();
         print() << "  --show-dialog          " << showDlgOnStartOption.description();
         print() << "  -m, --minimize-only    " << dialogMinOnlyOption.description();
+        print() << "  --record FILE          " << recordOption.description();
+        print() << "  --replay FILE          " << replayOption.description();
+        print() << "  --replay-device DEVICE " << replayDeviceOption.description();
+        print() << "  --replay-output FILE   " << replayOutputOption.description();
       }
-      print() << "  -c COMMAND|PROPERTY    " << commandOption.description() << std::endl;
+      print() << "  -c COMMAND|PROPERTY    " << commandOption.description();
+      print() << "  --command-stream       " << commandStreamOption.description();
+      print() << "  --subscribe TOPICS     " << subscribeOption.description() << std::endl;
       print() << "<Commands>";
       print() << "  spot=[on|off|toggle]   " << Main::tr("Turn spotlight on/off or toggle.");
       print() << "  settings=[show|hide]   " << Main::tr("Show/hide preferences dialog.");
       if (parser.isSet(fullHelpOption)) {
         print() << "  preset=NAME            " << Main::tr("Set a preset.");
+        print() << "  stats[=reset]          " << Main::tr("Print or reset input latency and settings statistics.");
       }
       print() << "  quit                   " << Main::tr("Quit the running instance.");
 
@@ -273,25 +298,85 @@ int main(int argc, char *argv[])
       }
       return 0;
     }
-    else if (parser.isSet(commandOption))
+
+    // The config file is also used for the input mapping of replays.
+    if (parser.isSet(cfgFileOption)) {
+      options.configFile = parser.value(cfgFileOption);
+    }
+
+    if (parser.isSet(replayOption))
+    {
+      InputRecording::File recording;
+      if (!recording.open(parser.value(replayOption))) {
+        error() << recording.errorString();
+        return 45;
+      }
+
+      // The input mapping of the given device is taken from the (custom) config file.
+      DeviceId deviceId;
+      if (parser.isSet(replayDeviceOption)) {
+        const auto devAttribs = parser.value(replayDeviceOption).split(":");
+        deviceId.vendorId = devAttribs[0].toUShort(nullptr, 16);
+        deviceId.productId = (devAttribs.size() >= 2) ? devAttribs[1].toUShort(nullptr, 16) : 0;
+        if (deviceId.vendorId == 0 || deviceId.productId == 0) {
+          error() << Main::tr("Invalid vendor/productId pair: ") << parser.value(replayDeviceOption);
+          return 45;
+        }
+      }
+
+      InputMapConfig config;
+      int keyEventInterval = -1;
+      if (deviceId.vendorId)
+      {
+        const std::unique_ptr<Settings> settings(options.configFile.isEmpty() ? new Settings()
+                                                                             : new Settings(options.configFile));
+        config = settings->getDeviceInputMapConfig(deviceId);
+        keyEventInterval = settings->deviceInputSeqInterval(deviceId);
+      }
+
+      const auto result = InputRecording::replay(recording, config, keyEventInterval);
+      if (!result.ok) {
+        error() << result.errorString;
+        return 45;
+      }
+
+      print() << Main::tr("Replayed %1 events in %2 frames (%3 mouse move frames).")
+                 .arg(recording.size()).arg(result.frames).arg(result.mouseMoveFrames);
+      print() << Main::tr("Emitted %1 events in %2 ms (%3 frames/s).")
+                 .arg(result.emitted.size()).arg(result.durationNsecs / 1e6, 0, 'f', 3)
+                 .arg(result.framesPerSecond(), 0, 'f', 0);
+
+      if (parser.isSet(replayOutputOption)
+          && !InputRecording::write(parser.value(replayOutputOption), result.emitted)) {
+        return 45;
+      }
+      return 0;
+    }
+    else if (parser.isSet(commandOption) || parser.isSet(commandStreamOption) || parser.isSet(subscribeOption))
     {
+      clientOptions.commandStream = parser.isSet(commandStreamOption);
+      clientOptions.subscribeTopics = parser.value(subscribeOption).trimmed();
+      auto& ipcCommands = clientOptions.commands;
       ipcCommands = parser.values(commandOption);
       for (auto& value : ipcCommands) {
         value = value.trimmed();
       }
       ipcCommands.removeAll("");
 
-      if (ipcCommands.isEmpty()) {
+      if (parser.isSet(subscribeOption) && clientOptions.subscribeTopics.isEmpty()) {
+        error() << Main::tr("Subscription topics cannot be an empty string.");
+        return 44;
+      }
+      if (parser.isSet(commandOption) && ipcCommands.isEmpty()) {
         error() << Main::tr("Command/Properties cannot be an empty string.");
         return 44;
       }
     }
 
-    if (parser.isSet(cfgFileOption)) {
-      options.configFile = parser.value(cfgFileOption);
-    }
-
     options.enableUInput = !parser.isSet(disableUInputOption);
+    options.splitUInput = parser.isSet(splitUInputOption);
+    options.asyncUInput = parser.isSet(asyncUInputOption);
+    options.recordFile = parser.value(recordOption);
     options.showPreferencesOnStart = parser.isSet(showDlgOnStartOption);
     options.dialogMinimizeOnly = parser.isSet(dialogMinOnlyOption);
     options.disableOverlay = parser.isSet(disableOverlayOption);
@@ -306,17 +391,20 @@ int main(int argc, char *argv[])
     }
   }
 
+  const bool isClient = clientOptions.commands.size() || clientOptions.commandStream
+                        || clientOptions.subscribeTopics.size();
   RunGuard guard(QCoreApplication::applicationName());
   if (!guard.tryToRun())
   {
-    if (ipcCommands.size()) {
-      return ProjecteurCommandClientApp(ipcCommands, argc, argv).exec();
+    if (isClient) {
+      return ProjecteurCommandClientApp(clientOptions, argc, argv).exec();
     }
     error() << Main::tr("Another application instance is already running. Exiting.");
     return 42;
   }
-  else if (ipcCommands.size())
+  else if (isClient)
   {
+    const auto& ipcCommands = clientOptions.commands;
     // No other application instance running - but command option was used.
     logInfo(appMain) << Main::tr("Cannot send commands '%1' - no running application instance found.").arg(ipcCommands.join("; "));
     logWarning(appMain) << Main::tr("Cannot send commands '%1' - no running application instance found.").arg(ipcCommands.join("; "));
@@ -3,6 +3,8 @@
 
 #include "aboutdlg.h"
 #include "imageitem.h"
+#include "deviceinput.h"
+#include "ipceventpublisher.h"
 #include "linuxdesktop.h"
 #include "logging.h"
 #include "preferencesdlg.h"
@@ -22,10 +24,18 @@
 #include <QQmlProperty>
 #include <QQuickWindow>
 #include <QScreen>
+#include <QSocketNotifier>
 #include <QSystemTrayIcon>
 #include <QTimer>
 #include <QWindow>
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <iostream>
+
+#include <unistd.h>
+
 LOGGING_CATEGORY(mainapp, "mainapp")
 LOGGING_CATEGORY(cmdclient, "cmdclient")
 LOGGING_CATEGORY(cmdserver, "cmdserver")
@@ -34,6 +44,52 @@ namespace {
   QString localServerName() {
     return QCoreApplication::applicationName() + "_local_socket";
   }
+
+  // Key and value of a 'key=value' command, as trimmed views into the received command data.
+  struct CommandView
+  {
+    QLatin1String key;
+    QLatin1String value;
+  };
+
+  QLatin1String trimmed(const char* begin, const char* end)
+  {
+    while (begin < end && std::isspace(static_cast<unsigned char>(*begin))) ++begin;
+    while (end > begin && std::isspace(static_cast<unsigned char>(*(end - 1)))) --end;
+    return QLatin1String(begin, static_cast<int>(end - begin));
+  }
+
+  CommandView parseCommand(const QByteArray& command)
+  {
+    const char* begin = command.constData();
+    const char* end = begin + command.size();
+    const char* separator = std::find(begin, end, '=');
+    return CommandView{ trimmed(begin, separator), trimmed(std::min(separator + 1, end), end) };
+  }
+
+  // Text representation of events for subscribers on the command line.
+  QString eventToString(const IpcProtocol::Event& event)
+  {
+    using IpcProtocol::EventType;
+    QString text = QString("%1 %2").arg(event.timestamp).arg(IpcProtocol::eventName(event.type));
+    if (event.type == EventType::DeviceConnected || event.type == EventType::DeviceDisconnected
+        || event.type == EventType::ActionMapped)
+    {
+      text += QString(" %1:%2").arg(event.vendorId, 4, 16, QChar('0'))
+                               .arg(event.productId, 4, 16, QChar('0'));
+    }
+
+    switch (event.type)
+    {
+    case EventType::SpotActiveChanged: return text + QString(" active=%1").arg(event.value);
+    case EventType::ActionMapped: return text + QString(" action=%1").arg(event.value);
+    case EventType::CursorPosition: return text + QString(" %1,%2").arg(event.x).arg(event.y);
+    case EventType::DeviceConnected:
+    case EventType::DeviceDisconnected:
+    case EventType::PresetLoaded: return text + QString(" '%1'").arg(event.text);
+    }
+    return text;
+  }
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -42,6 +98,7 @@ ProjecteurApplication::ProjecteurApplication(int &argc, char **argv, const Optio
   , m_trayIcon(new QSystemTrayIcon())
   , m_trayMenu(new QMenu())
   , m_localServer(new QLocalServer(this))
+  , m_eventPublisher(new IpcEventPublisher(this))
   , m_linuxDesktop(new LinuxDesktop(this))
   , m_xcbOnWayland(QGuiApplication::platformName() == "xcb" && m_linuxDesktop->isWayland())
 {
@@ -60,8 +117,9 @@ ProjecteurApplication::ProjecteurApplication(int &argc, char **argv, const Optio
 
   m_settings = options.configFile.isEmpty() ? new Settings(this)
                                             : new Settings(options.configFile, this);
-  m_spotlight = new Spotlight(this, Spotlight::Options{options.enableUInput, options.additionalDevices},
-                              m_settings);
+  m_spotlight = new Spotlight(this, Spotlight::Options{options.enableUInput, options.splitUInput,
+                                                      options.asyncUInput, options.recordFile,
+                                                      options.additionalDevices}, m_settings);
 
   m_settings->setOverlayDisabled(options.disableOverlay);
   m_dialog.reset(new PreferencesDialog(m_settings, m_spotlight,
@@ -265,6 +323,51 @@ ProjecteurApplication::ProjecteurApplication(int &argc, char **argv, const Optio
     }
   });
 
+  // Events for subscribed IPC clients
+  connect(m_spotlight, &Spotlight::spotActiveChanged, m_eventPublisher, [this](bool active) {
+    IpcProtocol::Event event;
+    event.type = IpcProtocol::EventType::SpotActiveChanged;
+    event.value = active;
+    m_eventPublisher->publish(std::move(event));
+  });
+
+  const auto publishDeviceEvent = [this](IpcProtocol::EventType type, const DeviceId& id, const QString& name) {
+    IpcProtocol::Event event;
+    event.type = type;
+    event.vendorId = id.vendorId;
+    event.productId = id.productId;
+    event.text = name;
+    m_eventPublisher->publish(std::move(event));
+  };
+  connect(m_spotlight, &Spotlight::deviceConnected, m_eventPublisher,
+  [publishDeviceEvent](const DeviceId& id, const QString& name) {
+    publishDeviceEvent(IpcProtocol::EventType::DeviceConnected, id, name);
+  });
+  connect(m_spotlight, &Spotlight::deviceDisconnected, m_eventPublisher,
+  [publishDeviceEvent](const DeviceId& id, const QString& name) {
+    publishDeviceEvent(IpcProtocol::EventType::DeviceDisconnected, id, name);
+  });
+
+  connect(m_spotlight, &Spotlight::actionMapped, m_eventPublisher,
+  [this](const DeviceId& id, std::shared_ptr<Action> action) {
+    IpcProtocol::Event event;
+    event.type = IpcProtocol::EventType::ActionMapped;
+    event.vendorId = id.vendorId;
+    event.productId = id.productId;
+    event.value = static_cast<qint32>(action->type());
+    m_eventPublisher->publish(std::move(event));
+  });
+
+  connect(m_settings, &Settings::presetLoaded, m_eventPublisher, [this](const QString& preset) {
+    IpcProtocol::Event event;
+    event.type = IpcProtocol::EventType::PresetLoaded;
+    event.text = preset;
+    m_eventPublisher->publish(std::move(event));
+  });
+
+  connect(this, &ProjecteurApplication::currentCursorPosChanged,
+          m_eventPublisher, &IpcEventPublisher::publishCursorPosition);
+
   // Open local server for local IPC commands, e.g. from other command line instances
   QLocalServer::removeServer(localServerName());
   if (m_localServer->listen(localServerName()))
@@ -277,29 +380,27 @@ ProjecteurApplication::ProjecteurApplication(int &argc, char **argv, const Optio
           this->readCommand(clientConnection);
         });
         connect(clientConnection, &QLocalSocket::disconnected, this, [this, clientConnection]() {
-          const auto it = m_commandConnections.find(clientConnection);
-          if (it != m_commandConnections.end())
-          {
-            quint32& commandSize = it->second;
-            while (clientConnection->bytesAvailable() && commandSize <= clientConnection->bytesAvailable()) {
-              this->readCommand(clientConnection);
-            }
-            m_commandConnections.erase(it);
-          }
+          // Version 1 clients disconnect right after sending, process everything still buffered.
+          this->readCommand(clientConnection);
+          m_commandConnections.erase(clientConnection);
+          m_eventPublisher->unsubscribe(clientConnection);
           clientConnection->close();
           clientConnection->deleteLater();
         });
 
-        // Timeout timer - if after 5 seconds the connection is still open just disconnect...
+        // Timeout timer - if after 5 seconds the connection is still open just disconnect,
+        // unless the client uses the persistent version 2 protocol.
         const auto clientConnPtr = QPointer<QLocalSocket>(clientConnection);
-        QTimer::singleShot(5000, clientConnection, [clientConnPtr](){
-          if (clientConnPtr) {
+        QTimer::singleShot(5000, clientConnection, [this, clientConnPtr](){
+          if (!clientConnPtr) return;
+          const auto it = m_commandConnections.find(clientConnPtr.data());
+          if (it == m_commandConnections.end() || !it->second.persistent) {
             // time out
             clientConnPtr->disconnectFromServer();
           }
         });
 
-        m_commandConnections.emplace(clientConnection, 0);
+        m_commandConnections.emplace(clientConnection, CommandConnection());
       }
     });
   }
@@ -526,31 +627,87 @@ void ProjecteurApplication::readCommand(QLocalSocket* clientConnection)
     return;
   }
 
-  quint32& commandSize = it->second;
+  auto& connection = it->second;
 
-  // Read size of command (always quint32) if not already done.
-  if (commandSize == 0) {
-    if (clientConnection->bytesAvailable() < static_cast<int>(sizeof(quint32)))
+  // Process all complete frames, clients may pipeline several frames without waiting for replies.
+  QByteArray payload;
+  auto type = IpcProtocol::FrameReader::FrameType::Command;
+  for (;;)
+  {
+    const auto result = connection.reader.read(clientConnection, payload, type);
+    if (result == IpcProtocol::FrameReader::Result::Incomplete) {
+      break;
+    }
+    if (result == IpcProtocol::FrameReader::Result::Invalid
+        || type == IpcProtocol::FrameReader::FrameType::Event)
+    {
+      logWarning(cmdserver) << tr("Received invalid command frame.");
+      clientConnection->disconnectFromServer();
       return;
+    }
 
-    QDataStream in(clientConnection);
-    in >> commandSize;
+    if (type == IpcProtocol::FrameReader::FrameType::Command)
+    {
+      QByteArray reply;
+      executeCommand(payload, reply);
+      if (reply.size()) clientConnection->write(IpcProtocol::commandFrame(reply));
+      continue;
+    }
 
-    if (commandSize > 256)
+    IpcProtocol::Batch batch;
+    if (!IpcProtocol::parseBatch(payload, batch))
     {
-      logWarning(cmdserver) << tr("Received invalid command size (%1)").arg(commandSize);
+      logWarning(cmdserver) << tr("Received invalid command batch.");
       clientConnection->disconnectFromServer();
-      return ;
+      return;
     }
+
+    // Any batch, also the empty handshake batch of a client, makes the connection persistent.
+    connection.persistent = true;
+    if (batch.commands.empty()) continue;
+
+    std::vector<IpcProtocol::Ack> acks(batch.commands.size());
+    for (size_t i = 0; i < batch.commands.size(); ++i)
+    {
+      const auto& command = batch.commands[i];
+      acks[i].sequence = batch.firstSequence + static_cast<quint32>(i);
+      if (command.size() > static_cast<int>(IpcProtocol::MaxCommandSize)) {
+        acks[i].status = IpcProtocol::Status::InvalidCommand;
+      }
+      else if (parseCommand(command).key == QLatin1String("subscribe"))
+      {
+        // Subscriptions need a persistent connection, they are only possible with batches.
+        const QString topics = parseCommand(command).value;
+        acks[i].status = m_eventPublisher->subscribe(clientConnection, topics)
+                         ? IpcProtocol::Status::Ok : IpcProtocol::Status::InvalidCommand;
+      }
+      else {
+        acks[i].status = executeCommand(command, acks[i].reply);
+      }
+    }
+    clientConnection->write(IpcProtocol::ackFrame(acks));
   }
+  clientConnection->flush();
+}
 
-  if (clientConnection->bytesAvailable() < commandSize || clientConnection->atEnd()) {
-    return;
+// -------------------------------------------------------------------------------------------------
+IpcProtocol::Status ProjecteurApplication::executeCommand(const QByteArray& command, QByteArray& reply)
+{
+  // Property commands (e.g. for scripted animations) are looked up without any string copies.
+  const auto cmd = parseCommand(command);
+  if (cmd.value.size())
+  {
+    if (const auto property = m_settings->stringProperty(cmd.key))
+    {
+      const auto value = QString::fromLocal8Bit(cmd.value.data(), cmd.value.size());
+      logDebug(cmdserver) << tr("Received command '%1'='%2'").arg(cmd.key).arg(value);
+      property->setFunction(value);
+      return IpcProtocol::Status::Ok;
+    }
   }
 
-  const auto command = QString::fromLocal8Bit(clientConnection->read(commandSize));
-  const QString cmdKey = command.section('=', 0, 0).trimmed();
-  const QString cmdValue = command.section('=', 1).trimmed();
+  const auto cmdKey = QString::fromLocal8Bit(cmd.key.data(), cmd.key.size());
+  const auto cmdValue = QString::fromLocal8Bit(cmd.value.data(), cmd.value.size());
 
   if (cmdKey == "quit")
   {
@@ -579,24 +736,29 @@ void ProjecteurApplication::readCommand(QLocalSocket* clientConnection)
     logDebug(cmdserver) << tr("Received command preset = %1").arg(cmdValue);
     if (!cmdValue.isEmpty()) m_settings->loadPreset(cmdValue);
   }
-  else if (cmdValue.size())
+  else if (cmdKey == "stats")
   {
-    const auto& properties = m_settings->stringProperties();
-    const auto it = std::find_if(properties.cbegin(), properties.cend(),
-    [&cmdKey](const auto& pair){
-      return (pair.first == cmdKey);
-    });
-    if (it != m_settings->stringProperties().cend()) {
-      logDebug(cmdserver) << tr("Received command '%1'='%2'").arg(cmdKey, cmdValue);
-      it->second.setFunction(cmdValue);
+    logDebug(cmdserver) << tr("Received command stats = %1").arg(cmdValue);
+    if (cmdValue.toLower() == "reset") {
+      m_spotlight->resetLatencyStatistics();
     }
     else {
-      // string property not found...
-      logWarning(cmdserver) << tr("Received unknown command key (%1)").arg(cmdKey);
+      const auto statistics = m_spotlight->latencyStatistics() + '\n' + m_settings->persistenceStatistics();
+      reply = statistics.toLocal8Bit();
     }
   }
-  // reset command size, for next command
-  commandSize = 0;
+  else if (cmdValue.size())
+  {
+    // string property not found...
+    logWarning(cmdserver) << tr("Received unknown command key (%1)").arg(cmdKey);
+    return IpcProtocol::Status::UnknownCommand;
+  }
+  else
+  {
+    logWarning(cmdserver) << tr("Received invalid command (%1)").arg(cmdKey);
+    return IpcProtocol::Status::InvalidCommand;
+  }
+  return IpcProtocol::Status::Ok;
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -618,58 +780,211 @@ void ProjecteurApplication::showPreferences(bool show)
 }
 
 // =================================================================================================
-ProjecteurCommandClientApp::ProjecteurCommandClientApp(const QStringList& ipcCommands, int &argc, char **argv)
+ProjecteurCommandClientApp::ProjecteurCommandClientApp(const Options& options, int &argc, char **argv)
   : QCoreApplication(argc, argv)
+  , m_localSocket(new QLocalSocket(this))
+  , m_queuedCommands(options.commands)
+  , m_streaming(options.commandStream)
+  , m_subscribed(!options.subscribeTopics.isEmpty())
+  , m_inputDone(!options.commandStream)
 {
-  if (ipcCommands.isEmpty())
+  if (options.commands.isEmpty() && !options.commandStream && !m_subscribed)
   {
     QMetaObject::invokeMethod(this, "quit", Qt::QueuedConnection);
     return;
   }
 
-  QLocalSocket* const localSocket = new QLocalSocket(this);
-
   #if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
-    connect(localSocket, &QLocalSocket::errorOccurred,
+    connect(m_localSocket, &QLocalSocket::errorOccurred,
   #else
-    connect(localSocket,
+    connect(m_localSocket,
           static_cast<void (QLocalSocket::*)(QLocalSocket::LocalSocketError)>(&QLocalSocket::error),
   #endif
   this,
-  [this, localSocket](QLocalSocket::LocalSocketError /*socketError*/) {
-    logError(cmdclient) << tr("Error sending commands: %1", "%1=error message").arg(localSocket->errorString());
-    localSocket->close();
+  [this](QLocalSocket::LocalSocketError /*socketError*/) {
+    logError(cmdclient) << tr("Error sending commands: %1", "%1=error message").arg(m_localSocket->errorString());
+    m_localSocket->close();
     QMetaObject::invokeMethod(this, "quit", Qt::QueuedConnection);
   });
 
-  connect(localSocket, &QLocalSocket::connected, [localSocket, &ipcCommands]()
+  // The subscription is sent first, so that events caused by the other commands are received.
+  if (m_subscribed)
   {
-    for (const auto& ipcCommand : ipcCommands)
-    {
-      if (ipcCommand.isEmpty()) continue;
+    m_subscribeSequence = m_nextSequence;
+    m_queuedCommands.prepend(QString("subscribe=%1").arg(options.subscribeTopics));
+  }
 
-      const QByteArray commandBlock = [&ipcCommand]()
-      {
-        const QByteArray ipcBytes = ipcCommand.toLocal8Bit();
-        QByteArray block;
-        {
-          QDataStream out(&block, QIODevice::WriteOnly);
-          out << static_cast<quint32>(ipcBytes.size());
-        }
-        block.append(ipcBytes);
-        return block;
-      }();
+  connect(m_localSocket, &QLocalSocket::connected, this, [this]()
+  {
+    m_connected = true;
+    sendBatch(m_queuedCommands);
+    m_queuedCommands.clear();
+    disconnectIfDone();
+  });
+
+  connect(m_localSocket, &QLocalSocket::readyRead, this, &ProjecteurCommandClientApp::readFrames);
 
-      localSocket->write(commandBlock);
-      localSocket->flush();
+  connect(m_localSocket, &QLocalSocket::disconnected, this, [this]() {
+    m_localSocket->close();
+    if (!m_pendingCommands.empty()) {
+      logError(cmdclient) << tr("Connection closed before all commands were acknowledged.");
     }
-    localSocket->disconnectFromServer();
+    const int exitCode = (m_failedCommands || !m_pendingCommands.empty()) ? 1 : 0;
+    QTimer::singleShot(0, this, [exitCode](){ QCoreApplication::exit(exitCode); });
   });
 
-  connect(localSocket, &QLocalSocket::disconnected, this, [this, localSocket]() {
-    localSocket->close();
-    QMetaObject::invokeMethod(this, "quit", Qt::QueuedConnection);
-  });
+  if (options.commandStream)
+  {
+    const auto notifier = new QSocketNotifier(STDIN_FILENO, QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, &ProjecteurCommandClientApp::readStdin);
+  }
+
+  m_localSocket->connectToServer(localServerName());
+}
+
+// -------------------------------------------------------------------------------------------------
+void ProjecteurCommandClientApp::sendBatch(const QStringList& commands)
+{
+  IpcProtocol::Batch batch;
+  quint32 batchSize = 0;
+  bool frameSent = false;
+  const auto send = [this, &batch, &batchSize, &frameSent]()
+  {
+    // Without commands, an empty batch is sent as handshake, it makes the connection persistent.
+    if (batch.commands.empty() && frameSent) return;
+    m_localSocket->write(IpcProtocol::batchFrame(batch));
+    frameSent = true;
+    batch.firstSequence = m_nextSequence;
+    batch.commands.clear();
+    batchSize = 0;
+  };
+
+  batch.firstSequence = m_nextSequence;
+  for (const auto& command : commands)
+  {
+    if (command.isEmpty()) continue;
+
+    auto data = command.toLocal8Bit();
+    // Split into multiple frames if necessary, leaving some space for the batch header.
+    if (batchSize + data.size() + sizeof(quint32) > IpcProtocol::MaxFrameSize - 64) send();
+
+    batchSize += data.size() + sizeof(quint32);
+    m_pendingCommands.emplace(m_nextSequence++, command);
+    batch.commands.emplace_back(std::move(data));
+  }
+  send();
+  m_localSocket->flush();
+}
 
-  localSocket->connectToServer(localServerName());
+// -------------------------------------------------------------------------------------------------
+void ProjecteurCommandClientApp::readStdin()
+{
+  char buffer[4096];
+  const auto bytesRead = ::read(STDIN_FILENO, buffer, sizeof(buffer));
+  if (bytesRead > 0) {
+    m_stdinBuffer.append(buffer, static_cast<int>(bytesRead));
+  }
+  else if (bytesRead < 0 && errno == EINTR) {
+    return;
+  }
+  else
+  {
+    // End of input, a last line without line break is also a command.
+    if (const auto notifier = qobject_cast<QSocketNotifier*>(sender())) notifier->setEnabled(false);
+    m_inputDone = true;
+    m_stdinBuffer.append('\n');
+  }
+
+  // All complete lines read with one notification are sent in one batch.
+  QStringList commands;
+  int lineStart = 0;
+  for (int lineEnd; (lineEnd = m_stdinBuffer.indexOf('\n', lineStart)) >= 0; lineStart = lineEnd + 1)
+  {
+    const auto line = QString::fromLocal8Bit(m_stdinBuffer.constData() + lineStart, lineEnd - lineStart).trimmed();
+    if (!line.isEmpty() && !line.startsWith('#')) commands.push_back(line);
+  }
+  m_stdinBuffer.remove(0, lineStart);
+
+  if (m_connected) {
+    if (!commands.isEmpty()) sendBatch(commands);
+    disconnectIfDone();
+  }
+  else {
+    m_queuedCommands.append(commands);
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+void ProjecteurCommandClientApp::readFrames()
+{
+  QByteArray payload;
+  auto type = IpcProtocol::FrameReader::FrameType::Command;
+  for (;;)
+  {
+    const auto result = m_reader.read(m_localSocket, payload, type);
+    if (result == IpcProtocol::FrameReader::Result::Incomplete) {
+      break;
+    }
+
+    std::vector<IpcProtocol::Ack> acks;
+    std::vector<IpcProtocol::Event> events;
+    quint32 dropped = 0;
+    if (result == IpcProtocol::FrameReader::Result::Frame
+        && type == IpcProtocol::FrameReader::FrameType::Batch
+        && IpcProtocol::parseAcks(payload, acks))
+    {
+      handleAcks(acks);
+    }
+    else if (result == IpcProtocol::FrameReader::Result::Frame
+             && type == IpcProtocol::FrameReader::FrameType::Event
+             && IpcProtocol::parseEvents(payload, dropped, events))
+    {
+      if (dropped) std::cout << "dropped " << dropped << std::endl;
+      for (const auto& event : events) {
+        std::cout << eventToString(event).toStdString() << std::endl;
+      }
+    }
+    else
+    {
+      logError(cmdclient) << tr("Received invalid reply from the running instance.");
+      m_localSocket->disconnectFromServer();
+      return;
+    }
+  }
+
+  disconnectIfDone();
+}
+
+// -------------------------------------------------------------------------------------------------
+void ProjecteurCommandClientApp::handleAcks(const std::vector<IpcProtocol::Ack>& acks)
+{
+  for (const auto& ack : acks)
+  {
+    const auto it = m_pendingCommands.find(ack.sequence);
+    if (it == m_pendingCommands.end()) continue;
+
+    if (ack.status != IpcProtocol::Status::Ok)
+    {
+      ++m_failedCommands;
+      logWarning(cmdclient) << tr("Command '%1' failed: %2").arg(it->second)
+                               .arg(IpcProtocol::statusName(ack.status));
+      if (ack.sequence == m_subscribeSequence) m_subscribed = false;
+    }
+    if (m_streaming) {
+      std::cout << ack.sequence << ' ' << IpcProtocol::statusName(ack.status) << std::endl;
+    }
+    if (ack.reply.size()) {
+      std::cout << QString::fromLocal8Bit(ack.reply).toStdString() << std::endl;
+    }
+    m_pendingCommands.erase(it);
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+void ProjecteurCommandClientApp::disconnectIfDone()
+{
+  // Wait for all acknowledgements before disconnecting, subscribers stay connected.
+  if (m_connected && m_inputDone && m_pendingCommands.empty() && !m_subscribed) {
+    m_localSocket->disconnectFromServer();
+  }
 }
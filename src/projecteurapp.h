@@ -1,5 +1,6 @@
 // This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
 #pragma once
+#include "ipcprotocol.h"
 #include "spotlight.h"
 
 #include <QApplication>
@@ -8,6 +9,7 @@
 #include <memory>
 
 class AboutDialog;
+class IpcEventPublisher;
 class LinuxDesktop;
 class PreferencesDialog;
 class QLocalServer;
@@ -30,6 +32,9 @@ public:
   struct Options {
     QString configFile;
     bool enableUInput = true; // enable virtual uinput device
+    bool splitUInput = false; // separate virtual pointer and keyboard devices
+    bool asyncUInput = false; // write to the virtual devices from a separate thread
+    QString recordFile; // record device input events to this file, if not empty
     bool showPreferencesOnStart = false;
     bool dialogMinimizeOnly = false;
     bool disableOverlay = false;
@@ -56,6 +61,7 @@ private slots:
   void readCommand(QLocalSocket* client);
 
 private:
+  IpcProtocol::Status executeCommand(const QByteArray& command, QByteArray& reply);
   void showPreferences(bool show = true);
   void setScreenForCursorPos();
   QScreen* screenAtCursorPos() const;
@@ -73,12 +79,17 @@ private:
   std::unique_ptr<PreferencesDialog> m_dialog;
   std::unique_ptr<AboutDialog> m_aboutDialog;
   QLocalServer* const m_localServer = nullptr;
+  IpcEventPublisher* const m_eventPublisher = nullptr;
   Spotlight* m_spotlight = nullptr;
   Settings* m_settings = nullptr;
   LinuxDesktop* m_linuxDesktop = nullptr;
   QQmlApplicationEngine* m_qmlEngine = nullptr;
   QQmlComponent* m_windowQmlComponent = nullptr;
-  std::map<QLocalSocket*, quint32> m_commandConnections;
+  struct CommandConnection {
+    IpcProtocol::FrameReader reader;
+    bool persistent = false; // version 2 clients are not disconnected after a timeout
+  };
+  std::map<QLocalSocket*, CommandConnection> m_commandConnections;
   bool m_overlayVisible = false;
   const bool m_xcbOnWayland = false;
 
@@ -93,5 +104,33 @@ class ProjecteurCommandClientApp : public QCoreApplication
   Q_OBJECT
 
 public:
-  explicit ProjecteurCommandClientApp(const QStringList& ipcCommands, int &argc, char **argv);
+  struct Options {
+    QStringList commands; // sent in a single batch
+    // Keep the connection open and send commands read from standard input (one per line)
+    // as further batches until the end of input.
+    bool commandStream = false;
+    QString subscribeTopics; // stay connected and print events of these topics, if not empty
+  };
+
+  explicit ProjecteurCommandClientApp(const Options& options, int &argc, char **argv);
+
+private:
+  void sendBatch(const QStringList& commands);
+  void readStdin();
+  void readFrames();
+  void handleAcks(const std::vector<IpcProtocol::Ack>& acks);
+  void disconnectIfDone();
+
+  QLocalSocket* const m_localSocket = nullptr;
+  IpcProtocol::FrameReader m_reader;
+  QStringList m_queuedCommands; // commands read before the connection was established
+  QByteArray m_stdinBuffer;
+  std::map<quint32, QString> m_pendingCommands; // sent commands by sequence number
+  quint32 m_nextSequence = 1;
+  quint32 m_subscribeSequence = 0; // sequence number of the subscribe command, if any
+  bool m_streaming = false;
+  bool m_subscribed = false;
+  bool m_connected = false;
+  bool m_inputDone = true;
+  int m_failedCommands = 0;
 };
@@ -0,0 +1,113 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "reactor.h"
+
+#include "logging.h"
+
+#include <QSocketNotifier>
+
+#include <unistd.h>
+
+DECLARE_LOGGING_CATEGORY(device)
+
+// -------------------------------------------------------------------------------------------------
+Reactor::Reactor()
+  : m_epollFd(epoll_create1(EPOLL_CLOEXEC)) {}
+
+// -------------------------------------------------------------------------------------------------
+Reactor::~Reactor()
+{
+  if (m_epollFd >= 0) ::close(m_epollFd);
+}
+
+// -------------------------------------------------------------------------------------------------
+bool Reactor::add(int fd, Handler handler, uint32_t events)
+{
+  if (m_epollFd < 0 || fd < 0 || !handler) return false;
+
+  struct epoll_event ev{};
+  ev.events = events | EPOLLET;
+  ev.data.fd = fd;
+  if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) return false;
+
+  m_handlers[fd] = std::make_shared<Handler>(std::move(handler));
+  return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+bool Reactor::remove(int fd)
+{
+  const auto it = m_handlers.find(fd);
+  if (it == m_handlers.end()) return false;
+
+  // The descriptor might already be closed, ignore the result.
+  epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+  m_handlers.erase(it);
+  return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+int Reactor::wait(int timeoutMsecs)
+{
+  m_numReady = 0;
+  const int numReady = epoll_wait(m_epollFd, m_ready.data(), static_cast<int>(m_ready.size()), timeoutMsecs);
+  if (numReady > 0) m_numReady = numReady;
+  return numReady;
+}
+
+// -------------------------------------------------------------------------------------------------
+void Reactor::dispatchReady()
+{
+  const int numReady = m_numReady;
+  m_numReady = 0;
+
+  for (int i = 0; i < numReady; ++i)
+  {
+    const auto it = m_handlers.find(m_ready[i].data.fd);
+    if (it == m_handlers.end()) continue; // removed in the meantime
+
+    // Keep the handler alive, it might remove its own file descriptor.
+    const auto handler = it->second;
+    (*handler)(m_ready[i].events);
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+EventLoopReactor::EventLoopReactor(QObject* parent)
+  : QObject(parent)
+{
+  if (!m_reactor.isValid()) {
+    logError(device) << tr("Cannot create epoll instance (%1).").arg(errno);
+    return;
+  }
+
+  m_notifier = new QSocketNotifier(m_reactor.fileDescriptor(), QSocketNotifier::Read, this);
+  connect(m_notifier, &QSocketNotifier::activated, this, [this](){ processEvents(); });
+}
+
+// -------------------------------------------------------------------------------------------------
+EventLoopReactor::~EventLoopReactor()
+{
+  if (m_notifier) m_notifier->setEnabled(false);
+}
+
+// -------------------------------------------------------------------------------------------------
+bool EventLoopReactor::add(int fd, Reactor::Handler handler, uint32_t events)
+{
+  return m_reactor.add(fd, std::move(handler), events);
+}
+
+// -------------------------------------------------------------------------------------------------
+bool EventLoopReactor::remove(int fd)
+{
+  return m_reactor.remove(fd);
+}
+
+// -------------------------------------------------------------------------------------------------
+void EventLoopReactor::processEvents()
+{
+  // Does not block, the notifier only fires if file descriptors are ready. If more descriptors
+  // are ready than fit into one batch, the notifier fires again.
+  if (m_reactor.wait(0) > 0) {
+    m_reactor.dispatchReady();
+  }
+}
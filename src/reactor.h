@@ -0,0 +1,73 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include <QObject>
+
+#include <array>
+#include <functional>
+#include <map>
+#include <memory>
+
+#include <sys/epoll.h>
+
+class QSocketNotifier;
+
+// -------------------------------------------------------------------------------------------------
+/// Dispatches the readiness of file descriptors to their handlers, using a single epoll instance.
+/// File descriptors are registered edge-triggered: handlers must read until EAGAIN.
+///
+/// The reactor is not thread-safe, with the exception that wait() can be called from one thread
+/// while another thread adds or removes file descriptors. Synchronization of add(), remove() and
+/// dispatchReady() is up to the owner.
+class Reactor
+{
+public:
+  using Handler = std::function<void(uint32_t events)>;
+
+  Reactor();
+  ~Reactor();
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+
+  bool isValid() const { return m_epollFd >= 0; }
+  /// The epoll file descriptor, readable if any registered file descriptor is ready.
+  int fileDescriptor() const { return m_epollFd; }
+
+  bool add(int fd, Handler handler, uint32_t events = EPOLLIN);
+  bool remove(int fd); // The handler of a removed file descriptor is not called anymore.
+  size_t size() const { return m_handlers.size(); }
+
+  /// Wait up to timeoutMsecs (-1: no timeout) for ready file descriptors, returns their number or
+  /// -1 on error (with errno set).
+  int wait(int timeoutMsecs);
+  /// Call the handlers of all file descriptors that were ready on the last wait().
+  void dispatchReady();
+
+private:
+  int m_epollFd = -1;
+  std::map<int, std::shared_ptr<Handler>> m_handlers;
+  std::array<struct epoll_event, 32> m_ready;
+  int m_numReady = 0;
+};
+
+// -------------------------------------------------------------------------------------------------
+/// Reactor dispatched from the Qt event loop of the thread it lives in. All its file descriptors
+/// share a single socket notifier and are handled in one batch.
+class EventLoopReactor : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit EventLoopReactor(QObject* parent = nullptr);
+  ~EventLoopReactor() override;
+
+  bool add(int fd, Reactor::Handler handler, uint32_t events = EPOLLIN);
+  bool remove(int fd);
+  bool isValid() const { return m_reactor.isValid(); }
+
+private:
+  void processEvents();
+
+  Reactor m_reactor;
+  QSocketNotifier* m_notifier = nullptr;
+};
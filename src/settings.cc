@@ -3,11 +3,15 @@
 
 #include "device.h"
 #include "deviceinput.h"
+#include "inputmapstore.h"
 #include "logging.h"
+#include "settingswriter.h"
 
 #include <algorithm>
+#include <memory>
 
 #include <QGuiApplication>
+#include <QFile>
 #include <QFileInfo>
 #include <QFont>
 #include <QPalette>
@@ -41,6 +45,7 @@ namespace {
     // -- device specific
     constexpr char inputSequenceInterval[] = "inputSequenceInterval";
     constexpr char inputMapConfig[] = "inputMapConfig";
+    constexpr char relEventCoalescing[] = "relEventCoalescing";
 
     namespace defaultValue {
       constexpr bool showSpotShade = true;
@@ -64,6 +69,7 @@ namespace {
 
       // -- device specific defaults
       constexpr int inputSequenceInterval = 250;
+      constexpr bool relEventCoalescing = false;
     }
 
     namespace ranges {
@@ -76,7 +82,8 @@ namespace {
       constexpr Settings::SettingRange<double> borderOpacity{ 0.0, 1.0 };
       constexpr Settings::SettingRange<double> zoomFactor{ 1.5, 20.0 };
 
-      constexpr Settings::SettingRange<int> inputSequenceInterval{ 100, 950 };
+      constexpr Settings::SettingRange<int> inputSequenceInterval{ InputMapper::MinKeyEventInterval,
+                                                                   InputMapper::MaxKeyEventInterval };
     }
   }
 
@@ -119,6 +126,7 @@ Settings::Settings(QObject* parent)
   : QObject(parent)
   , m_settings(new QSettings(QCoreApplication::applicationName(),
                              QCoreApplication::applicationName(), this))
+  , m_writer(new SettingsWriter(m_settings, this))
   , m_presetModel(new PresetModel(loadPresets(m_settings), this))
   , m_shapeSettingsRoot(new QQmlPropertyMap(this))
 {
@@ -129,6 +137,7 @@ Settings::Settings(QObject* parent)
 Settings::Settings(const QString& configFile, QObject* parent)
   : QObject(parent)
   , m_settings(new QSettings(configFile, QSettings::NativeFormat, this))
+  , m_writer(new SettingsWriter(m_settings, this))
   , m_presetModel(new PresetModel(loadPresets(m_settings), this))
   , m_shapeSettingsRoot(new QQmlPropertyMap(this))
 {
@@ -138,6 +147,7 @@ Settings::Settings(const QString& configFile, QObject* parent)
 // -------------------------------------------------------------------------------------------------
 Settings::~Settings()
 {
+  m_writer->flush();
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -242,6 +252,37 @@ void Settings::initializeStringProperties()
   map.emplace_back( "zoom.factor", StringProperty{ StringProperty::Double,
                     {::settings::ranges::zoomFactor.min, ::settings::ranges::zoomFactor.max},
                     [this](const QString& value){ setZoomFactor(value.toDouble()); } } );
+
+  // Index the properties by name, the views used as keys point into the interned names.
+  m_stringPropertyNames.clear();
+  m_stringPropertyNames.reserve(map.size());
+  for (const auto& property : map) {
+    m_stringPropertyNames.push_back(property.first.toLatin1());
+  }
+  m_stringPropertyIndex.clear();
+  m_stringPropertyIndex.reserve(map.size());
+  for (size_t i = 0; i < m_stringPropertyNames.size(); ++i)
+  {
+    const auto& name = m_stringPropertyNames[i];
+    m_stringPropertyIndex.emplace(QLatin1String(name.constData(), name.size()), i);
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+size_t Settings::Latin1Hash::operator()(QLatin1String s) const
+{
+  size_t hash = 2166136261u; // FNV-1a
+  for (int i = 0; i < s.size(); ++i) {
+    hash = (hash ^ static_cast<unsigned char>(s.data()[i])) * 16777619u;
+  }
+  return hash;
+}
+
+// -------------------------------------------------------------------------------------------------
+const Settings::StringProperty* Settings::stringProperty(QLatin1String name) const
+{
+  const auto it = m_stringPropertyIndex.find(name);
+  return (it != m_stringPropertyIndex.cend()) ? &m_stringPropertyMap[it->second].second : nullptr;
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -334,7 +375,7 @@ void Settings::shapeSettingsLoad(const QString& preset)
       {
         const QString key = settingDefinition.settingsKey();
         const QString settingsKey = section + QString("Shape.%1/%2").arg(shape.name()).arg(key);
-        const QVariant loadedValue = m_settings->value(settingsKey, settingDefinition.defaultValue());
+        const QVariant loadedValue = m_writer->value(settingsKey, settingDefinition.defaultValue());
 
         if (settingDefinition.defaultValue().type() == QVariant::Int // Currently only int shape settings supported
             && settingDefinition.defaultValue() != loadedValue) {
@@ -365,7 +406,7 @@ void Settings::shapeSettingsSavePreset(const QString& preset)
       {
         const QString key = settingDefinition.settingsKey();
         const QString settingsKey = section + QString("Shape.%1/%2").arg(shape.name()).arg(key);
-        m_settings->setValue(settingsKey, propertyMap->property(key.toLocal8Bit()));
+        m_writer->setValue(settingsKey, propertyMap->property(key.toLocal8Bit()));
       }
     }
   }
@@ -400,7 +441,7 @@ void Settings::shapeSettingsInitialize()
             }
             logDebug(lcSettings) << QString("spot.shape.%1.%2 = ").arg(shape.name().toLower(), it->settingsKey())
                                  << setValue;
-            m_settings->setValue(QString("Shape.%1/%2").arg(shape.name()).arg(key), newValue);
+            m_writer->setValue(QString("Shape.%1/%2").arg(shape.name()).arg(key), newValue);
           }
         }
       });
@@ -424,7 +465,7 @@ void Settings::loadPreset(const QString& preset)
 void Settings::removePreset(const QString& preset)
 {
   m_presetModel->removePreset(preset);
-  m_settings->remove(presetSection(preset, false));
+  m_writer->remove(presetSection(preset, false));
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -446,24 +487,24 @@ void Settings::load(const QString& preset)
                        << (preset.size() ? QString("(%1)").arg(preset) : "");
 
   const auto s = preset.size() ? presetSection(preset) : "";
-  setShowSpotShade(m_settings->value(s+::settings::showSpotShade, settings::defaultValue::showSpotShade).toBool());
-  setSpotSize(m_settings->value(s+::settings::spotSize, settings::defaultValue::spotSize).toInt());
-  setShowCenterDot(m_settings->value(s+::settings::showCenterDot, settings::defaultValue::showCenterDot).toBool());
-  setDotSize(m_settings->value(s+::settings::dotSize, settings::defaultValue::dotSize).toInt());
-  setDotColor(m_settings->value(s+::settings::dotColor, QColor(settings::defaultValue::dotColor)).value<QColor>());
-  setDotOpacity(m_settings->value(s+::settings::dotOpacity, settings::defaultValue::dotOpacity).toDouble());
-  setShadeColor(m_settings->value(s+::settings::shadeColor, QColor(settings::defaultValue::shadeColor)).value<QColor>());
-  setShadeOpacity(m_settings->value(s+::settings::shadeOpacity, settings::defaultValue::shadeOpacity).toDouble());
-  setCursor(static_cast<Qt::CursorShape>(m_settings->value(s+::settings::cursor, static_cast<int>(settings::defaultValue::cursor)).toInt()));
-  setSpotShape(m_settings->value(s+::settings::spotShape, settings::defaultValue::spotShape).toString());
-  setSpotRotation(m_settings->value(s+::settings::spotRotation, settings::defaultValue::spotRotation).toDouble());
-  setShowBorder(m_settings->value(s+::settings::showBorder, settings::defaultValue::showBorder).toBool());
-  setBorderColor(m_settings->value(s+::settings::borderColor, QColor(settings::defaultValue::borderColor)).value<QColor>());
-  setBorderSize(m_settings->value(s+::settings::borderSize, settings::defaultValue::borderSize).toInt());
-  setBorderOpacity(m_settings->value(s+::settings::borderOpacity, settings::defaultValue::borderOpacity).toDouble());
-  setZoomEnabled(m_settings->value(s+::settings::zoomEnabled, settings::defaultValue::zoomEnabled).toBool());
-  setZoomFactor(m_settings->value(s+::settings::zoomFactor, settings::defaultValue::zoomFactor).toDouble());
-  setMultiScreenOverlayEnabled(m_settings->value(s+::settings::multiScreenOverlay, settings::defaultValue::multiScreenOverlay).toBool());
+  setShowSpotShade(m_writer->value(s+::settings::showSpotShade, settings::defaultValue::showSpotShade).toBool());
+  setSpotSize(m_writer->value(s+::settings::spotSize, settings::defaultValue::spotSize).toInt());
+  setShowCenterDot(m_writer->value(s+::settings::showCenterDot, settings::defaultValue::showCenterDot).toBool());
+  setDotSize(m_writer->value(s+::settings::dotSize, settings::defaultValue::dotSize).toInt());
+  setDotColor(m_writer->value(s+::settings::dotColor, QColor(settings::defaultValue::dotColor)).value<QColor>());
+  setDotOpacity(m_writer->value(s+::settings::dotOpacity, settings::defaultValue::dotOpacity).toDouble());
+  setShadeColor(m_writer->value(s+::settings::shadeColor, QColor(settings::defaultValue::shadeColor)).value<QColor>());
+  setShadeOpacity(m_writer->value(s+::settings::shadeOpacity, settings::defaultValue::shadeOpacity).toDouble());
+  setCursor(static_cast<Qt::CursorShape>(m_writer->value(s+::settings::cursor, static_cast<int>(settings::defaultValue::cursor)).toInt()));
+  setSpotShape(m_writer->value(s+::settings::spotShape, settings::defaultValue::spotShape).toString());
+  setSpotRotation(m_writer->value(s+::settings::spotRotation, settings::defaultValue::spotRotation).toDouble());
+  setShowBorder(m_writer->value(s+::settings::showBorder, settings::defaultValue::showBorder).toBool());
+  setBorderColor(m_writer->value(s+::settings::borderColor, QColor(settings::defaultValue::borderColor)).value<QColor>());
+  setBorderSize(m_writer->value(s+::settings::borderSize, settings::defaultValue::borderSize).toInt());
+  setBorderOpacity(m_writer->value(s+::settings::borderOpacity, settings::defaultValue::borderOpacity).toDouble());
+  setZoomEnabled(m_writer->value(s+::settings::zoomEnabled, settings::defaultValue::zoomEnabled).toBool());
+  setZoomFactor(m_writer->value(s+::settings::zoomFactor, settings::defaultValue::zoomFactor).toDouble());
+  setMultiScreenOverlayEnabled(m_writer->value(s+::settings::multiScreenOverlay, settings::defaultValue::multiScreenOverlay).toBool());
   shapeSettingsLoad(preset);
 }
 
@@ -472,24 +513,24 @@ void Settings::savePreset(const QString& preset)
 {
   const auto section = presetSection(preset);
 
-  m_settings->setValue(section+::settings::showSpotShade, m_showSpotShade);
-  m_settings->setValue(section+::settings::spotSize, m_spotSize);
-  m_settings->setValue(section+::settings::showCenterDot, m_showCenterDot);
-  m_settings->setValue(section+::settings::dotSize, m_dotSize);
-  m_settings->setValue(section+::settings::dotColor, m_dotColor);
-  m_settings->setValue(section+::settings::dotOpacity, m_dotOpacity);
-  m_settings->setValue(section+::settings::shadeColor, m_shadeColor);
-  m_settings->setValue(section+::settings::shadeOpacity, m_shadeOpacity);
-  m_settings->setValue(section+::settings::cursor, static_cast<int>(m_cursor));
-  m_settings->setValue(section+::settings::spotShape, m_spotShape);
-  m_settings->setValue(section+::settings::spotRotation, m_spotRotation);
-  m_settings->setValue(section+::settings::showBorder, m_showBorder);
-  m_settings->setValue(section+::settings::borderColor, m_borderColor);
-  m_settings->setValue(section+::settings::borderSize, m_borderSize);
-  m_settings->setValue(section+::settings::borderOpacity, m_borderOpacity);
-  m_settings->setValue(section+::settings::zoomEnabled, m_zoomEnabled);
-  m_settings->setValue(section+::settings::zoomFactor, m_zoomFactor);
-  m_settings->setValue(section+::settings::multiScreenOverlay, m_multiScreenOverlayEnabled);
+  m_writer->setValue(section+::settings::showSpotShade, m_showSpotShade);
+  m_writer->setValue(section+::settings::spotSize, m_spotSize);
+  m_writer->setValue(section+::settings::showCenterDot, m_showCenterDot);
+  m_writer->setValue(section+::settings::dotSize, m_dotSize);
+  m_writer->setValue(section+::settings::dotColor, m_dotColor);
+  m_writer->setValue(section+::settings::dotOpacity, m_dotOpacity);
+  m_writer->setValue(section+::settings::shadeColor, m_shadeColor);
+  m_writer->setValue(section+::settings::shadeOpacity, m_shadeOpacity);
+  m_writer->setValue(section+::settings::cursor, static_cast<int>(m_cursor));
+  m_writer->setValue(section+::settings::spotShape, m_spotShape);
+  m_writer->setValue(section+::settings::spotRotation, m_spotRotation);
+  m_writer->setValue(section+::settings::showBorder, m_showBorder);
+  m_writer->setValue(section+::settings::borderColor, m_borderColor);
+  m_writer->setValue(section+::settings::borderSize, m_borderSize);
+  m_writer->setValue(section+::settings::borderOpacity, m_borderOpacity);
+  m_writer->setValue(section+::settings::zoomEnabled, m_zoomEnabled);
+  m_writer->setValue(section+::settings::zoomFactor, m_zoomFactor);
+  m_writer->setValue(section+::settings::multiScreenOverlay, m_multiScreenOverlayEnabled);
   shapeSettingsSavePreset(preset);
 
   m_presetModel->addPreset(preset);
@@ -503,7 +544,7 @@ void Settings::setShowSpotShade(bool show)
     return;
 
   m_showSpotShade = show;
-  m_settings->setValue(::settings::showSpotShade, m_showSpotShade);
+  m_writer->setValue(::settings::showSpotShade, m_showSpotShade);
   logDebug(lcSettings) << "shade =" << m_showSpotShade;
   emit showSpotShadeChanged(m_showSpotShade);
 }
@@ -515,7 +556,7 @@ void Settings::setSpotSize(int size)
     return;
 
   m_spotSize = qMin(qMax(::settings::ranges::spotSize.min, size), ::settings::ranges::spotSize.max);
-  m_settings->setValue(::settings::spotSize, m_spotSize);
+  m_writer->setValue(::settings::spotSize, m_spotSize);
   logDebug(lcSettings) << "spot.size =" << m_spotSize;
   emit spotSizeChanged(m_spotSize);
 }
@@ -527,7 +568,7 @@ void Settings::setShowCenterDot(bool show)
     return;
 
   m_showCenterDot = show;
-  m_settings->setValue(::settings::showCenterDot, m_showCenterDot);
+  m_writer->setValue(::settings::showCenterDot, m_showCenterDot);
   logDebug(lcSettings) << "dot =" << m_showCenterDot;
   emit showCenterDotChanged(m_showCenterDot);
 }
@@ -539,7 +580,7 @@ void Settings::setDotSize(int size)
     return;
 
   m_dotSize = qMin(qMax(::settings::ranges::dotSize.min, size), ::settings::ranges::dotSize.max);
-  m_settings->setValue(::settings::dotSize, m_dotSize);
+  m_writer->setValue(::settings::dotSize, m_dotSize);
   logDebug(lcSettings) << "dot.size =" << m_dotSize;
   emit dotSizeChanged(m_dotSize);
 }
@@ -551,7 +592,7 @@ void Settings::setDotColor(const QColor& color)
     return;
 
   m_dotColor = color;
-  m_settings->setValue(::settings::dotColor, m_dotColor);
+  m_writer->setValue(::settings::dotColor, m_dotColor);
   logDebug(lcSettings) << "dot.color =" << m_dotColor.name();
   emit dotColorChanged(m_dotColor);
 }
@@ -562,7 +603,7 @@ void Settings::setDotOpacity(double opacity)
   if (opacity > m_dotOpacity || opacity < m_dotOpacity)
   {
     m_dotOpacity = qMin(qMax(::settings::ranges::dotOpacity.min, opacity), ::settings::ranges::dotOpacity.max);
-    m_settings->setValue(::settings::dotOpacity, m_dotOpacity);
+    m_writer->setValue(::settings::dotOpacity, m_dotOpacity);
     logDebug(lcSettings) << "dot.opacity = " << m_dotOpacity;
     emit dotOpacityChanged(m_dotOpacity);
   }
@@ -575,7 +616,7 @@ void Settings::setShadeColor(const QColor& color)
     return;
 
   m_shadeColor = color;
-  m_settings->setValue(::settings::shadeColor, m_shadeColor);
+  m_writer->setValue(::settings::shadeColor, m_shadeColor);
   logDebug(lcSettings) << "shade.color =" << m_shadeColor.name();
   emit shadeColorChanged(m_shadeColor);
 }
@@ -586,7 +627,7 @@ void Settings::setShadeOpacity(double opacity)
   if (opacity > m_shadeOpacity || opacity < m_shadeOpacity)
   {
     m_shadeOpacity = qMin(qMax(::settings::ranges::shadeOpacity.min, opacity), ::settings::ranges::shadeOpacity.max);
-    m_settings->setValue(::settings::shadeOpacity, m_shadeOpacity);
+    m_writer->setValue(::settings::shadeOpacity, m_shadeOpacity);
     logDebug(lcSettings) << "shade.opacity = " << m_shadeOpacity;
     emit shadeOpacityChanged(m_shadeOpacity);
   }
@@ -599,7 +640,7 @@ void Settings::setCursor(Qt::CursorShape cursor)
     return;
 
   m_cursor = qMin(qMax(static_cast<Qt::CursorShape>(0), cursor), Qt::LastCursor);
-  m_settings->setValue(::settings::cursor, static_cast<int>(m_cursor));
+  m_writer->setValue(::settings::cursor, static_cast<int>(m_cursor));
   logDebug(lcSettings) << "cursor = " << m_cursor;
   emit cursorChanged(m_cursor);
 }
@@ -617,7 +658,7 @@ void Settings::setSpotShape(const QString& spotShapeQmlComponent)
 
   if (it != spotShapes().cend()) {
     m_spotShape = it->qmlComponent();
-    m_settings->setValue(::settings::spotShape, m_spotShape);
+    m_writer->setValue(::settings::spotShape, m_spotShape);
     logDebug(lcSettings) << "spot.shape = " << m_spotShape;
     emit spotShapeChanged(m_spotShape);
     setSpotRotationAllowed(it->allowRotation());
@@ -630,7 +671,7 @@ void Settings::setSpotRotation(double rotation)
   if (rotation > m_spotRotation || rotation < m_spotRotation)
   {
     m_spotRotation = qMin(qMax(::settings::ranges::spotRotation.min, rotation), ::settings::ranges::spotRotation.max);
-    m_settings->setValue(::settings::spotRotation, m_spotRotation);
+    m_writer->setValue(::settings::spotRotation, m_spotRotation);
     logDebug(lcSettings) << "spot.rotation = " << m_spotRotation;
     emit spotRotationChanged(m_spotRotation);
   }
@@ -688,7 +729,7 @@ void Settings::setShowBorder(bool show)
     return;
 
   m_showBorder = show;
-  m_settings->setValue(::settings::showBorder, m_showBorder);
+  m_writer->setValue(::settings::showBorder, m_showBorder);
   logDebug(lcSettings) << "border = " << m_showBorder;
   emit showBorderChanged(m_showBorder);
 }
@@ -700,7 +741,7 @@ void Settings::setBorderColor(const QColor& color)
     return;
 
   m_borderColor = color;
-  m_settings->setValue(::settings::borderColor, m_borderColor);
+  m_writer->setValue(::settings::borderColor, m_borderColor);
   logDebug(lcSettings) << "border.color = " << m_borderColor.name();
   emit borderColorChanged(m_borderColor);
 }
@@ -712,7 +753,7 @@ void Settings::setBorderSize(int size)
     return;
 
   m_borderSize = qMin(qMax(::settings::ranges::borderSize.min, size), ::settings::ranges::borderSize.max);
-  m_settings->setValue(::settings::borderSize, m_borderSize);
+  m_writer->setValue(::settings::borderSize, m_borderSize);
   logDebug(lcSettings) << "border.size = " << m_borderSize;
   emit borderSizeChanged(m_borderSize);
 }
@@ -723,7 +764,7 @@ void Settings::setBorderOpacity(double opacity)
   if (opacity > m_borderOpacity || opacity < m_borderOpacity)
   {
     m_borderOpacity = qMin(qMax(::settings::ranges::borderOpacity.min, opacity), ::settings::ranges::borderOpacity.max);
-    m_settings->setValue(::settings::borderOpacity, m_borderOpacity);
+    m_writer->setValue(::settings::borderOpacity, m_borderOpacity);
     logDebug(lcSettings) << "border.opacity = " << m_borderOpacity;
     emit borderOpacityChanged(m_borderOpacity);
   }
@@ -736,7 +777,7 @@ void Settings::setZoomEnabled(bool enabled)
     return;
 
   m_zoomEnabled = enabled;
-  m_settings->setValue(::settings::zoomEnabled, m_zoomEnabled);
+  m_writer->setValue(::settings::zoomEnabled, m_zoomEnabled);
   logDebug(lcSettings) << "zoom = " << m_zoomEnabled;
   emit zoomEnabledChanged(m_zoomEnabled);
 }
@@ -747,7 +788,7 @@ void Settings::setZoomFactor(double factor)
   if (factor > m_zoomFactor || factor < m_zoomFactor)
   {
     m_zoomFactor = qMin(qMax(::settings::ranges::zoomFactor.min, factor), ::settings::ranges::zoomFactor.max);
-    m_settings->setValue(::settings::zoomFactor, m_zoomFactor);
+    m_writer->setValue(::settings::zoomFactor, m_zoomFactor);
     logDebug(lcSettings) << "zoom.factor = " << m_zoomFactor;
     emit zoomFactorChanged(m_zoomFactor);
   }
@@ -758,7 +799,7 @@ void Settings::setMultiScreenOverlayEnabled(bool enabled)
 {
     if (m_multiScreenOverlayEnabled == enabled) return;
     m_multiScreenOverlayEnabled = enabled;
-    m_settings->setValue(::settings::multiScreenOverlay, m_multiScreenOverlayEnabled);
+    m_writer->setValue(::settings::multiScreenOverlay, m_multiScreenOverlayEnabled);
     logDebug(lcSettings) << "multi-screen-overlay = " << m_multiScreenOverlayEnabled;
     emit multiScreenOverlayEnabledChanged(m_multiScreenOverlayEnabled);
 }
@@ -789,57 +830,126 @@ void Settings::setDeviceInputSeqInterval(const DeviceId& dId, int intervalMs)
 {
   const auto v = qMin(qMax(::settings::ranges::inputSequenceInterval.min, intervalMs),
                            ::settings::ranges::inputSequenceInterval.max);
-  m_settings->setValue(settingsKey(dId, ::settings::inputSequenceInterval), v);
+  m_writer->setValue(settingsKey(dId, ::settings::inputSequenceInterval), v);
 }
 
 // -------------------------------------------------------------------------------------------------
 int Settings::deviceInputSeqInterval(const DeviceId& dId) const
 {
-  const auto value = m_settings->value(settingsKey(dId, ::settings::inputSequenceInterval),
+  const auto value = m_writer->value(settingsKey(dId, ::settings::inputSequenceInterval),
                                        ::settings::defaultValue::inputSequenceInterval).toInt();
   return qMin(qMax(::settings::ranges::inputSequenceInterval.min, value),
                    ::settings::ranges::inputSequenceInterval.max);
 }
 
+// -------------------------------------------------------------------------------------------------
+void Settings::setDeviceRelEventCoalescing(const DeviceId& dId, bool coalesce)
+{
+  m_writer->setValue(settingsKey(dId, ::settings::relEventCoalescing), coalesce);
+}
+
+// -------------------------------------------------------------------------------------------------
+bool Settings::deviceRelEventCoalescing(const DeviceId& dId) const
+{
+  return m_writer->value(settingsKey(dId, ::settings::relEventCoalescing),
+                           ::settings::defaultValue::relEventCoalescing).toBool();
+}
+
+// -------------------------------------------------------------------------------------------------
+QString Settings::persistenceStatistics() const
+{
+  const auto& s = m_writer->statistics();
+  return tr("Settings file writes: flushes=%1 values=%2 coalesced=%3 pending=%4 "
+            "last=%5us max=%6us total=%7us")
+    .arg(s.flushes).arg(s.keysWritten).arg(s.coalescedWrites).arg(m_writer->pendingCount())
+    .arg(s.lastFlushUsec).arg(s.maxFlushUsec).arg(s.totalFlushUsec);
+}
+
+// -------------------------------------------------------------------------------------------------
+QString Settings::inputMapFilePath(const DeviceId& dId) const
+{
+  const QFileInfo fi(m_settings->fileName());
+  return QString("%1/%2-inputmaps/%3_%4.pim").arg(fi.absolutePath(), fi.completeBaseName())
+           .arg(dId.vendorId, 4, 16, QChar('0')).arg(dId.productId, 4, 16, QChar('0'));
+}
+
 // -------------------------------------------------------------------------------------------------
 void Settings::setDeviceInputMapConfig(const DeviceId& dId, const InputMapConfig& imc)
 {
-  const int sizeBefore = m_settings->value(settingsKey(dId, ::settings::inputMapConfig)
-                                           + "/size", 0).toInt();
-  m_settings->beginWriteArray(settingsKey(dId, ::settings::inputMapConfig), imc.size());
+  const auto path = inputMapFilePath(dId);
+  if (InputMapStore::save(path, imc))
+  {
+    // Input mappings from previous versions in the settings file are replaced.
+    m_writer->remove(settingsKey(dId, ::settings::inputMapConfig));
+    return;
+  }
+
+  // Fall back to the settings file, a stale input mapping file would take precedence.
+  // The mappings are written through the settings writer in the key layout of a QSettings array
+  // ('<group>/<1-based index>/<key>' and '<group>/size'), like previous versions did.
+  QFile::remove(path);
+  const QString group = settingsKey(dId, ::settings::inputMapConfig);
+  m_writer->remove(group); // also removes old entries
   int index = 0;
   for (const auto& item : imc)
   {
-    m_settings->setArrayIndex(index++);
-    m_settings->setValue("deviceSequence", QVariant::fromValue(item.first));
-    m_settings->setValue("mappedAction", QVariant::fromValue(item.second));
+    const QString prefix = QString("%1/%2/").arg(group).arg(++index);
+    m_writer->setValue(prefix + "deviceSequence", QVariant::fromValue(item.first));
+    m_writer->setValue(prefix + "mappedAction", QVariant::fromValue(item.second));
   }
-  m_settings->endArray();
+  m_writer->setValue(group + "/size", index);
+}
 
-  // Remove old entries...
-  m_settings->beginGroup(settingsKey(dId, ::settings::inputMapConfig));
-  for (; index < sizeBefore; ++index) {
-    m_settings->remove(QString::number(index+1));
+// -------------------------------------------------------------------------------------------------
+InputMapConfig Settings::getDeviceInputMapConfig(const DeviceId& dId)
+{
+  InputMapStore::File file;
+  if (file.open(inputMapFilePath(dId)))
+  {
+    InputMapConfig cfg;
+    if (file.decode(cfg)) return cfg;
+    logWarning(lcSettings) << file.errorString();
   }
-  m_settings->endGroup();
+  return settingsFileInputMapConfig(dId);
 }
 
 // -------------------------------------------------------------------------------------------------
-InputMapConfig Settings::getDeviceInputMapConfig(const DeviceId& dId)
+std::function<InputMapConfig()> Settings::deviceInputMapConfigLoader(const DeviceId& dId)
+{
+  // Only maps the file, the input mapping is decoded when it is used first.
+  auto file = std::make_shared<InputMapStore::File>();
+  if (file->open(inputMapFilePath(dId)))
+  {
+    return [file]() {
+      InputMapConfig cfg;
+      if (!file->decode(cfg)) logWarning(lcSettings) << file->errorString();
+      return cfg;
+    };
+  }
+
+  // Migrate input mappings stored in the settings file by previous versions.
+  auto cfg = settingsFileInputMapConfig(dId);
+  if (!cfg.empty()) setDeviceInputMapConfig(dId, cfg);
+  return [cfg=std::move(cfg)]() { return cfg; };
+}
+
+// -------------------------------------------------------------------------------------------------
+InputMapConfig Settings::settingsFileInputMapConfig(const DeviceId& dId)
 {
   InputMapConfig cfg;
 
-  const int size = m_settings->beginReadArray(settingsKey(dId, ::settings::inputMapConfig));
-  for (int i = 0; i < size; ++i)
+  // Read through the settings writer, which might still hold the mappings as pending values.
+  const QString group = settingsKey(dId, ::settings::inputMapConfig);
+  const int size = m_writer->value(group + "/size", 0).toInt();
+  for (int i = 1; i <= size; ++i)
   {
-    m_settings->setArrayIndex(i);
-    const auto seq = m_settings->value("deviceSequence");
+    const QString prefix = QString("%1/%2/").arg(group).arg(i);
+    const auto seq = m_writer->value(prefix + "deviceSequence");
     if (!seq.canConvert<KeyEventSequence>()) continue;
-    const auto conf = m_settings->value("mappedAction");
+    const auto conf = m_writer->value(prefix + "mappedAction");
     if (!conf.canConvert<MappedAction>()) continue;
     cfg.emplace(qvariant_cast<KeyEventSequence>(seq), qvariant_cast<MappedAction>(conf));
   }
-  m_settings->endArray();
 
   return cfg;
 }
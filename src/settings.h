@@ -3,6 +3,7 @@
 
 #include <functional>
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 #include <QAbstractListModel>
@@ -14,6 +15,7 @@ class InputMapConfig;
 class PresetModel;
 class QSettings;
 class QQmlPropertyMap;
+class SettingsWriter;
 
 // -------------------------------------------------------------------------------------------------
 class Settings : public QObject
@@ -159,6 +161,8 @@ public:
   };
 
   const std::vector<std::pair<QString, StringProperty>>& stringProperties() const;
+  // Hash lookup of a string property by its (Latin-1) name, nullptr if there is no such property.
+  const StringProperty* stringProperty(QLatin1String name) const;
 
   void savePreset(const QString& preset);
   void loadPreset(const QString& preset);
@@ -168,8 +172,16 @@ public:
 
   void setDeviceInputSeqInterval(const DeviceId& dId, int intervalMs);
   int deviceInputSeqInterval(const DeviceId& dId) const;
+  void setDeviceRelEventCoalescing(const DeviceId& dId, bool coalesce);
+  bool deviceRelEventCoalescing(const DeviceId& dId) const;
   void setDeviceInputMapConfig(const DeviceId& dId, const InputMapConfig& imc);
   InputMapConfig getDeviceInputMapConfig(const DeviceId& dId);
+  // Returns a loader for the input mapping of the device that can be used with
+  // InputMapper::setConfigurationLoader, the stored mapping is not read before it is called.
+  std::function<InputMapConfig()> deviceInputMapConfigLoader(const DeviceId& dId);
+
+  // Human readable statistics of the settings file writes.
+  QString persistenceStatistics() const;
 
 signals:
   void showSpotShadeChanged(bool show);
@@ -196,7 +208,11 @@ signals:
   void presetLoaded(const QString& preset);
 
 private:
+  QString inputMapFilePath(const DeviceId& dId) const;
+  InputMapConfig settingsFileInputMapConfig(const DeviceId& dId);
+
   QSettings* m_settings = nullptr;
+  SettingsWriter* m_writer = nullptr; // all values except input mappings are written through it
 
   PresetModel* m_presetModel;
   std::map<QString, QQmlPropertyMap*> m_shapeSettings;
@@ -225,6 +241,10 @@ private:
 
   std::vector<std::pair<QString, StringProperty>> m_stringPropertyMap;
 
+  struct Latin1Hash { size_t operator()(QLatin1String s) const; };
+  std::vector<QByteArray> m_stringPropertyNames; // interned names, referenced by the index keys
+  std::unordered_map<QLatin1String, size_t, Latin1Hash> m_stringPropertyIndex;
+
 private:
   void init();
   void load(const QString& preset = QString());
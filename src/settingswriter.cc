@@ -0,0 +1,108 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "settingswriter.h"
+
+#include "logging.h"
+
+#include <QCoreApplication>
+#include <QSettings>
+#include <QTimer>
+
+#include <algorithm>
+
+DECLARE_LOGGING_CATEGORY(lcSettings)
+
+// -------------------------------------------------------------------------------------------------
+SettingsWriter::SettingsWriter(QSettings* settings, QObject* parent)
+  : QObject(parent)
+  , m_settings(settings)
+  , m_timer(new QTimer(this))
+{
+  m_timer->setSingleShot(true);
+  connect(m_timer, &QTimer::timeout, this, &SettingsWriter::flush);
+
+  if (const auto app = QCoreApplication::instance()) {
+    connect(app, &QCoreApplication::aboutToQuit, this, &SettingsWriter::flush);
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+SettingsWriter::~SettingsWriter()
+{
+  flush();
+}
+
+// -------------------------------------------------------------------------------------------------
+void SettingsWriter::setValue(const QString& key, const QVariant& value)
+{
+  const auto it = m_pending.find(key);
+  if (it != m_pending.end())
+  {
+    ++m_statistics.coalescedWrites;
+    it.value() = value;
+  }
+  else
+  {
+    // Setters are also called when settings are loaded, skip values that are stored already.
+    if (m_settings->contains(key) && m_settings->value(key) == value) return;
+    if (m_pending.isEmpty()) m_firstPending.start();
+    m_pending.insert(key, value);
+  }
+  scheduleFlush();
+}
+
+// -------------------------------------------------------------------------------------------------
+QVariant SettingsWriter::value(const QString& key, const QVariant& defaultValue) const
+{
+  const auto it = m_pending.constFind(key);
+  return (it != m_pending.cend()) ? it.value() : m_settings->value(key, defaultValue);
+}
+
+// -------------------------------------------------------------------------------------------------
+void SettingsWriter::remove(const QString& key)
+{
+  const QString groupPrefix = key + '/';
+  for (auto it = m_pending.begin(); it != m_pending.end();)
+  {
+    if (it.key() == key || it.key().startsWith(groupPrefix)) it = m_pending.erase(it);
+    else ++it;
+  }
+  if (m_pending.isEmpty()) m_timer->stop();
+
+  m_settings->remove(key);
+}
+
+// -------------------------------------------------------------------------------------------------
+void SettingsWriter::scheduleFlush()
+{
+  // Each change restarts the quiet period, but a continuous stream of changes (e.g. while dragging
+  // a slider) is still written after the maximum delay.
+  const auto remainingDelay = std::max<qint64>(0, MaxDelayMsecs - m_firstPending.elapsed());
+  m_timer->start(static_cast<int>(std::min<qint64>(m_quietPeriodMsecs, remainingDelay)));
+}
+
+// -------------------------------------------------------------------------------------------------
+void SettingsWriter::flush()
+{
+  m_timer->stop();
+  if (m_pending.isEmpty()) return;
+
+  QElapsedTimer timer;
+  timer.start();
+  for (auto it = m_pending.cbegin(); it != m_pending.cend(); ++it) {
+    m_settings->setValue(it.key(), it.value());
+  }
+  m_settings->sync(); // QSettings writes the file atomically
+
+  const int64_t durationUsec = timer.nsecsElapsed() / 1000;
+  ++m_statistics.flushes;
+  m_statistics.keysWritten += m_pending.size();
+  m_statistics.lastFlushUsec = durationUsec;
+  m_statistics.maxFlushUsec = std::max(m_statistics.maxFlushUsec, durationUsec);
+  m_statistics.totalFlushUsec += durationUsec;
+
+  if (m_settings->status() != QSettings::NoError) {
+    logWarning(lcSettings) << tr("Error writing settings file '%1'.").arg(m_settings->fileName());
+  }
+  logDebug(lcSettings) << tr("Wrote %1 settings in %2 us.").arg(m_pending.size()).arg(durationUsec);
+  m_pending.clear();
+}
@@ -0,0 +1,62 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QVariant>
+
+#include <cstdint>
+
+class QSettings;
+class QTimer;
+
+// -------------------------------------------------------------------------------------------------
+/// Write-behind layer for QSettings: Values are collected and written to the settings file at
+/// once after a quiet period without changes, at the latest after the maximum delay, and when the
+/// application quits. Reads return pending values, so the layer is transparent to the caller.
+class SettingsWriter : public QObject
+{
+  Q_OBJECT
+
+public:
+  static constexpr int DefaultQuietPeriodMsecs = 500;
+  static constexpr int MaxDelayMsecs = 5000;
+
+  struct Statistics
+  {
+    uint64_t flushes = 0;         // writes of the settings file
+    uint64_t keysWritten = 0;     // values written with all flushes
+    uint64_t coalescedWrites = 0; // changes that replaced a pending value of the same key
+    int64_t lastFlushUsec = 0;
+    int64_t maxFlushUsec = 0;
+    int64_t totalFlushUsec = 0;
+  };
+
+  // The settings object is not owned and must outlive the writer or be flushed before.
+  explicit SettingsWriter(QSettings* settings, QObject* parent = nullptr);
+  ~SettingsWriter() override;
+
+  void setValue(const QString& key, const QVariant& value);
+  QVariant value(const QString& key, const QVariant& defaultValue = QVariant()) const;
+  // Remove the key and all keys in the group with that name, including pending values.
+  void remove(const QString& key);
+
+  void flush(); // Write all pending values and sync the settings file.
+  int pendingCount() const { return m_pending.size(); }
+
+  int quietPeriod() const { return m_quietPeriodMsecs; }
+  void setQuietPeriod(int msecs) { m_quietPeriodMsecs = msecs; }
+
+  const Statistics& statistics() const { return m_statistics; }
+
+private:
+  void scheduleFlush();
+
+  QSettings* const m_settings;
+  QTimer* const m_timer;
+  QHash<QString, QVariant> m_pending;
+  QElapsedTimer m_firstPending; // time since the oldest pending change
+  int m_quietPeriodMsecs = DefaultQuietPeriodMsecs;
+  Statistics m_statistics;
+};
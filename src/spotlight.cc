@@ -2,50 +2,79 @@
 #include "spotlight.h"
 
 #include "deviceinput.h"
+#include "hotplugmonitor.h"
+#include "inputengine.h"
+#include "inputlatency.h"
 #include "logging.h"
+#include "reactor.h"
 #include "settings.h"
 #include "virtualdevice.h"
 
-#include <QSocketNotifier>
+#include <QDir>
+#include <QStringList>
 #include <QTimer>
-#include <QVarLengthArray>
+
+#include <array>
 
 #include <fcntl.h>
 #include <sys/inotify.h>
-#include <sys/ioctl.h>
 #include <linux/input.h>
 #include <unistd.h>
 
 DECLARE_LOGGING_CATEGORY(device)
 
 namespace {
+  // Retry connecting a hotplugged device that is not accessible yet, e.g. because the udev rules
+  // have not been applied when only kernel uevents are available.
+  constexpr int hotplugRetryInterval = 50; // ms
+  constexpr int hotplugMaxRetries = 20;
 } // --- end anonymous namespace
 
 // -------------------------------------------------------------------------------------------------
 Spotlight::Spotlight(QObject* parent, Options options, Settings* settings)
   : QObject(parent)
   , m_options(std::move(options))
-  , m_activeTimer(new QTimer(this))
+  , m_scanCache(m_options.scanRoots)
+  , m_reactor(new EventLoopReactor(this))
   , m_connectionTimer(new QTimer(this))
   , m_settings(settings)
 {
-  m_activeTimer->setSingleShot(true);
-  m_activeTimer->setInterval(600);
-
-  connect(m_activeTimer, &QTimer::timeout, this, [this](){
-    setSpotActive(false);
-  });
-
-  if (m_options.enableUInput) {
-    m_virtualDevice = VirtualDevice::create();
+  if (m_options.enableUInput)
+  {
+    // The keyboard profile covers every key a key sequence action can emit, so the capabilities
+    // do not depend on the input mappings, which can change at any time.
+    using Capabilities = VirtualDevice::Capabilities;
+    m_virtualDevice = m_options.splitUInput
+      ? VirtualDevice::createSplit(Capabilities::fromProfile(Capabilities::Profile::Pointer),
+                                   Capabilities::fromProfile(Capabilities::Profile::Keyboard))
+      : VirtualDevice::create(Capabilities::fromProfile(Capabilities::Profile::Combined));
+    if (m_virtualDevice && m_options.asyncUInput) m_virtualDevice->startAsyncWriting();
   }
   else {
     logInfo(device) << tr("Virtual device initialization was skipped.");
   }
 
+  // Device input is read and mapped in a separate thread, independent of the GUI.
+  m_inputEngine = new InputEngine(m_virtualDevice, this);
+  if (!m_options.recordFile.isEmpty() && m_inputEngine->startRecording(m_options.recordFile)) {
+    logInfo(device) << tr("Recording device input to '%1'.").arg(m_options.recordFile);
+  }
+  connect(m_inputEngine, &InputEngine::spotActiveChanged, this, [this](bool active){
+    setSpotActive(active);
+  });
+
+  connect(m_inputEngine, &InputEngine::readError, this, [this](const QString& devicePath){
+    const bool anyConnectedBefore = anySpotlightDeviceConnected();
+    removeDeviceConnection(devicePath);
+    if (!anySpotlightDeviceConnected() && anyConnectedBefore) {
+      emit anySpotlightDeviceConnectedChanged(false);
+    }
+  });
+  m_inputEngine->start();
+
   m_connectionTimer->setSingleShot(true);
   // From detecting a change from inotify, the device needs some time to be ready for open
-  // TODO: This interval seems to work, but it is arbitrary - there should be a better way.
+  // This interval seems to work, but it is arbitrary - only used if hotplug events are not available.
   m_connectionTimer->setInterval(800);
 
   connect(m_connectionTimer, &QTimer::timeout, this, [this]() {
@@ -55,11 +84,23 @@ Spotlight::Spotlight(QObject* parent, Options options, Settings* settings)
 
   // Try to find already attached device(s) and connect to it.
   connectDevices();
-  setupDevEventInotify();
+  if (!setupHotplugMonitor()) {
+    setupDevEventInotify();
+  }
 }
 
 // -------------------------------------------------------------------------------------------------
-Spotlight::~Spotlight() = default;
+Spotlight::~Spotlight()
+{
+  // Make sure the input engine does not access device connections anymore
+  m_inputEngine->stop();
+
+  if (m_inotifyFd >= 0)
+  {
+    m_reactor->remove(m_inotifyFd);
+    ::close(m_inotifyFd);
+  }
+}
 
 // -------------------------------------------------------------------------------------------------
 bool Spotlight::anySpotlightDeviceConnected() const
@@ -85,7 +126,7 @@ void Spotlight::setSpotActive(bool active)
 {
   if (m_spotActive == active) return;
   m_spotActive = active;
-  if (!m_spotActive) m_activeTimer->stop();
+  if (!m_spotActive) m_inputEngine->resetSpotActivity();
   emit spotActiveChanged(m_spotActive);
 }
 
@@ -108,97 +149,164 @@ std::vector<Spotlight::ConnectedDeviceInfo> Spotlight::connectedDevices() const
 }
 
 // -------------------------------------------------------------------------------------------------
-int Spotlight::connectDevices()
+QString Spotlight::latencyStatistics() const
 {
-  const auto scanResult = DeviceScan::getDevices(m_options.additionalDevices);
-  for (const auto& dev : scanResult.devices)
+  QStringList lines;
+  lines.push_back(tr("Input latency (kernel event time until written to the virtual device):"));
+  for (const auto& dc : m_deviceConnections)
   {
-    auto& dc = m_deviceConnections[dev.id];
-    if (!dc) {
-      dc = std::make_shared<DeviceConnection>(dev.id, dev.getName(), m_virtualDevice);
+    lines.push_back(QString("%1 (%2:%3)").arg(dc.second->deviceName())
+                    .arg(dc.first.vendorId, 4, 16, QChar('0'))
+                    .arg(dc.first.productId, 4, 16, QChar('0')));
+    const auto& statistics = dc.second->inputMapper()->latencyStatistics();
+    for (size_t i = 0; i < InputLatencyStatistics::NumPaths; ++i)
+    {
+      const auto path = static_cast<InputPath>(i);
+      lines.push_back(QString("  %1 %2").arg(InputLatencyStatistics::pathName(path), -17)
+                      .arg(toString(statistics.histogram(path).snapshot())));
     }
+  }
 
-    const bool anyConnectedBefore = anySpotlightDeviceConnected();
-    for (const auto& scanSubDevice : dev.subDevices)
+  if (m_virtualDevice)
+  {
+    lines.push_back(tr("Virtual device write duration:"));
+    lines.push_back(QString("  %1").arg(toString(m_virtualDevice->writeDuration().snapshot())));
+    for (const auto& s : m_virtualDevice->writerStatistics())
     {
-      if (scanSubDevice.type != DeviceScan::SubDevice::Type::Event) continue;
-      if (!scanSubDevice.deviceReadable) continue;
-      if (dc->hasSubDevice(scanSubDevice.deviceFile)) continue;
+      lines.push_back(QString("  queue: depth=%1 max=%2 written=%3 dropped=%4 stalls=%5 errors=%6")
+                      .arg(s.queueDepth).arg(s.maxQueueDepth).arg(s.written).arg(s.dropped)
+                      .arg(s.stalls).arg(s.errors));
+    }
+  }
+  return lines.join('\n');
+}
 
-      auto subDeviceConnection = SubEventConnection::create(scanSubDevice, *dc);
-      if (!addInputEventHandler(subDeviceConnection)) continue;
+// -------------------------------------------------------------------------------------------------
+void Spotlight::resetLatencyStatistics()
+{
+  for (const auto& dc : m_deviceConnections) {
+    dc.second->inputMapper()->latencyStatistics().reset();
+  }
+  if (m_virtualDevice) m_virtualDevice->resetWriteDuration();
+}
+
+// -------------------------------------------------------------------------------------------------
+int Spotlight::connectDevices()
+{
+  const auto scanResult = m_scanCache.getDevices(m_options.additionalDevices);
+  for (const auto& dev : scanResult.devices) {
+    connectSubDevices(dev);
+  }
+  return m_deviceConnections.size();
+}
+
+// -------------------------------------------------------------------------------------------------
+int Spotlight::connectSubDevices(const DeviceScan::Device& dev, const QString& deviceFile)
+{
+  int connected = 0;
+  auto& dc = m_deviceConnections[dev.id];
+  if (!dc) {
+    dc = std::make_shared<DeviceConnection>(dev.id, dev.getName(), m_virtualDevice);
+  }
 
-      if (dc->subDeviceCount() == 0) {
-        // Load Input mapping settings when first sub-device gets added.
-        const auto im = dc->inputMapper().get();
+  const bool anyConnectedBefore = anySpotlightDeviceConnected();
+  for (const auto& scanSubDevice : dev.subDevices)
+  {
+    if (!deviceFile.isEmpty() && scanSubDevice.deviceFile != deviceFile) continue;
+    if (!scanSubDevice.deviceReadable) continue;
+    if (dc->hasSubDevice(scanSubDevice.deviceFile)) continue;
 
-        im->setKeyEventInterval(m_settings->deviceInputSeqInterval(dev.id));
-        im->setConfiguration(m_settings->getDeviceInputMapConfig(dev.id));
+    std::shared_ptr<SubDeviceConnection> subDeviceConnection;
+    if (scanSubDevice.type == DeviceScan::SubDevice::Type::Event) {
+      subDeviceConnection = SubEventConnection::create(scanSubDevice, *dc);
+    }
+    else if (scanSubDevice.type == DeviceScan::SubDevice::Type::Hidraw && scanSubDevice.deviceWritable) {
+      // HID++ requests are written to the hidraw device.
+      subDeviceConnection = SubHidrawConnection::create(scanSubDevice, *dc);
+    }
+    if (!subDeviceConnection || !subDeviceConnection->isConnected()) continue;
 
-        connect(im, &InputMapper::configurationChanged, this, [this, id=dev.id, im]() {
-          m_settings->setDeviceInputMapConfig(id, im->configuration());
-        });
+    if (dc->subDeviceCount() == 0) {
+      // Load Input mapping settings when first sub-device gets added. This must be done before the
+      // input engine reads from the sub-device, events must not be mapped with a default setup.
+      const auto im = dc->inputMapper().get();
+      disconnect(im, nullptr, this, nullptr); // a previous sub-device may have failed to connect
 
-        static QString lastPreset;
+      im->setKeyEventInterval(m_settings->deviceInputSeqInterval(dev.id));
+      im->setRelEventCoalescing(m_settings->deviceRelEventCoalescing(dev.id));
+      im->setConfigurationLoader(m_settings->deviceInputMapConfigLoader(dev.id));
 
-        connect(im, &InputMapper::actionMapped, this, [this](std::shared_ptr<Action> action)
+      connect(im, &InputMapper::configurationChanged, this, [this, id=dev.id, im]() {
+        m_settings->setDeviceInputMapConfig(id, im->configuration());
+      });
+
+      static QString lastPreset;
+
+      connect(im, &InputMapper::actionMapped, this, [this, id=dev.id](std::shared_ptr<Action> action)
+      {
+        emit actionMapped(id, action);
+        if (action->type() == Action::Type::CyclePresets)
         {
-          if (action->type() == Action::Type::CyclePresets)
-          {
-            auto it = std::find(m_settings->presets().cbegin(), m_settings->presets().cend(), lastPreset);
-            if ((it == m_settings->presets().cend()) || (++it == m_settings->presets().cend())) {
-              it = m_settings->presets().cbegin();
-            }
-
-            if (it != m_settings->presets().cend())
-            {
-              lastPreset = *it;
-              m_settings->loadPreset(lastPreset);
-            }
+          auto it = std::find(m_settings->presets().cbegin(), m_settings->presets().cend(), lastPreset);
+          if ((it == m_settings->presets().cend()) || (++it == m_settings->presets().cend())) {
+            it = m_settings->presets().cbegin();
           }
-          else if (action->type() == Action::Type::ToggleSpotlight)
+
+          if (it != m_settings->presets().cend())
           {
-            m_settings->setOverlayDisabled(!m_settings->overlayDisabled());
+            lastPreset = *it;
+            m_settings->loadPreset(lastPreset);
           }
-        });
+        }
+        else if (action->type() == Action::Type::ToggleSpotlight)
+        {
+          m_settings->setOverlayDisabled(!m_settings->overlayDisabled());
+        }
+      });
 
-        connect(m_settings, &Settings::presetLoaded, this, [](const QString& preset){
-          lastPreset = preset;
-        });
-      }
+      connect(m_settings, &Settings::presetLoaded, this, [](const QString& preset){
+        lastPreset = preset;
+      });
+    }
 
-      dc->addSubDevice(std::move(subDeviceConnection));
-      if (dc->subDeviceCount() == 1)
-      {
-        QTimer::singleShot(0, this,
-        [this, id = dev.id, devName = dc->deviceName(), anyConnectedBefore](){
-          logInfo(device) << tr("Connected device: %1 (%2:%3)")
-                             .arg(devName)
-                             .arg(id.vendorId, 4, 16, QChar('0'))
-                             .arg(id.productId, 4, 16, QChar('0'));
-          emit deviceConnected(id, devName);
-          if (!anyConnectedBefore) emit anySpotlightDeviceConnectedChanged(true);
-        });
-      }
+    // Hand the sub-device to the input engine thread only after the mapper is set up.
+    if (!addInputEventHandler(subDeviceConnection)) continue;
 
-      logDebug(device) << tr("Connected sub-device: %1 (%2:%3) %4")
-                          .arg(dc->deviceName())
-                          .arg(dev.id.vendorId, 4, 16, QChar('0'))
-                          .arg(dev.id.productId, 4, 16, QChar('0'))
-                          .arg(scanSubDevice.deviceFile);
-      emit subDeviceConnected(dev.id, dc->deviceName(), scanSubDevice.deviceFile);
+    dc->addSubDevice(std::move(subDeviceConnection));
+    if (dc->subDeviceCount() == 1)
+    {
+      QTimer::singleShot(0, this,
+      [this, id = dev.id, devName = dc->deviceName(), anyConnectedBefore](){
+        logInfo(device) << tr("Connected device: %1 (%2:%3)")
+                           .arg(devName)
+                           .arg(id.vendorId, 4, 16, QChar('0'))
+                           .arg(id.productId, 4, 16, QChar('0'));
+        emit deviceConnected(id, devName);
+        if (!anyConnectedBefore) emit anySpotlightDeviceConnectedChanged(true);
+      });
     }
 
-    if (dc->subDeviceCount() == 0) {
-      m_deviceConnections.erase(dev.id);
-    }
+    logDebug(device) << tr("Connected sub-device: %1 (%2:%3) %4")
+                        .arg(dc->deviceName())
+                        .arg(dev.id.vendorId, 4, 16, QChar('0'))
+                        .arg(dev.id.productId, 4, 16, QChar('0'))
+                        .arg(scanSubDevice.deviceFile);
+    emit subDeviceConnected(dev.id, dc->deviceName(), scanSubDevice.deviceFile);
+    ++connected;
   }
-  return m_deviceConnections.size();
+
+  if (dc->subDeviceCount() == 0) {
+    m_deviceConnections.erase(dev.id);
+  }
+  return connected;
 }
 
 // -------------------------------------------------------------------------------------------------
 void Spotlight::removeDeviceConnection(const QString &devicePath)
 {
+  // Stop reading from the sub-device before closing it.
+  m_inputEngine->removeConnection(devicePath);
+
   for (auto dc_it = m_deviceConnections.begin(); dc_it != m_deviceConnections.end(); )
   {
     if (!dc_it->second) {
@@ -227,75 +335,68 @@ void Spotlight::removeDeviceConnection(const QString &devicePath)
 }
 
 // -------------------------------------------------------------------------------------------------
-void Spotlight::onEventDataAvailable(int fd, SubEventConnection& connection)
+bool Spotlight::addInputEventHandler(std::shared_ptr<SubDeviceConnection> connection)
 {
-  const bool isNonBlocking = !!(connection.flags() & DeviceFlag::NonBlocking);
-  while (true)
-  {
-    auto& buf = connection.inputBuffer();
-    auto& ev = buf.current();
-    if (::read(fd, &ev, sizeof(ev)) != sizeof(ev))
-    {
-      if (errno != EAGAIN)
-      {
-        const bool anyConnectedBefore = anySpotlightDeviceConnected();
-        connection.disable();
-        QTimer::singleShot(0, this, [this, devicePath=connection.path(), anyConnectedBefore](){
-          removeDeviceConnection(devicePath);
-          if (!anySpotlightDeviceConnected() && anyConnectedBefore) {
-            emit anySpotlightDeviceConnectedChanged(false);
-          }
-        });
-      }
-      break;
-    }
-    ++buf;
+  if (!connection || !connection->isConnected()) {
+    return false;
+  }
 
-    if (ev.type == EV_SYN)
-    {
-      // Check for relative events -> set Spotlight active
-      const auto &first_ev = buf[0];
-      const bool isMouseMoveEvent = first_ev.type == EV_REL
-                                    && (first_ev.code == REL_X || first_ev.code == REL_Y);
-      if (isMouseMoveEvent)
-      { // Skip input mapping for mouse move events completely
-        if (!m_activeTimer->isActive()) {
-          setSpotActive(true);
-        }
-        m_activeTimer->start();
-        if (m_virtualDevice) m_virtualDevice->emitEvents(buf.data(), buf.pos());
-      }
-      else
-      { // Forward events to input mapper for the device
-        connection.inputMapper()->addEvents(buf.data(), buf.pos());
-      }
-      buf.reset();
-    }
-    else if (buf.pos() >= buf.size())
-    { // No idea if this will ever happen, but log it to make sure we get notified.
-      logWarning(device) << tr("Discarded %1 input events without EV_SYN.").arg(buf.size());
-      connection.inputMapper()->resetState();
-      buf.reset();
+  return m_inputEngine->addConnection(std::move(connection));
+}
+
+// -------------------------------------------------------------------------------------------------
+bool Spotlight::setupHotplugMonitor()
+{
+  const auto monitor = HotplugMonitor::create(m_reactor, this);
+  if (!monitor) return false;
+
+  const auto isSubDevice = [](const UEvent& uevent) {
+    return (uevent.subsystem == "input" && uevent.devName.startsWith("input/event"))
+           || (uevent.subsystem == "hidraw" && uevent.devName.startsWith("hidraw"));
+  };
+
+  connect(monitor, &HotplugMonitor::deviceAdded, this, [this, isSubDevice](const UEvent& uevent) {
+    if (!isSubDevice(uevent)) return;
+    const auto& roots = m_options.scanRoots;
+    connectHotplugSubDevice(roots.sysfs + uevent.devPath, QDir(roots.dev).filePath(uevent.devName));
+  });
+
+  connect(monitor, &HotplugMonitor::deviceRemoved, this, [this, isSubDevice](const UEvent& uevent) {
+    m_scanCache.invalidate(uevent.devPath);
+    if (!isSubDevice(uevent)) return;
+    const bool anyConnectedBefore = anySpotlightDeviceConnected();
+    removeDeviceConnection(QDir(m_options.scanRoots.dev).filePath(uevent.devName));
+    if (!anySpotlightDeviceConnected() && anyConnectedBefore) {
+      emit anySpotlightDeviceConnectedChanged(false);
     }
+  });
 
-    if (!isNonBlocking) break;
-  } // end while loop
+  return true;
 }
 
 // -------------------------------------------------------------------------------------------------
-bool Spotlight::addInputEventHandler(std::shared_ptr<SubEventConnection> connection)
+void Spotlight::connectHotplugSubDevice(const QString& sysPath, const QString& deviceFile, int retry)
 {
-  if (!connection || connection->type() != ConnectionType::Event || !connection->isConnected()) {
-    return false;
-  }
+  // Only scan the device the new sub-device belongs to.
+  const auto dev = DeviceScan::getDevice(sysPath, m_options.additionalDevices, m_options.scanRoots);
+  if (dev.id.vendorId == 0) return; // not a supported device
 
-  QSocketNotifier* const notifier = connection->socketNotifier();
-  connect(notifier, &QSocketNotifier::activated, this,
-  [this, connection=std::move(connection)](int fd) {
-    onEventDataAvailable(fd, *connection.get());
+  const auto it = std::find_if(dev.subDevices.cbegin(), dev.subDevices.cend(),
+  [&deviceFile](const DeviceScan::SubDevice& sd) {
+    return sd.deviceFile == deviceFile;
   });
+  if (it == dev.subDevices.cend()) return;
 
-  return true;
+  if (!it->deviceReadable && retry < hotplugMaxRetries)
+  {
+    QTimer::singleShot(hotplugRetryInterval, this, [this, sysPath, deviceFile, retry]() {
+      connectHotplugSubDevice(sysPath, deviceFile, retry + 1);
+    });
+    return;
+  }
+
+  logDebug(device) << tr("Hotplug event for %1").arg(deviceFile);
+  connectSubDevices(dev, deviceFile);
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -303,7 +404,7 @@ bool Spotlight::setupDevEventInotify()
 {
   int fd = -1;
 #if defined(IN_CLOEXEC)
-  fd = inotify_init1(IN_CLOEXEC);
+  fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
 #endif
   if (fd == -1)
   {
@@ -314,40 +415,48 @@ bool Spotlight::setupDevEventInotify()
     }
   }
   fcntl(fd, F_SETFD, FD_CLOEXEC);
-  const int wd = inotify_add_watch(fd, "/dev/input", IN_CREATE | IN_DELETE);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  const QString inputDevPath = QDir(m_options.scanRoots.dev).filePath("input");
+  const int wd = inotify_add_watch(fd, inputDevPath.toLocal8Bit().constData(), IN_CREATE | IN_DELETE);
 
   if (wd < 0) {
-    logError(device) << tr("inotify_add_watch for /dev/input returned with failure.");
+    logError(device) << tr("inotify_add_watch for %1 returned with failure.").arg(inputDevPath);
+    ::close(fd);
     return false;
   }
 
-  const auto notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
-  connect(notifier, &QSocketNotifier::activated, this, [this](int fd)
+  // Edge-triggered, read until no more events are available.
+  const bool added = m_reactor->add(fd, [this, fd](uint32_t)
   {
-    int bytesAvaibable = 0;
-    if (ioctl(fd, FIONREAD, &bytesAvaibable) < 0 || bytesAvaibable <= 0) {
-      return; // Error or no bytes available
-    }
-    QVarLengthArray<char, 2048> buffer(bytesAvaibable);
-    const auto bytesRead = read(fd, buffer.data(), static_cast<size_t>(bytesAvaibable));
-    const char* at = buffer.data();
-    const char* const end = at + bytesRead;
-    while (at < end)
+    alignas(struct inotify_event) std::array<char, 4096> buffer;
+    while (true)
     {
-      const auto event = reinterpret_cast<const inotify_event*>(at);
+      const auto bytesRead = ::read(fd, buffer.data(), buffer.size());
+      if (bytesRead < 0 && errno == EINTR) continue;
+      if (bytesRead <= 0) break;
 
-      if ((event->mask & (IN_CREATE)) && QString(event->name).startsWith("event"))
+      const char* at = buffer.data();
+      const char* const end = at + bytesRead;
+      while (at < end)
       {
-        // Trigger new device scan and connect if a new event device was created.
-        m_connectionTimer->start();
-      }
+        const auto event = reinterpret_cast<const inotify_event*>(at);
+
+        if ((event->mask & (IN_CREATE)) && QString(event->name).startsWith("event"))
+        {
+          // Trigger new device scan and connect if a new event device was created.
+          m_connectionTimer->start();
+        }
 
-      at += sizeof(inotify_event) + event->len;
+        at += sizeof(inotify_event) + event->len;
+      }
     }
   });
 
-  connect(notifier, &QSocketNotifier::destroyed, [notifier]() {
-    ::close(static_cast<int>(notifier->socket()));
-  });
+  if (!added) {
+    ::close(fd);
+    return false;
+  }
+
+  m_inotifyFd = fd;
   return true;
 }
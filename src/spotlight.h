@@ -9,6 +9,9 @@
 
 #include "devicescan.h"
 
+struct Action;
+class EventLoopReactor;
+class InputEngine;
 class QTimer;
 class Settings;
 class VirtualDevice;
@@ -22,7 +25,11 @@ class Spotlight : public QObject
 public:
   struct Options {
     bool enableUInput = true; // enable virtual uinput device
+    bool splitUInput = false; // separate virtual pointer and keyboard devices
+    bool asyncUInput = false; // write to the virtual devices from a separate thread
+    QString recordFile; // record device input events to this file, if not empty
     std::vector<SupportedDevice> additionalDevices;
+    DeviceScan::Roots scanRoots; // sysfs and device node roots used for device scans
   };
 
   explicit Spotlight(QObject* parent, Options options, Settings* settings);
@@ -41,6 +48,10 @@ public:
   std::vector<ConnectedDeviceInfo> connectedDevices() const;
   std::shared_ptr<DeviceConnection> deviceConnection(const DeviceId& deviceId);
 
+  // Human readable input latency statistics of all connected devices.
+  QString latencyStatistics() const;
+  void resetLatencyStatistics();
+
 signals:
   void deviceConnected(const DeviceId& id, const QString& name);
   void deviceDisconnected(const DeviceId& id, const QString& name);
@@ -48,22 +59,29 @@ signals:
   void subDeviceDisconnected(const DeviceId& id, const QString& name, const QString& path);
   void anySpotlightDeviceConnectedChanged(bool connected);
   void spotActiveChanged(bool isActive);
+  void actionMapped(const DeviceId& id, std::shared_ptr<Action> action);
 
 private:
   enum class ConnectionResult { CouldNotOpen, NotASpotlightDevice, Connected };
   ConnectionResult connectSpotlightDevice(const QString& devicePath, bool verbose = false);
 
-  bool addInputEventHandler(std::shared_ptr<SubEventConnection> connection);
+  bool addInputEventHandler(std::shared_ptr<SubDeviceConnection> connection);
 
+  bool setupHotplugMonitor();
   bool setupDevEventInotify();
   int connectDevices();
+  // Connect event and hidraw sub-devices of a scanned device, only the given device file if not empty.
+  int connectSubDevices(const DeviceScan::Device& dev, const QString& deviceFile = QString());
+  void connectHotplugSubDevice(const QString& sysPath, const QString& deviceFile, int retry = 0);
   void removeDeviceConnection(const QString& devicePath);
-  void onEventDataAvailable(int fd, SubEventConnection& connection);
 
   const Options m_options;
   std::map<DeviceId, std::shared_ptr<DeviceConnection>> m_deviceConnections;
+  DeviceScan::ScanCache m_scanCache;
 
-  QTimer* m_activeTimer = nullptr;
+  InputEngine* m_inputEngine = nullptr;
+  EventLoopReactor* m_reactor = nullptr; // hotplug and inotify file descriptors
+  int m_inotifyFd = -1;
   QTimer* m_connectionTimer = nullptr;
   bool m_spotActive = false;
   std::shared_ptr<VirtualDevice> m_virtualDevice;
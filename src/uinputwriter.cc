@@ -0,0 +1,137 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "uinputwriter.h"
+
+#include "inputlatency.h"
+#include "logging.h"
+
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+DECLARE_LOGGING_CATEGORY(virtualdevice)
+
+// -------------------------------------------------------------------------------------------------
+UInputWriter::UInputWriter(int fd, LatencyHistogram& writeDuration, QObject* parent)
+  : QThread(parent)
+  , m_fd(fd)
+  , m_writeDuration(writeDuration)
+  , m_wakeupFd(eventfd(0, EFD_CLOEXEC))
+{
+  setObjectName("UInputWriter");
+}
+
+// -------------------------------------------------------------------------------------------------
+UInputWriter::~UInputWriter()
+{
+  stop();
+  if (m_wakeupFd >= 0) ::close(m_wakeupFd);
+}
+
+// -------------------------------------------------------------------------------------------------
+bool UInputWriter::reserve(size_t num)
+{
+  if (m_queue.writable() >= num) return true;
+
+  m_dropped.fetch_add(num, std::memory_order_relaxed);
+  return false;
+}
+
+// -------------------------------------------------------------------------------------------------
+void UInputWriter::publish()
+{
+  const size_t depth = m_queue.publish();
+  if (depth > m_maxQueueDepth.load(std::memory_order_relaxed)) {
+    m_maxQueueDepth.store(depth, std::memory_order_relaxed);
+  }
+
+  // Only wake up the writer thread if it is waiting, a burst of events costs one wakeup.
+  if (m_sleeping.exchange(false)) {
+    const uint64_t one = 1;
+    if (::write(m_wakeupFd, &one, sizeof(one)) < 0) {} // cannot fail before 2^64-1 wakeups
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+void UInputWriter::stop()
+{
+  if (!isRunning()) return;
+
+  m_stop = true;
+  const uint64_t one = 1;
+  if (::write(m_wakeupFd, &one, sizeof(one)) < 0) {}
+  wait();
+}
+
+// -------------------------------------------------------------------------------------------------
+UInputWriter::Statistics UInputWriter::statistics() const
+{
+  Statistics s;
+  s.queueDepth = m_queue.size();
+  s.maxQueueDepth = m_maxQueueDepth.load(std::memory_order_relaxed);
+  s.written = m_written.load(std::memory_order_relaxed);
+  s.dropped = m_dropped.load(std::memory_order_relaxed);
+  s.stalls = m_stalls.load(std::memory_order_relaxed);
+  s.errors = m_errors.load(std::memory_order_relaxed);
+  return s;
+}
+
+// -------------------------------------------------------------------------------------------------
+void UInputWriter::run()
+{
+  if (m_wakeupFd < 0) {
+    logError(virtualdevice) << tr("Cannot create wakeup event for the uinput writer (%1).").arg(errno);
+    return;
+  }
+
+  while (true)
+  {
+    const auto ranges = m_queue.readable();
+    const size_t num = ranges.first.size + ranges.second.size;
+    if (num)
+    { // Write everything that is queued at once.
+      write(ranges);
+      m_queue.pop(num);
+      continue;
+    }
+
+    if (m_stop) break;
+
+    // Announce the wait before checking the queue again, so a concurrent publish() either is
+    // seen here or wakes us up.
+    m_sleeping = true;
+    if (m_queue.size() == 0 && !m_stop)
+    {
+      uint64_t value = 0;
+      if (::read(m_wakeupFd, &value, sizeof(value)) < 0 && errno != EINTR) break;
+    }
+    m_sleeping = false;
+  }
+}
+
+// -------------------------------------------------------------------------------------------------
+void UInputWriter::write(const std::pair<Queue::Range, Queue::Range>& ranges)
+{
+  struct iovec iov[2] = {
+    { const_cast<input_event*>(ranges.first.data), sizeof(input_event) * ranges.first.size },
+    { const_cast<input_event*>(ranges.second.data), sizeof(input_event) * ranges.second.size },
+  };
+  const int count = ranges.second.size ? 2 : 1;
+  const auto sz = static_cast<ssize_t>(iov[0].iov_len + iov[1].iov_len);
+
+  const auto writeStart = monotonicTimeUsec();
+  const auto bytesWritten = writev(m_fd, iov, count);
+  const auto duration = monotonicTimeUsec() - writeStart;
+  m_writeDuration.record(duration);
+
+  if (duration > StallThresholdUsec) m_stalls.fetch_add(1, std::memory_order_relaxed);
+
+  if (bytesWritten != sz)
+  {
+    // Only log the first error, the error counter is part of the statistics.
+    if (m_errors.fetch_add(1, std::memory_order_relaxed) == 0) {
+      logError(virtualdevice) << tr("Error while writing to virtual device.");
+    }
+    return;
+  }
+  m_written.fetch_add(ranges.first.size + ranges.second.size, std::memory_order_relaxed);
+}
@@ -0,0 +1,131 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include <QThread>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+#include <linux/input.h>
+
+class LatencyHistogram;
+
+// -------------------------------------------------------------------------------------------------
+/// Lock-free ring buffer for exactly one producer and one consumer thread. The producer stages
+/// items and makes them visible to the consumer with publish(), so a group of items (e.g. all
+/// frames of one action) is consumed completely or not at all.
+template<typename T, size_t Capacity>
+class SpscRing
+{
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  static constexpr size_t capacity() { return Capacity; }
+
+  // --- Producer
+  size_t writable() const {
+    return Capacity - (m_pendingTail - m_head.load(std::memory_order_acquire));
+  }
+
+  // Copy items to the ring, the caller has to check writable() before.
+  void stage(const T* items, size_t num)
+  {
+    for (size_t i = 0; i < num; ++i) {
+      m_items[(m_pendingTail + i) & (Capacity - 1)] = items[i];
+    }
+    m_pendingTail += num;
+  }
+
+  // Make all staged items visible to the consumer, returns the number of published items.
+  size_t publish()
+  {
+    m_tail.store(m_pendingTail, std::memory_order_seq_cst);
+    return m_pendingTail - m_head.load(std::memory_order_relaxed);
+  }
+
+  // --- Consumer
+  struct Range { const T* data; size_t size; };
+
+  // Published items in up to two contiguous ranges (the second after a wrap around). The items
+  // stay valid until they are released with pop().
+  std::pair<Range, Range> readable() const
+  {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    const size_t size = m_tail.load(std::memory_order_acquire) - head;
+    const size_t first = head & (Capacity - 1);
+    const size_t firstSize = std::min(size, Capacity - first);
+    return { Range{ &m_items[first], firstSize }, Range{ &m_items[0], size - firstSize } };
+  }
+
+  void pop(size_t num) { m_head.fetch_add(num, std::memory_order_release); }
+
+  // Number of published items, exact only on the consumer thread.
+  size_t size() const {
+    return m_tail.load(std::memory_order_seq_cst) - m_head.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::array<T, Capacity> m_items;
+  alignas(64) std::atomic<size_t> m_head{0}; // written by the consumer
+  alignas(64) std::atomic<size_t> m_tail{0}; // written by the producer
+  size_t m_pendingTail = 0; // producer only
+};
+
+// -------------------------------------------------------------------------------------------------
+/// Thread writing input events to a uinput device. Producers never wait for the device: If the
+/// queue is full, the events are dropped. All events must be pushed from a single thread.
+class UInputWriter : public QThread
+{
+  Q_OBJECT
+
+public:
+  static constexpr size_t QueueCapacity = 1024; // input events
+  static constexpr int64_t StallThresholdUsec = 1000;
+
+  struct Statistics
+  {
+    size_t queueDepth = 0;    // events currently queued
+    size_t maxQueueDepth = 0; // high-water mark of queued events
+    uint64_t written = 0;     // events written to the device
+    uint64_t dropped = 0;     // events dropped because the queue was full
+    uint64_t stalls = 0;      // writes that took longer than StallThresholdUsec
+    uint64_t errors = 0;      // failed writes
+  };
+
+  // Write to the uinput device fd (not owned), write durations are recorded in writeDuration.
+  UInputWriter(int fd, LatencyHistogram& writeDuration, QObject* parent = nullptr);
+  ~UInputWriter() override;
+
+  // --- Producer thread
+  // Check for queue space for num events, they are counted as dropped if the queue is full.
+  bool reserve(size_t num);
+  // Queue events within the reserved space, they are written after publish().
+  void stage(const struct input_event events[], size_t num) { m_queue.stage(events, num); }
+  void publish();
+
+  void stop(); // Write all published events and stop the thread.
+  Statistics statistics() const;
+
+protected:
+  void run() override;
+
+private:
+  using Queue = SpscRing<struct input_event, QueueCapacity>;
+  void write(const std::pair<Queue::Range, Queue::Range>& ranges);
+
+  const int m_fd;
+  LatencyHistogram& m_writeDuration;
+  int m_wakeupFd = -1;
+  std::atomic<bool> m_stop{false};
+  std::atomic<bool> m_sleeping{false};
+  Queue m_queue;
+
+  std::atomic<size_t> m_maxQueueDepth{0};
+  std::atomic<uint64_t> m_written{0};
+  std::atomic<uint64_t> m_dropped{0};
+  std::atomic<uint64_t> m_stalls{0};
+  std::atomic<uint64_t> m_errors{0};
+};
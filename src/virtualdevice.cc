@@ -5,98 +5,285 @@
 
 #include <fcntl.h>
 #include <linux/uinput.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <utility>
+
 #include <QFileInfo>
 
 LOGGING_CATEGORY(virtualdevice, "virtualdevice")
 
 namespace  {
   class VirtualDevice_ : public QObject {}; // for i18n and logging
+
+  // Segments written with one writev() call; larger batches are split into several calls.
+  constexpr size_t maxIovecsPerWrite = 16;
+
+  // Key code ranges of keyboard keys, without the button ranges in between. The first range
+  // includes all codes of native key sequences, which are recorded from X11 key codes (<= 255).
+  constexpr std::pair<uint16_t, uint16_t> keyboardKeyRanges[] = {
+    { KEY_ESC, KEY_MICMUTE },
+#ifdef KEY_LIGHTS_TOGGLE // not available in older kernel headers
+    { KEY_OK, KEY_LIGHTS_TOGGLE },
+#endif
+  };
+
+  // Set the capability bits on a uinput file descriptor, only one ioctl per announced code.
+  bool setCapabilityBits(int fd, const VirtualDevice::Capabilities& capabilities)
+  {
+    bool ok = (ioctl(fd, UI_SET_EVBIT, EV_SYN) == 0);
+    if (capabilities.keys.any()) ok = ok && (ioctl(fd, UI_SET_EVBIT, EV_KEY) == 0);
+    if (capabilities.rels.any()) ok = ok && (ioctl(fd, UI_SET_EVBIT, EV_REL) == 0);
+
+    for (size_t i = 0; ok && i < capabilities.keys.size(); ++i) {
+      if (capabilities.keys.test(i)) ok = (ioctl(fd, UI_SET_KEYBIT, i) == 0);
+    }
+    for (size_t i = 0; ok && i < capabilities.rels.size(); ++i) {
+      if (capabilities.rels.test(i)) ok = (ioctl(fd, UI_SET_RELBIT, i) == 0);
+    }
+    return ok;
+  }
+
+  // Setup the device identity with UI_DEV_SETUP (Linux >= 4.5), or fall back to writing the
+  // legacy uinput_user_dev struct on older kernels.
+  bool setupDevice(int fd, const char* name, const struct input_id& id)
+  {
+#ifdef UI_DEV_SETUP
+    struct uinput_setup setup {};
+    snprintf(setup.name, sizeof(setup.name), "%s", name);
+    setup.id = id;
+    if (ioctl(fd, UI_DEV_SETUP, &setup) == 0) return true;
+    if (errno != EINVAL && errno != ENOTTY) return false;
+#endif
+
+    struct uinput_user_dev uinp {};
+    snprintf(uinp.name, sizeof(uinp.name), "%s", name);
+    uinp.id = id;
+    return write(fd, &uinp, sizeof(uinp)) == sizeof(uinp);
+  }
+
+  // Open and create a uinput device, returns the file descriptor or -1 on failure.
+  int createDevice(const VirtualDevice::Capabilities& capabilities, const char* name,
+                   const struct input_id& id, const char* location)
+  {
+    const QFileInfo fi(location);
+    if (!fi.exists()) {
+      logWarn(virtualdevice) << VirtualDevice_::tr("File not found: %1").arg(location);
+      logWarn(virtualdevice) << VirtualDevice_::tr("Please check if uinput kernel module is loaded");
+      return -1;
+    }
+
+    const int fd = ::open(location, O_WRONLY | O_NDELAY);
+    if (fd < 0) {
+      logWarn(virtualdevice) << VirtualDevice_::tr("Unable to open: %1").arg(location);
+      logWarn(virtualdevice) << VirtualDevice_::tr("Please check if current user has write access");
+      return -1;
+    }
+
+    // Setup the uinput device, only with the event codes of the requested capabilities
+    // and create the input device in the input sub-system.
+    if (!setCapabilityBits(fd, capabilities) || !setupDevice(fd, name, id) || ioctl(fd, UI_DEV_CREATE))
+    {
+      ::close(fd);
+      logWarn(virtualdevice) << VirtualDevice_::tr("Unable to create Virtual (UINPUT) device.");
+      return -1;
+    }
+
+    // Log the device name
+    char sysfs_device_name[16]{};
+    ioctl(fd, UI_GET_SYSNAME(sizeof(sysfs_device_name)), sysfs_device_name);
+    logInfo(virtualdevice) << VirtualDevice_::tr("Created uinput device: %1")
+                              .arg(QString("/sys/devices/virtual/input/%1").arg(sysfs_device_name));
+    return fd;
+  }
+
+  void destroyDevice(int fd)
+  {
+    if (fd < 0) return;
+    ioctl(fd, UI_DEV_DESTROY);
+    ::close(fd);
+    logDebug(virtualdevice) << VirtualDevice_::tr("uinput Device Closed");
+  }
+
+  // Relative motion and mouse buttons are routed to the pointer device of split devices.
+  bool isPointerEvent(const struct input_event& ie)
+  {
+    return ie.type == EV_REL || (ie.type == EV_KEY && ie.code >= BTN_MOUSE && ie.code < BTN_JOYSTICK);
+  }
+
+  struct input_id makeInputId(uint16_t vendorId, uint16_t productId, uint16_t versionId)
+  {
+    struct input_id id {};
+    id.bustype = BUS_USB;
+    id.vendor = vendorId;
+    id.product = productId;
+    id.version = versionId;
+    return id;
+  }
+}
+
+VirtualDevice::Capabilities VirtualDevice::Capabilities::fromProfile(Profile profile)
+{
+  Capabilities capabilities;
+
+  if (profile == Profile::Keyboard || profile == Profile::Combined)
+  {
+    for (const auto& range : keyboardKeyRanges) {
+      for (uint16_t code = range.first; code <= range.second; ++code) capabilities.addKey(code);
+    }
+  }
+
+  if (profile == Profile::Pointer || profile == Profile::Combined)
+  {
+    for (uint16_t code = BTN_LEFT; code <= BTN_TASK; ++code) capabilities.addKey(code);
+    for (const uint16_t code : { REL_X, REL_Y, REL_HWHEEL, REL_WHEEL }) capabilities.addRel(code);
+#ifdef REL_WHEEL_HI_RES
+    capabilities.addRel(REL_WHEEL_HI_RES);
+    capabilities.addRel(REL_HWHEEL_HI_RES);
+#endif
+  }
+
+  return capabilities;
+}
+
+InputEventBatch::InputEventBatch(size_t stagingCapacity, size_t segmentCapacity)
+{
+  m_staging.reserve(stagingCapacity);
+  m_segments.reserve(segmentCapacity);
+}
+
+void InputEventBatch::append(const struct input_event events[], size_t num)
+{
+  if (num == 0) return;
+  m_segments.push_back(Segment{events, 0, num});
+  m_eventCount += num;
+}
+
+void InputEventBatch::stage(uint16_t type, uint16_t code, int32_t value)
+{
+  m_staging.emplace_back(input_event{{}, type, code, value});
+  ++m_eventCount;
+
+  // Consecutive staged events share one segment
+  if (!m_segments.empty() && m_segments.back().events == nullptr
+      && m_segments.back().offset + m_segments.back().num == m_staging.size() - 1)
+  {
+    ++m_segments.back().num;
+    return;
+  }
+  m_segments.push_back(Segment{nullptr, m_staging.size() - 1, 1});
+}
+
+void InputEventBatch::clear()
+{
+  m_staging.resize(0);
+  m_segments.resize(0);
+  m_eventCount = 0;
 }
 
 struct VirtualDevice::Token {};
 
-VirtualDevice::VirtualDevice(Token, int fd)
+VirtualDevice::VirtualDevice(Token, int fd, int keyboardFd)
   : m_uinpFd(fd)
+  , m_keyboardFd(keyboardFd)
 {}
 
 VirtualDevice::~VirtualDevice()
 {
-  if (m_uinpFd >= 0)
-  {
-    ioctl(m_uinpFd, UI_DEV_DESTROY);
-    ::close(m_uinpFd);
-    logDebug(virtualdevice) << VirtualDevice_::tr("uinput Device Closed");
-  }
+  // Writers drain their queues before the devices are destroyed.
+  m_writer.reset();
+  m_keyboardWriter.reset();
+  destroyDevice(m_uinpFd);
+  destroyDevice(m_keyboardFd);
 }
 
 // Setup uinput device that can send mouse and keyboard events.
-std::shared_ptr<VirtualDevice> VirtualDevice::create(const char* name,
+std::shared_ptr<VirtualDevice> VirtualDevice::create(const Capabilities& capabilities,
+                                                     const char* name,
                                                      uint16_t virtualVendorId,
                                                      uint16_t virtualProductId,
                                                      uint16_t virtualVersionId,
                                                      const char* location)
 {
-  const QFileInfo fi(location);
-  if (!fi.exists()) {
-    logWarn(virtualdevice) << VirtualDevice_::tr("File not found: %1").arg(location);
-    logWarn(virtualdevice) << VirtualDevice_::tr("Please check if uinput kernel module is loaded");
-    return std::unique_ptr<VirtualDevice>();
-  }
+  const int fd = createDevice(capabilities, name,
+                              makeInputId(virtualVendorId, virtualProductId, virtualVersionId), location);
+  if (fd < 0) return std::unique_ptr<VirtualDevice>();
+
+  return std::make_shared<VirtualDevice>(Token{}, fd);
+}
+
+// Setup separate pointer and keyboard uinput devices.
+std::shared_ptr<VirtualDevice> VirtualDevice::createSplit(const Capabilities& pointerCapabilities,
+                                                          const Capabilities& keyboardCapabilities,
+                                                          const char* location)
+{
+  const int pointerFd = createDevice(pointerCapabilities, "Projecteur_pointer_device",
+                                     makeInputId(0xfeed, 0xc0de, 1), location);
+  if (pointerFd < 0) return std::unique_ptr<VirtualDevice>();
 
-  const int fd = ::open(location, O_WRONLY | O_NDELAY);
-  if (fd < 0) {
-    logWarn(virtualdevice) << VirtualDevice_::tr("Unable to open: %1").arg(location);
-    logWarn(virtualdevice) << VirtualDevice_::tr("Please check if current user has write access");
+  const int keyboardFd = createDevice(keyboardCapabilities, "Projecteur_keyboard_device",
+                                      makeInputId(0xfeed, 0xc0df, 1), location);
+  if (keyboardFd < 0) {
+    destroyDevice(pointerFd);
     return std::unique_ptr<VirtualDevice>();
   }
 
-  struct uinput_user_dev uinp {};
-  snprintf(uinp.name, sizeof(uinp.name), "%s", name);
-  uinp.id.bustype = BUS_USB;
-  uinp.id.vendor = virtualVendorId;
-  uinp.id.product = virtualProductId;
-  uinp.id.version = virtualVersionId;
-
-  // Setup the uinput device
-  // TODO Are the following Key and Event bits sufficient? Do we need more? (see all in Linux's input-event-codes.h)
-  ioctl(fd, UI_SET_EVBIT, EV_SYN);
-  ioctl(fd, UI_SET_EVBIT, EV_KEY);
-  ioctl(fd, UI_SET_EVBIT, EV_REL);
+  return std::make_shared<VirtualDevice>(Token{}, pointerFd, keyboardFd);
+}
 
-  // Set all rel event code bits on virtual device
-  for (int i = 0; i < REL_CNT; ++i) {
-    ioctl(fd, UI_SET_RELBIT, i);
-  }
+std::shared_ptr<VirtualDevice> VirtualDevice::createSink(int fd)
+{
+  if (fd < 0) return std::unique_ptr<VirtualDevice>();
+  return std::make_shared<VirtualDevice>(Token{}, fd);
+}
 
-  // Set all key code bits on virtual device
-  for (int i = 1; i < KEY_CNT; ++i) {
-    ioctl(fd, UI_SET_KEYBIT, i);
-  }
+void VirtualDevice::startAsyncWriting()
+{
+  if (m_writer) return;
 
-  // Create input device into input sub-system
-  const auto bytesWritten = write(fd, &uinp, sizeof(uinp));
-  if ((bytesWritten != sizeof(uinp)) || (ioctl(fd, UI_DEV_CREATE)))
+  m_writer = std::make_unique<UInputWriter>(m_uinpFd, m_writeDuration);
+  m_writer->start();
+  if (isSplit())
   {
-    ::close(fd);
-    logWarn(virtualdevice) << VirtualDevice_::tr("Unable to create Virtual (UINPUT) device.");
-    return std::unique_ptr<VirtualDevice>();
+    m_keyboardWriter = std::make_unique<UInputWriter>(m_keyboardFd, m_writeDuration);
+    m_keyboardWriter->start();
   }
+}
 
-  // Log the device name
-  char sysfs_device_name[16]{};
-  ioctl(fd, UI_GET_SYSNAME(sizeof(sysfs_device_name)), sysfs_device_name);
-  logInfo(virtualdevice) << VirtualDevice_::tr("Created uinput device: %1")
-                            .arg(QString("/sys/devices/virtual/input/%1").arg(sysfs_device_name));
-
-  return std::make_shared<VirtualDevice>(Token{}, fd);
+std::vector<UInputWriter::Statistics> VirtualDevice::writerStatistics() const
+{
+  std::vector<UInputWriter::Statistics> statistics;
+  if (m_writer) statistics.push_back(m_writer->statistics());
+  if (m_keyboardWriter) statistics.push_back(m_keyboardWriter->statistics());
+  return statistics;
 }
 
 void VirtualDevice::emitEvents(const struct input_event input_events[], size_t num)
 {
+  if (isSplit())
+  {
+    route(input_events, num);
+    flushRouted();
+    return;
+  }
+
+  if (m_writer)
+  {
+    if (num && m_writer->reserve(num)) {
+      m_writer->stage(input_events, num);
+      m_writer->publish();
+    }
+    return;
+  }
+
   if (const ssize_t sz = sizeof(input_event) * num) {
+    const auto writeStart = monotonicTimeUsec();
     const auto bytesWritten = write(m_uinpFd, input_events, sz);
+    m_writeDuration.record(monotonicTimeUsec() - writeStart);
     if (bytesWritten != sz) {
       logError(virtualdevice) << VirtualDevice_::tr("Error while writing to virtual device.");
     }
@@ -105,11 +292,116 @@ void VirtualDevice::emitEvents(const struct input_event input_events[], size_t n
 
 void VirtualDevice::emitEvents(const std::vector<struct input_event>& events)
 {
-  if (const ssize_t sz = sizeof(input_event) * events.size()) {
-    const auto bytesWritten = write(m_uinpFd, events.data(), sz);
+  emitEvents(events.data(), events.size());
+}
+
+void VirtualDevice::emitEvents(const InputEventBatch& batch)
+{
+  if (!isSplit())
+  {
+    writeBatch(m_uinpFd, batch);
+    return;
+  }
+
+  for (const auto& segment : batch.m_segments) {
+    route(batch.segmentData(segment), segment.num);
+  }
+  flushRouted();
+}
+
+void VirtualDevice::writeBatch(int fd, const InputEventBatch& batch)
+{
+  if (batch.empty()) return;
+
+  if (const auto writer = (fd == m_keyboardFd) ? m_keyboardWriter.get() : m_writer.get())
+  { // All events of the batch are queued, or none of them.
+    if (!writer->reserve(batch.eventCount())) return;
+    for (const auto& segment : batch.m_segments) {
+      writer->stage(batch.segmentData(segment), segment.num);
+    }
+    writer->publish();
+    return;
+  }
+
+  std::array<struct iovec, maxIovecsPerWrite> iov;
+  const auto& segments = batch.m_segments;
+  for (size_t first = 0; first < segments.size(); first += iov.size())
+  {
+    const size_t count = std::min(iov.size(), segments.size() - first);
+    ssize_t sz = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+      const auto& segment = segments[first + i];
+      iov[i].iov_base = const_cast<input_event*>(batch.segmentData(segment));
+      iov[i].iov_len = sizeof(input_event) * segment.num;
+      sz += static_cast<ssize_t>(iov[i].iov_len);
+    }
+
+    const auto writeStart = monotonicTimeUsec();
+    const auto bytesWritten = writev(fd, iov.data(), static_cast<int>(count));
+    m_writeDuration.record(monotonicTimeUsec() - writeStart);
     if (bytesWritten != sz) {
       logError(virtualdevice) << VirtualDevice_::tr("Error while writing to virtual device.");
+      return;
     }
   }
 }
 
+void VirtualDevice::route(const struct input_event input_events[], size_t num)
+{
+  size_t frameStart = 0;
+  for (size_t i = 0; i < num; ++i)
+  {
+    if (i + 1 < num && !(input_events[i].type == EV_SYN && input_events[i].code == SYN_REPORT)) continue;
+
+    const auto frame = input_events + frameStart;
+    const size_t frameSize = i + 1 - frameStart;
+    frameStart = i + 1;
+
+    size_t pointerEvents = 0;
+    size_t keyboardEvents = 0;
+    for (size_t j = 0; j < frameSize; ++j)
+    {
+      if (frame[j].type == EV_SYN || frame[j].type == EV_MSC) continue;
+      if (isPointerEvent(frame[j])) ++pointerEvents; else ++keyboardEvents;
+    }
+
+    // Frames are written in their original order across both devices: only one of the batches
+    // holds pending frames, it is flushed as soon as a frame for the other device follows.
+    if (keyboardEvents == 0)
+    {
+      flushBatch(m_keyboardFd, m_keyboardBatch);
+      m_pointerBatch.append(frame, frameSize);
+    }
+    else if (pointerEvents == 0)
+    {
+      flushBatch(m_uinpFd, m_pointerBatch);
+      m_keyboardBatch.append(frame, frameSize);
+    }
+    else
+    { // Mixed frame: split it and close both parts with their own syn event.
+      for (size_t j = 0; j < frameSize; ++j)
+      {
+        if (frame[j].type == EV_SYN) continue;
+        auto& batch = isPointerEvent(frame[j]) ? m_pointerBatch : m_keyboardBatch;
+        batch.stage(frame[j].type, frame[j].code, frame[j].value);
+      }
+      m_pointerBatch.stage(EV_SYN, SYN_REPORT, 0);
+      m_keyboardBatch.stage(EV_SYN, SYN_REPORT, 0);
+      flushRouted();
+    }
+  }
+}
+
+void VirtualDevice::flushBatch(int fd, InputEventBatch& batch)
+{
+  if (batch.empty()) return;
+  writeBatch(fd, batch);
+  batch.clear();
+}
+
+void VirtualDevice::flushRouted()
+{
+  flushBatch(m_uinpFd, m_pointerBatch);
+  flushBatch(m_keyboardFd, m_keyboardBatch);
+}
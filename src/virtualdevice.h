@@ -6,28 +6,128 @@
 
 # pragma once
 
+#include "inputlatency.h"
+#include "uinputwriter.h"
+
+#include <bitset>
 #include <cstdint>
 #include <memory>
 #include <vector>
 
+#include <linux/input.h>
+
+// Events of one action, collected and written to the virtual device with a single writev() call.
+// Frames from the caller are referenced, events built on the fly are copied to a preallocated
+// staging buffer. A batch is meant to be reused: clear() keeps the allocated memory.
+class InputEventBatch
+{
+public:
+  explicit InputEventBatch(size_t stagingCapacity = 32, size_t segmentCapacity = 8);
+
+  // Reference events, they must stay valid until the batch is emitted.
+  void append(const struct input_event events[], size_t num);
+  void append(const std::vector<struct input_event>& events) { append(events.data(), events.size()); }
+  // Copy an event to the staging buffer.
+  void stage(uint16_t type, uint16_t code, int32_t value);
+
+  bool empty() const { return m_eventCount == 0; }
+  size_t eventCount() const { return m_eventCount; }
+  size_t segmentCount() const { return m_segments.size(); }
+  void clear();
+
+private:
+  friend class VirtualDevice;
+
+  struct Segment {
+    const struct input_event* events; // nullptr: events are in the staging buffer at offset
+    size_t offset;
+    size_t num;
+  };
+
+  const struct input_event* segmentData(const Segment& s) const {
+    return s.events ? s.events : m_staging.data() + s.offset;
+  }
+
+  std::vector<struct input_event> m_staging;
+  std::vector<Segment> m_segments;
+  size_t m_eventCount = 0;
+};
+
 // Device that can act as virtual keyboard and mouse
 class VirtualDevice
 {
 private:
   struct Token;
-  int m_uinpFd = -1;
+  int m_uinpFd = -1; // pointer device if split
+  int m_keyboardFd = -1; // separate keyboard device, -1 if not split
+  LatencyHistogram m_writeDuration;
+  InputEventBatch m_pointerBatch; // frames routed to the devices if split
+  InputEventBatch m_keyboardBatch;
+  std::unique_ptr<UInputWriter> m_writer; // asynchronous writers, if enabled
+  std::unique_ptr<UInputWriter> m_keyboardWriter;
+
+  void writeBatch(int fd, const InputEventBatch& batch);
+  void flushBatch(int fd, InputEventBatch& batch);
+  void route(const struct input_event[], size_t num);
+  void flushRouted();
 
 public:
+  // Event codes announced by the virtual device. Events with codes that are not part of the
+  // capabilities are dropped by the kernel.
+  struct Capabilities
+  {
+    enum class Profile {
+      Keyboard, // keyboard keys
+      Pointer,  // mouse buttons, relative motion and wheels
+      Combined, // keyboard and pointer
+    };
+    static Capabilities fromProfile(Profile profile);
+
+    void addKey(uint16_t code) { if (code < keys.size()) keys.set(code); }
+    void addRel(uint16_t code) { if (code < rels.size()) rels.set(code); }
+    bool empty() const { return keys.none() && rels.none(); }
+
+    std::bitset<KEY_CNT> keys;
+    std::bitset<REL_CNT> rels;
+  };
+
   // Return a VirtualDevice shared_ptr or an empty shared_ptr if the creation fails.
-  static std::shared_ptr<VirtualDevice> create(const char* name = "Projecteur_input_device",
+  static std::shared_ptr<VirtualDevice> create(const Capabilities& capabilities,
+                                               const char* name = "Projecteur_input_device",
                                                uint16_t virtualVendorId = 0xfeed,
                                                uint16_t virtualProductId = 0xc0de,
                                                uint16_t virtualVersionId = 1,
                                                const char* location = "/dev/uinput");
 
-  explicit VirtualDevice(Token, int fd);
+  // Create separate pointer and keyboard devices. Frames with relative motion or mouse buttons
+  // are written to the pointer device, all others to the keyboard device.
+  static std::shared_ptr<VirtualDevice> createSplit(const Capabilities& pointerCapabilities,
+                                                    const Capabilities& keyboardCapabilities,
+                                                    const char* location = "/dev/uinput");
+
+  // Device writing to the given file descriptor (e.g. a pipe or memfd) instead of a uinput
+  // device, to capture emitted events in replays and benchmarks. Takes ownership of the fd.
+  static std::shared_ptr<VirtualDevice> createSink(int fd);
+
+  explicit VirtualDevice(Token, int fd, int keyboardFd = -1);
   ~VirtualDevice();
 
+  bool isSplit() const { return m_keyboardFd >= 0; }
+
+  // Write events from a separate thread per device: emitEvents() only queues the events and
+  // never blocks, events are dropped if a queue is full.
+  void startAsyncWriting();
+  bool isAsync() const { return !!m_writer; }
+  // Statistics of the asynchronous writers, the keyboard device is the second one if split.
+  std::vector<UInputWriter::Statistics> writerStatistics() const;
+
+  // Events must be emitted from a single thread, split devices route frames via staging buffers.
   void emitEvents(const struct input_event[], size_t num);
   void emitEvents(const std::vector<struct input_event>& events);
+  // Write all events of the batch with a single system call.
+  void emitEvents(const InputEventBatch& batch);
+
+  // Time spent in write calls to the uinput device.
+  const LatencyHistogram& writeDuration() const { return m_writeDuration; }
+  void resetWriteDuration() { m_writeDuration.reset(); }
 };
@@ -0,0 +1,124 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+
+// Feeding input events to a configured DeviceKeyMap runs for every device frame on the input
+// engine thread and must not allocate. The global operator new/delete are replaced to count the
+// allocations between configuration and the end of the feed calls.
+
+#include "devicekeymap.h"
+
+#include <QtTest>
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <linux/input.h>
+
+namespace {
+  std::atomic<uint64_t> allocations{0};
+
+  // -----------------------------------------------------------------------------------------------
+  void* allocate(std::size_t size)
+  {
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+  }
+} // --- end anonymous namespace
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  ++allocations;
+  return std::malloc(size ? size : 1);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  ++allocations;
+  return std::malloc(size ? size : 1);
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+  // -----------------------------------------------------------------------------------------------
+  KeyEvent keyEvent(uint16_t code, int32_t value) {
+    return KeyEvent{ DeviceInputEvent(EV_MSC, MSC_SCAN, code), DeviceInputEvent(EV_KEY, code, value) };
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  std::vector<input_event> frame(const KeyEvent& ke)
+  {
+    std::vector<input_event> events(ke.size());
+    for (size_t i = 0; i < ke.size(); ++i)
+    {
+      events[i].type = ke[i].type;
+      events[i].code = ke[i].code;
+      events[i].value = ke[i].value;
+    }
+    return events;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  MappedAction keySequenceAction() {
+    return MappedAction{ std::make_shared<KeySequenceAction>(NativeKeySequence::predefined::altTab()) };
+  }
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+class DeviceKeyMapAllocTest : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void feedDoesNotAllocate();
+};
+
+// -------------------------------------------------------------------------------------------------
+void DeviceKeyMapAllocTest::feedDoesNotAllocate()
+{
+  // Sequences with shared prefixes, so feeding yields Miss, Valid, Hit and PartialHit results.
+  InputMapConfig config;
+  config.emplace(KeyEventSequence{ keyEvent(KEY_A, 1), keyEvent(KEY_A, 0) }, keySequenceAction());
+  config.emplace(KeyEventSequence{ keyEvent(KEY_A, 1), keyEvent(KEY_A, 0),
+                                   keyEvent(KEY_A, 1), keyEvent(KEY_A, 0) }, keySequenceAction());
+  config.emplace(KeyEventSequence{ keyEvent(KEY_B, 1), keyEvent(KEY_C, 1) }, keySequenceAction());
+  config.emplace(KeyEventSequence{ KeyEvent{ DeviceInputEvent(EV_KEY, BTN_LEFT, 1) } },
+                 keySequenceAction());
+
+  DeviceKeyMap keymap;
+  keymap.reconfigure(config);
+  QVERIFY(keymap.hasConfig());
+
+  const std::vector<std::vector<input_event>> frames = {
+    frame(keyEvent(KEY_A, 1)), frame(keyEvent(KEY_A, 0)), frame(keyEvent(KEY_A, 1)),
+    frame(keyEvent(KEY_A, 0)), frame(keyEvent(KEY_B, 1)), frame(keyEvent(KEY_C, 1)),
+    frame(keyEvent(KEY_D, 1)), frame(KeyEvent{ DeviceInputEvent(EV_KEY, BTN_LEFT, 1) }),
+    frame(KeyEvent{ DeviceInputEvent(EV_REL, REL_X, 3), DeviceInputEvent(EV_REL, REL_Y, -2) }),
+  };
+  std::array<uint64_t, 4> results = {};
+
+  const uint64_t before = allocations.load();
+  for (int round = 0; round < 1000; ++round)
+  {
+    for (const auto& f : frames)
+    {
+      const auto result = keymap.feed(f.data(), f.size());
+      ++results[result];
+      if (result == DeviceKeyMap::Result::Miss || result == DeviceKeyMap::Result::Hit) {
+        keymap.resetState();
+      }
+    }
+  }
+  const uint64_t after = allocations.load();
+
+  QCOMPARE(after - before, uint64_t(0));
+  for (const auto count : results) {
+    QVERIFY(count > 0);
+  }
+}
+
+QTEST_GUILESS_MAIN(DeviceKeyMapAllocTest)
+#include "devicekeymap-alloc-test.moc"
@@ -0,0 +1,157 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+
+// Compares the results of DeviceKeyMap with the previous std::map based implementation
+// (ReferenceKeyMap) for randomly generated configurations and input event streams.
+
+#include "devicekeymap.h"
+#include "referencekeymap.h"
+
+#include <QtTest>
+
+#include <array>
+#include <random>
+
+#include <linux/input.h>
+
+namespace {
+  constexpr uint32_t seed = 20201018;
+  constexpr int configCount = 300;
+  constexpr int framesPerConfig = 2000;
+
+  // -----------------------------------------------------------------------------------------------
+  // Small alphabet of device frames, so that random sequences share prefixes and random input
+  // streams hit the configured sequences often.
+  std::vector<KeyEvent> frameAlphabet()
+  {
+    std::vector<KeyEvent> frames;
+    for (const uint16_t code : { KEY_A, KEY_B, KEY_C, KEY_NEXT })
+    {
+      for (const int32_t value : { 1, 0 })
+      {
+        frames.emplace_back(KeyEvent{ DeviceInputEvent(EV_MSC, MSC_SCAN, code),
+                                      DeviceInputEvent(EV_KEY, code, value) });
+      }
+    }
+    frames.emplace_back(KeyEvent{ DeviceInputEvent(EV_KEY, BTN_LEFT, 1) });
+    frames.emplace_back(KeyEvent{ DeviceInputEvent(EV_KEY, BTN_LEFT, 0) });
+    frames.emplace_back(KeyEvent{ DeviceInputEvent(EV_REL, REL_X, 1), DeviceInputEvent(EV_REL, REL_Y, 1) });
+    return frames;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  std::vector<input_event> toInputEvents(const KeyEvent& ke)
+  {
+    std::vector<input_event> events(ke.size());
+    for (size_t i = 0; i < ke.size(); ++i)
+    {
+      events[i].type = ke[i].type;
+      events[i].code = ke[i].code;
+      events[i].value = ke[i].value;
+    }
+    return events;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  InputMapConfig randomConfig(std::mt19937& rng, const std::vector<KeyEvent>& alphabet)
+  {
+    std::uniform_int_distribution<int> sequenceCount(0, 12);
+    std::uniform_int_distribution<size_t> sequenceLength(1, 4);
+    std::uniform_int_distribution<size_t> frame(0, alphabet.size() - 1);
+    std::uniform_int_distribution<int> actionKind(0, 9);
+
+    InputMapConfig config;
+    for (int i = sequenceCount(rng); i > 0; --i)
+    {
+      KeyEventSequence kes;
+      for (size_t n = sequenceLength(rng); n > 0; --n) {
+        kes.push_back(alphabet[frame(rng)]);
+      }
+
+      // Mostly valid actions, but also no action and empty actions, which must be ignored.
+      MappedAction mapped;
+      const int kind = actionKind(rng);
+      if (kind == 0) {
+        mapped.action = std::make_shared<KeySequenceAction>();
+      }
+      else if (kind == 1) {
+        mapped.action = std::make_shared<ToggleSpotlightAction>();
+      }
+      else if (kind != 2) {
+        mapped.action = std::make_shared<KeySequenceAction>(NativeKeySequence::predefined::altTab());
+      }
+      config[kes] = mapped;
+    }
+    return config;
+  }
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+class DeviceKeyMapTest : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void matchesReferenceImplementation();
+};
+
+// -------------------------------------------------------------------------------------------------
+void DeviceKeyMapTest::matchesReferenceImplementation()
+{
+  const auto alphabet = frameAlphabet();
+  std::vector<std::vector<input_event>> frames;
+  for (const auto& ke : alphabet) frames.emplace_back(toInputEvents(ke));
+  // A frame that is never part of a configuration.
+  frames.emplace_back(toInputEvents(KeyEvent{ DeviceInputEvent(EV_MSC, MSC_SCAN, KEY_Z),
+                                              DeviceInputEvent(EV_KEY, KEY_Z, 1) }));
+
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<size_t> frame(0, frames.size() - 1);
+  std::uniform_int_distribution<int> reset(0, 49);
+
+  DeviceKeyMap keymap;
+  ReferenceKeyMap reference;
+  std::array<uint64_t, 4> results = {};
+
+  for (int c = 0; c < configCount; ++c)
+  {
+    const auto config = randomConfig(rng, alphabet);
+    keymap.reconfigure(config);
+    reference.reconfigure(config);
+    QCOMPARE(keymap.hasConfig(), reference.hasConfig());
+
+    for (int i = 0; i < framesPerConfig; ++i)
+    {
+      const auto& f = frames[frame(rng)];
+      const auto result = keymap.feed(f.data(), f.size());
+      const auto expected = reference.feed(f.data(), f.size());
+      QVERIFY2(result == expected,
+               qPrintable(QString("config %1, frame %2: result %3, expected %4 (seed %5)")
+                          .arg(c).arg(i).arg(result).arg(expected).arg(seed)));
+      ++results[result];
+
+      if (result == DeviceKeyMap::Result::Hit || result == DeviceKeyMap::Result::PartialHit)
+      {
+        const Action* action = keymap.state() ? keymap.state()->action.get() : nullptr;
+        QVERIFY2(action == reference.action(),
+                 qPrintable(QString("config %1, frame %2: different action (seed %3)")
+                            .arg(c).arg(i).arg(seed)));
+      }
+
+      // Reset like the InputMapper does after a Miss or Hit, and sometimes after a timeout.
+      if (result == DeviceKeyMap::Result::Miss || result == DeviceKeyMap::Result::Hit
+          || reset(rng) == 0)
+      {
+        keymap.resetState();
+        reference.resetState();
+      }
+    }
+  }
+
+  // Make sure the generated input covered all results.
+  for (const auto count : results) {
+    QVERIFY(count > 0);
+  }
+}
+
+QTEST_GUILESS_MAIN(DeviceKeyMapTest)
+#include "devicekeymap-test.moc"
@@ -0,0 +1,191 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+
+// Tests the HID++ sub-device connection: The controls are diverted once the REPROG_CONTROLS_V4
+// feature index is known and divertedButtonsEvent reports are decoded to key event frames, that
+// are passed to the InputMapper like the InputEngine does. The controls are restored when the
+// connection is closed. The device is a socketpair.
+
+#include "device.h"
+#include "deviceinput.h"
+#include "hidpp.h"
+#include "virtualdevice.h"
+
+#include <QtTest>
+
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/input.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+  constexpr uint8_t reprogFeatureIndex = 0x09;
+  constexpr uint16_t nextControlId = 0x00da;
+  constexpr uint16_t backControlId = 0x00dc;
+
+  // -----------------------------------------------------------------------------------------------
+  KeyEvent keyEvent(int32_t scanCode, uint16_t code, int32_t value) {
+    return KeyEvent{ DeviceInputEvent(EV_MSC, MSC_SCAN, scanCode), DeviceInputEvent(EV_KEY, code, value) };
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Response of the device to the getFeature request for the REPROG_CONTROLS_V4 feature.
+  HIDPP::LongReport getFeatureResponse(uint8_t deviceIndex)
+  {
+    HIDPP::LongReport report{};
+    report[0] = static_cast<uint8_t>(HIDPP::ReportType::Long);
+    report[1] = deviceIndex;
+    report[2] = HIDPP::RootFeatureIndex;
+    report[3] = HIDPP::SoftwareId;
+    report[4] = reprogFeatureIndex;
+    return report;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // divertedButtonsEvent notification with the controls currently held down.
+  HIDPP::LongReport divertedButtonsReport(uint8_t deviceIndex, std::vector<uint16_t> controlIds)
+  {
+    HIDPP::LongReport report{};
+    report[0] = static_cast<uint8_t>(HIDPP::ReportType::Long);
+    report[1] = deviceIndex;
+    report[2] = reprogFeatureIndex;
+    report[3] = 0x00;
+    for (size_t i = 0; i < controlIds.size(); ++i) {
+      report[4 + i * 2] = static_cast<uint8_t>(controlIds[i] >> 8);
+      report[5 + i * 2] = static_cast<uint8_t>(controlIds[i] & 0xff);
+    }
+    return report;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Decode the report and pass the key event frames to the input mapper, like the InputEngine.
+  size_t feed(SubHidrawConnection& connection, const HIDPP::LongReport& report, size_t& events)
+  {
+    connection.inputBuffer().reset();
+    events = connection.decodeReport(report.data(), report.size(), 0);
+    return connection.inputMapper()->addFrames(connection.inputBuffer().data(), events);
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Next report sent to the device, empty if there is none.
+  std::vector<uint8_t> receiveRequest(int fd)
+  {
+    std::vector<uint8_t> request(HIDPP::MaxReportSize);
+    const ssize_t size = ::recv(fd, request.data(), request.size(), 0);
+    request.resize(size > 0 ? static_cast<size_t>(size) : 0);
+    return request;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  template<typename Report>
+  std::vector<uint8_t> toVector(const Report& report) {
+    return std::vector<uint8_t>(report.cbegin(), report.cend());
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  QStringList readEvents(int fd)
+  {
+    QStringList list;
+    struct input_event ev;
+    while (::read(fd, &ev, sizeof(ev)) == sizeof(ev)) {
+      list.push_back(QString("%1:%2:%3").arg(ev.type).arg(ev.code).arg(ev.value));
+    }
+    return list;
+  }
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+class HidrawTest : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void divertedButtonsAreMappedFrameByFrame();
+};
+
+// -------------------------------------------------------------------------------------------------
+void HidrawTest::divertedButtonsAreMappedFrameByFrame()
+{
+  int deviceFds[2];
+  QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, deviceFds), 0);
+  int sinkFds[2];
+  QCOMPARE(::pipe2(sinkFds, O_NONBLOCK | O_CLOEXEC), 0);
+
+  const uint8_t deviceIndex = HIDPP::DirectDeviceIndex;
+  DeviceConnection dc(DeviceId{ 0x046d, 0xb503, "test" }, "Spotlight",
+                      VirtualDevice::createSink(sinkFds[1]));
+
+  // Next press and release is mapped, Back is not and must be forwarded.
+  const auto& next = *HIDPP::findControl(nextControlId);
+  const auto& back = *HIDPP::findControl(backControlId);
+  InputMapConfig config;
+  config.emplace(KeyEventSequence{ keyEvent(next.scanCode, next.keyCode, 1),
+                                   keyEvent(next.scanCode, next.keyCode, 0) },
+                 MappedAction{ std::make_shared<ToggleSpotlightAction>() });
+  dc.inputMapper()->setVirtualTime(true);
+  dc.inputMapper()->setConfiguration(config);
+
+  int actions = 0;
+  connect(dc.inputMapper().get(), &InputMapper::actionMapped, this,
+          [&actions](std::shared_ptr<Action> action) {
+            if (action && action->type() == Action::Type::ToggleSpotlight) ++actions;
+          });
+
+  auto connection = SubHidrawConnection::create(deviceFds[0], deviceIndex, "/dev/hidraw-test", dc);
+  QVERIFY(connection && connection->isConnected());
+  QCOMPARE(receiveRequest(deviceFds[1]),
+           toVector(HIDPP::getFeatureRequest(deviceIndex, HIDPP::ReprogControlsV4Feature)));
+
+  // The controls are diverted with the feature index from the response.
+  size_t events = 0;
+  QCOMPARE(feed(*connection, getFeatureResponse(deviceIndex), events), size_t(0));
+  for (const auto& control : HIDPP::divertedControls()) {
+    QCOMPARE(receiveRequest(deviceFds[1]),
+             toVector(HIDPP::setCidReportingRequest(deviceIndex, reprogFeatureIndex,
+                                                    control.controlId, true)));
+  }
+
+  // Notifications for other devices are ignored.
+  QCOMPARE(feed(*connection, divertedButtonsReport(0x02, { nextControlId }), events), size_t(0));
+  QCOMPARE(events, size_t(0));
+
+  QCOMPARE(feed(*connection, divertedButtonsReport(deviceIndex, { nextControlId }), events), size_t(1));
+  QCOMPARE(events, size_t(3));
+  QCOMPARE(actions, 0);
+
+  // Next released and Back pressed with a single report
+  QCOMPARE(feed(*connection, divertedButtonsReport(deviceIndex, { backControlId }), events), size_t(2));
+  QCOMPARE(events, size_t(6));
+  QCOMPARE(actions, 1);
+
+  QCOMPARE(feed(*connection, divertedButtonsReport(deviceIndex, {}), events), size_t(1));
+  QCOMPARE(actions, 1);
+
+  const QStringList expected = {
+    QString("%1:%2:%3").arg(EV_MSC).arg(MSC_SCAN).arg(back.scanCode),
+    QString("%1:%2:%3").arg(EV_KEY).arg(back.keyCode).arg(1),
+    QString("%1:%2:%3").arg(EV_SYN).arg(SYN_REPORT).arg(0),
+    QString("%1:%2:%3").arg(EV_MSC).arg(MSC_SCAN).arg(back.scanCode),
+    QString("%1:%2:%3").arg(EV_KEY).arg(back.keyCode).arg(0),
+    QString("%1:%2:%3").arg(EV_SYN).arg(SYN_REPORT).arg(0),
+  };
+  QCOMPARE(readEvents(sinkFds[0]), expected);
+
+  // The controls are restored before the device is closed.
+  connection->disconnect();
+  QVERIFY(!connection->isConnected());
+  for (const auto& control : HIDPP::divertedControls()) {
+    QCOMPARE(receiveRequest(deviceFds[1]),
+             toVector(HIDPP::setCidReportingRequest(deviceIndex, reprogFeatureIndex,
+                                                    control.controlId, false)));
+  }
+
+  connection.reset();
+  QVERIFY(receiveRequest(deviceFds[1]).empty());
+  ::close(deviceFds[1]);
+  ::close(sinkFds[0]);
+}
+
+QTEST_GUILESS_MAIN(HidrawTest)
+#include "hidraw-test.moc"
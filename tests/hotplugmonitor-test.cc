@@ -0,0 +1,247 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+
+// Tests the parsing of kernel and udev uevent messages and the filtering of the HotplugMonitor.
+// Messages are crafted in the respective wire format and injected via a socketpair.
+
+#include "hotplugmonitor.h"
+#include "logging.h"
+#include "reactor.h"
+
+#include <QtTest>
+
+#include <cstring>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+LOGGING_CATEGORY(device, "device")
+
+namespace {
+  // -----------------------------------------------------------------------------------------------
+  // Properties as '\0' separated KEY=VALUE pairs.
+  QByteArray properties(const QList<QByteArray>& keyValues)
+  {
+    QByteArray data;
+    for (const auto& keyValue : keyValues) {
+      data.append(keyValue).append('\0');
+    }
+    return data;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Kernel format: 'action@devpath' followed by the properties.
+  QByteArray kernelMessage(const QByteArray& action, const QByteArray& devPath,
+                           const QByteArray& subsystem, const QByteArray& devName)
+  {
+    QByteArray data = action + '@' + devPath;
+    data.append('\0');
+    QList<QByteArray> keyValues = { "ACTION=" + action, "DEVPATH=" + devPath,
+                                    "SUBSYSTEM=" + subsystem, "SEQNUM=4711" };
+    if (!devName.isEmpty()) keyValues.append("DEVNAME=" + devName);
+    return data + properties(keyValues);
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Udev format: libudev header (see libudev-monitor.c) followed by the properties.
+  QByteArray udevMessage(const QByteArray& action, const QByteArray& devPath,
+                         const QByteArray& subsystem, const QByteArray& devName,
+                         uint32_t magic = 0xfeedcafe)
+  {
+    struct {
+      char prefix[8];
+      uint32_t magic;
+      uint32_t headerSize;
+      uint32_t propertiesOffset;
+      uint32_t propertiesLength;
+      uint32_t filterSubsystemHash;
+      uint32_t filterDevtypeHash;
+      uint32_t filterTagBloomHi;
+      uint32_t filterTagBloomLo;
+    } header{};
+
+    const QByteArray props = properties({ "ACTION=" + action, "DEVPATH=" + devPath,
+                                          "SUBSYSTEM=" + subsystem, "DEVNAME=" + devName,
+                                          "ID_INPUT=1" });
+    std::memcpy(header.prefix, "libudev", 8);
+    header.magic = htonl(magic);
+    header.headerSize = sizeof(header);
+    header.propertiesOffset = sizeof(header);
+    header.propertiesLength = static_cast<uint32_t>(props.size());
+    return QByteArray(reinterpret_cast<const char*>(&header), sizeof(header)) + props;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  bool parse(const QByteArray& data, UEvent& uevent)
+  {
+    return UEvent::parse(data.constData(), static_cast<size_t>(data.size()), uevent);
+  }
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+class HotplugMonitorTest : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void parseKernelMessage();
+  void parseUdevMessage();
+  void rejectInvalidMessages();
+  void monitorFiltersSubsystemsAndActions();
+  void trustedKernelSender();
+  void trustedUdevSender();
+};
+
+// -------------------------------------------------------------------------------------------------
+void HotplugMonitorTest::parseKernelMessage()
+{
+  UEvent uevent;
+  QVERIFY(parse(kernelMessage("add", "/devices/virtual/input/input7/event5", "input", "input/event5"),
+                uevent));
+  QCOMPARE(uevent.action, UEvent::Action::Add);
+  QCOMPARE(uevent.devPath, QString("/devices/virtual/input/input7/event5"));
+  QCOMPARE(uevent.subsystem, QString("input"));
+  QCOMPARE(uevent.devName, QString("input/event5"));
+
+  // Messages without a device node
+  QVERIFY(parse(kernelMessage("remove", "/devices/pci0000:00/0003:046D:C53E.0001", "hid", ""), uevent));
+  QCOMPARE(uevent.action, UEvent::Action::Remove);
+  QCOMPARE(uevent.subsystem, QString("hid"));
+  QVERIFY(uevent.devName.isEmpty());
+}
+
+// -------------------------------------------------------------------------------------------------
+void HotplugMonitorTest::parseUdevMessage()
+{
+  UEvent uevent;
+  QVERIFY(parse(udevMessage("remove", "/devices/virtual/hidraw/hidraw3", "hidraw", "hidraw3"), uevent));
+  QCOMPARE(uevent.action, UEvent::Action::Remove);
+  QCOMPARE(uevent.devPath, QString("/devices/virtual/hidraw/hidraw3"));
+  QCOMPARE(uevent.subsystem, QString("hidraw"));
+  QCOMPARE(uevent.devName, QString("hidraw3"));
+
+  QVERIFY(parse(udevMessage("bind", "/devices/virtual/hid/0003:046D:C53E.0001", "hid", ""), uevent));
+  QCOMPARE(uevent.action, UEvent::Action::Bind);
+}
+
+// -------------------------------------------------------------------------------------------------
+void HotplugMonitorTest::rejectInvalidMessages()
+{
+  UEvent uevent;
+  // Wrong udev magic
+  QVERIFY(!parse(udevMessage("add", "/devices/x", "input", "input/event1", 0xcafefeed), uevent));
+
+  // Properties exceeding the message
+  QByteArray truncated = udevMessage("add", "/devices/x", "input", "input/event1");
+  truncated.chop(4);
+  QVERIFY(!parse(truncated, uevent));
+
+  // Kernel header without '@'
+  QVERIFY(!parse(properties({ "add/devices/x", "ACTION=add", "DEVPATH=/devices/x" }), uevent));
+
+  // Unknown action, missing device path
+  QVERIFY(!parse(kernelMessage("move", "/devices/x", "input", "input/event1"), uevent));
+  QVERIFY(!parse(properties({ "add@/devices/x", "ACTION=add", "SUBSYSTEM=input" }), uevent));
+
+  // Empty and garbage messages
+  QVERIFY(!parse(QByteArray(), uevent));
+  QVERIFY(!parse(QByteArray("libudev"), uevent));
+}
+
+// -------------------------------------------------------------------------------------------------
+void HotplugMonitorTest::monitorFiltersSubsystemsAndActions()
+{
+  int fds[2];
+  QCOMPARE(::socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds), 0);
+
+  EventLoopReactor reactor;
+  QVERIFY(reactor.isValid());
+  HotplugMonitor monitor(fds[0], HotplugMonitor::Source::Udev, &reactor);
+
+  std::vector<UEvent> added;
+  std::vector<UEvent> removed;
+  connect(&monitor, &HotplugMonitor::deviceAdded, this, [&added](const UEvent& e){ added.push_back(e); });
+  connect(&monitor, &HotplugMonitor::deviceRemoved, this, [&removed](const UEvent& e){ removed.push_back(e); });
+
+  const QList<QByteArray> messages = {
+    udevMessage("add", "/devices/usb1/1-1", "usb", "bus/usb/001/002"),          // not monitored
+    udevMessage("change", "/devices/virtual/input/input7", "input", ""),        // not add/remove
+    QByteArray("garbage"),
+    udevMessage("add", "/devices/virtual/input/input7/event5", "input", "input/event5"),
+    kernelMessage("remove", "/devices/virtual/hidraw/hidraw3", "hidraw", "hidraw3"),
+  };
+  for (const auto& message : messages) {
+    QCOMPARE(::send(fds[1], message.constData(), static_cast<size_t>(message.size()), 0),
+             static_cast<ssize_t>(message.size()));
+  }
+
+  QTRY_COMPARE(added.size() + removed.size(), size_t(2));
+  QCOMPARE(added.front().devName, QString("input/event5"));
+  QCOMPARE(removed.front().devName, QString("hidraw3"));
+
+  ::close(fds[1]);
+}
+
+// -------------------------------------------------------------------------------------------------
+void HotplugMonitorTest::trustedKernelSender()
+{
+  struct sockaddr_nl addr{};
+  addr.nl_family = AF_NETLINK;
+  struct msghdr msg{};
+  msg.msg_name = &addr;
+  msg.msg_namelen = sizeof(addr);
+
+  addr.nl_pid = 0;
+  QVERIFY(HotplugMonitor::isTrustedSender(msg, HotplugMonitor::Source::Kernel));
+
+  // Messages from user space processes to the kernel group
+  addr.nl_pid = 4711;
+  QVERIFY(!HotplugMonitor::isTrustedSender(msg, HotplugMonitor::Source::Kernel));
+
+  addr.nl_pid = 0;
+  msg.msg_namelen = 0;
+  QVERIFY(!HotplugMonitor::isTrustedSender(msg, HotplugMonitor::Source::Kernel));
+
+  msg.msg_namelen = sizeof(addr);
+  addr.nl_family = AF_UNIX;
+  QVERIFY(!HotplugMonitor::isTrustedSender(msg, HotplugMonitor::Source::Kernel));
+}
+
+// -------------------------------------------------------------------------------------------------
+void HotplugMonitorTest::trustedUdevSender()
+{
+  struct sockaddr_nl addr{};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_pid = 4711;
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(struct ucred))]{};
+  struct msghdr msg{};
+  msg.msg_name = &addr;
+  msg.msg_namelen = sizeof(addr);
+
+  // No credentials
+  QVERIFY(!HotplugMonitor::isTrustedSender(msg, HotplugMonitor::Source::Udev));
+
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  const auto cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_CREDENTIALS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+
+  const auto setUid = [cmsg](uid_t uid) {
+    struct ucred cred{ 4711, uid, 0 };
+    std::memcpy(CMSG_DATA(cmsg), &cred, sizeof(cred));
+  };
+
+  setUid(0);
+  QVERIFY(HotplugMonitor::isTrustedSender(msg, HotplugMonitor::Source::Udev));
+
+  // Messages from unprivileged processes to the udev group
+  setUid(1000);
+  QVERIFY(!HotplugMonitor::isTrustedSender(msg, HotplugMonitor::Source::Udev));
+}
+
+QTEST_GUILESS_MAIN(HotplugMonitorTest)
+#include "hotplugmonitor-test.moc"
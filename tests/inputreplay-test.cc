@@ -0,0 +1,164 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+
+// Regression test for the input mapping: Device frames are recorded to a file and replayed through
+// the InputMapper in virtual time, the events written to the virtual device must match exactly.
+
+#include "deviceinput.h"
+#include "inputrecording.h"
+
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include <linux/input.h>
+
+namespace {
+  constexpr int keyEventInterval = 200; // ms
+
+  // -----------------------------------------------------------------------------------------------
+  KeyEvent keyEvent(uint16_t code, int32_t value) {
+    return KeyEvent{ DeviceInputEvent(EV_MSC, MSC_SCAN, code), DeviceInputEvent(EV_KEY, code, value) };
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  // Device frame of a key event at the given time (msecs), closed by a SYN_REPORT event.
+  std::vector<input_event> keyFrame(int64_t msecs, uint16_t code, int32_t value)
+  {
+    std::vector<input_event> frame(3);
+    frame[0].type = EV_MSC; frame[0].code = MSC_SCAN; frame[0].value = code;
+    frame[1].type = EV_KEY; frame[1].code = code; frame[1].value = value;
+    frame[2].type = EV_SYN; frame[2].code = SYN_REPORT; frame[2].value = 0;
+    for (auto& ie : frame) setEventTimeUsec(ie, msecs * 1000);
+    return frame;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  std::vector<input_event> mouseMoveFrame(int64_t msecs, int32_t x)
+  {
+    std::vector<input_event> frame(2);
+    frame[0].type = EV_REL; frame[0].code = REL_X; frame[0].value = x;
+    frame[1].type = EV_SYN; frame[1].code = SYN_REPORT; frame[1].value = 0;
+    for (auto& ie : frame) setEventTimeUsec(ie, msecs * 1000);
+    return frame;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  QStringList toStrings(const std::vector<InputRecording::Event>& events)
+  {
+    QStringList list;
+    for (const auto& e : events) {
+      list.push_back(QString("%1:%2:%3").arg(e.type).arg(e.code).arg(e.value));
+    }
+    return list;
+  }
+
+  // -----------------------------------------------------------------------------------------------
+  QStringList toStrings(const std::vector<std::vector<DeviceInputEvent>>& frames)
+  {
+    QStringList list;
+    for (const auto& frame : frames) {
+      for (const auto& e : frame) list.push_back(QString("%1:%2:%3").arg(e.type).arg(e.code).arg(e.value));
+    }
+    return list;
+  }
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+class InputReplayTest : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void replayEmitsMappedAndForwardedEvents();
+  void replayIsDeterministic();
+
+private:
+  QString recordFrames(const QTemporaryDir& dir);
+  InputMapConfig config() const;
+};
+
+// -------------------------------------------------------------------------------------------------
+QString InputReplayTest::recordFrames(const QTemporaryDir& dir)
+{
+  const std::vector<std::vector<input_event>> frames = {
+    keyFrame(0, KEY_A, 1),       // mapped sequence A: Valid
+    keyFrame(50, KEY_A, 0),      // ... Hit, Alt+Tab
+    mouseMoveFrame(100, 5),      // forwarded without input mapping
+    keyFrame(200, KEY_C, 1),     // first half of the mapped sequence C, C
+    keyFrame(250, KEY_C, 0),
+    keyFrame(1000, KEY_B, 1),    // sequence C timed out before, C is forwarded; B is not mapped
+    keyFrame(1050, KEY_B, 0),
+  };
+
+  const QString path = dir.filePath("input.pjrec");
+  InputRecording::Recorder recorder;
+  if (!recorder.open(path)) return QString();
+  for (const auto& frame : frames) {
+    recorder.record(frame.data(), frame.size());
+  }
+  recorder.close();
+  return path;
+}
+
+// -------------------------------------------------------------------------------------------------
+InputMapConfig InputReplayTest::config() const
+{
+  InputMapConfig config;
+  config.emplace(KeyEventSequence{ keyEvent(KEY_A, 1), keyEvent(KEY_A, 0) },
+                 MappedAction{ std::make_shared<KeySequenceAction>(NativeKeySequence::predefined::altTab()) });
+  config.emplace(KeyEventSequence{ keyEvent(KEY_C, 1), keyEvent(KEY_C, 0), keyEvent(KEY_C, 1), keyEvent(KEY_C, 0) },
+                 MappedAction{ std::make_shared<KeySequenceAction>(NativeKeySequence::predefined::altF4()) });
+  return config;
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputReplayTest::replayEmitsMappedAndForwardedEvents()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  const auto path = recordFrames(dir);
+  QVERIFY(!path.isEmpty());
+
+  InputRecording::File recording;
+  QVERIFY2(recording.open(path), qPrintable(recording.errorString()));
+  QCOMPARE(recording.size(), size_t(20));
+
+  const auto result = InputRecording::replay(recording, config(), keyEventInterval);
+  QVERIFY2(result.ok, qPrintable(result.errorString));
+  QCOMPARE(result.frames, uint64_t(7));
+  QCOMPARE(result.mouseMoveFrames, uint64_t(1));
+
+  const std::vector<std::vector<DeviceInputEvent>> expected = {
+    // Alt+Tab for sequence A
+    { {EV_KEY, KEY_LEFTALT, 1}, {EV_KEY, KEY_TAB, 1}, {EV_SYN, SYN_REPORT, 0} },
+    { {EV_KEY, KEY_LEFTALT, 0}, {EV_KEY, KEY_TAB, 0}, {EV_SYN, SYN_REPORT, 0} },
+    // mouse move
+    { {EV_REL, REL_X, 5}, {EV_SYN, SYN_REPORT, 0} },
+    // incomplete sequence C after the timeout
+    { {EV_MSC, MSC_SCAN, KEY_C}, {EV_KEY, KEY_C, 1}, {EV_SYN, SYN_REPORT, 0} },
+    { {EV_MSC, MSC_SCAN, KEY_C}, {EV_KEY, KEY_C, 0}, {EV_SYN, SYN_REPORT, 0} },
+    // unmapped B
+    { {EV_MSC, MSC_SCAN, KEY_B}, {EV_KEY, KEY_B, 1}, {EV_SYN, SYN_REPORT, 0} },
+    { {EV_MSC, MSC_SCAN, KEY_B}, {EV_KEY, KEY_B, 0}, {EV_SYN, SYN_REPORT, 0} },
+  };
+  QCOMPARE(toStrings(result.emitted), toStrings(expected));
+}
+
+// -------------------------------------------------------------------------------------------------
+void InputReplayTest::replayIsDeterministic()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  const auto path = recordFrames(dir);
+  QVERIFY(!path.isEmpty());
+
+  InputRecording::File recording;
+  QVERIFY(recording.open(path));
+
+  const auto first = InputRecording::replay(recording, config(), keyEventInterval);
+  const auto second = InputRecording::replay(recording, config(), keyEventInterval);
+  QVERIFY(first.ok && second.ok);
+  QCOMPARE(toStrings(first.emitted), toStrings(second.emitted));
+}
+
+QTEST_GUILESS_MAIN(InputReplayTest)
+#include "inputreplay-test.moc"
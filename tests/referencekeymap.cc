@@ -0,0 +1,119 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#include "referencekeymap.h"
+
+#include <algorithm>
+
+#include <linux/input.h>
+
+namespace {
+  // -----------------------------------------------------------------------------------------------
+  size_t maxSequenceLength(const InputMapConfig& config)
+  {
+    const auto max = std::max_element(config.cbegin(), config.cend(),
+    [](const auto& a, const auto& b){
+      return a.first.size() < b.first.size();
+    });
+
+    return ((max == config.cend()) ? 0 : max->first.size());
+  }
+} // --- end anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+ReferenceKeyMap::Result ReferenceKeyMap::feed(const struct input_event input_events[], size_t num)
+{
+  if (!hasConfig()) return Result::Miss;
+
+  const KeyEvent ke(input_events, input_events + num);
+
+  if (m_pos == nullptr)
+  {
+    const auto find_it = m_keymaps[0].find(ke);
+    if (find_it == m_keymaps[0].cend()) return Result::Miss;
+    m_pos = &(*find_it);
+  }
+  else
+  {
+    if (!m_pos->second) return Result::Miss;
+
+    const auto& set = m_pos->second->next_events;
+    const auto find_it = std::find_if(set.cbegin(), set.cend(), [&ke](RefPair const* next_ptr) {
+      return next_ptr->first == ke;
+    });
+
+    if (find_it == set.cend()) return Result::Miss;
+
+    m_pos = (*find_it);
+  }
+
+  // Last KeyEvent in possible sequence...
+  if (!m_pos->second || m_pos->second->next_events.empty()) {
+    return Result::Hit;
+  }
+
+  // KeyEvent in Sequence has action attached, but there are other possible sequences...
+  if (m_pos->second->action && !m_pos->second->action->empty()) {
+    return Result::PartialHit;
+  }
+
+  return Result::Valid;
+}
+
+// -------------------------------------------------------------------------------------------------
+const Action* ReferenceKeyMap::action() const
+{
+  return (m_pos && m_pos->second) ? m_pos->second->action.get() : nullptr;
+}
+
+// -------------------------------------------------------------------------------------------------
+void ReferenceKeyMap::resetState()
+{
+  m_pos = nullptr;
+}
+
+// -------------------------------------------------------------------------------------------------
+void ReferenceKeyMap::reconfigure(const InputMapConfig& config)
+{
+  m_keymaps.resize(maxSequenceLength(config));
+
+  // -- clear maps + state
+  resetState();
+  for (auto& synKeyEventMap : m_keymaps) { synKeyEventMap.clear(); }
+
+  // -- fill maps
+  for (const auto& item: config)
+  {
+    if (!item.second.action || item.second.action->empty()) continue;
+
+    const auto& kes = item.first;
+    for (size_t i = 0; i < kes.size(); ++i) {
+      m_keymaps[i].emplace(kes[i], nullptr);
+    }
+  }
+
+  // -- fill references
+  for (const auto& item: config)
+  {
+    if (!item.second.action || item.second.action->empty()) continue;
+
+    const auto& kes = item.first;
+    for (size_t i = 0; i < kes.size(); ++i)
+    {
+      const auto r = m_keymaps[i].equal_range(kes[i]);
+      if (r.first == r.second) continue;
+      auto& refobj = r.first->second;
+      if (!refobj) {
+        refobj = std::make_unique<Next>();
+      }
+
+      if (i == kes.size() - 1) { // last keyevent in seq
+        refobj->action = item.second.action;
+      }
+      else if (i+1 < m_keymaps.size()) // if not last keyevent in seq
+      {
+        const auto r = m_keymaps[i+1].equal_range(kes[i+1]);
+        if (r.first == r.second) continue;
+        refobj->next_events.emplace(&(*r.first));
+      }
+    }
+  }
+}
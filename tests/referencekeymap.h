@@ -0,0 +1,45 @@
+// This file is part of Projecteur - https://github.com/jahnf/projecteur - See LICENSE.md and README.md
+#pragma once
+
+#include "devicekeymap.h"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+// -------------------------------------------------------------------------------------------------
+/// The key sequence matcher that DeviceKeyMap used before the configuration was compiled into a
+/// flat automaton: one std::map of key events per sequence position, with sets of references to
+/// the possible next key events. Only used by tests as reference for the results of DeviceKeyMap.
+class ReferenceKeyMap
+{
+public:
+  using Result = DeviceKeyMap::Result;
+
+  ReferenceKeyMap(const InputMapConfig& config = {}) { reconfigure(config); }
+
+  Result feed(const struct input_event input_events[], size_t num);
+
+  // Action of the current position, nullptr if there is none.
+  const Action* action() const;
+  void resetState();
+  void reconfigure(const InputMapConfig& config = {});
+  bool hasConfig() const { return m_keymaps.size(); }
+
+private:
+  struct Next;
+  // Map of Key event and the next possible key events.
+  using SynKeyEventMap = std::map<const KeyEvent, std::unique_ptr<Next>>;
+  using RefPair = SynKeyEventMap::value_type;
+  // Set of references to the next possible key event.
+  using RefSet = std::set<const RefPair*>;
+
+  struct Next {
+    std::shared_ptr<Action> action;
+    RefSet next_events;
+  };
+
+  const RefPair* m_pos = nullptr;
+  std::vector<SynKeyEventMap> m_keymaps;
+};